@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include "notify_dispatch.h"
+
+// Samples kept per channel; a minute at the fastest notify rate we see on packs (~4 Hz)
+#define BATTERY_TREND_CAPACITY 256
+#define BATTERY_TREND_CHANNELS 4
+#define BATTERY_TREND_DURATION_MS 60000
+#define BATTERY_TREND_POLL_MS 1000
+#define BATTERY_TREND_REPORT_MS 10000
+
+struct TrendSample {
+  uint32_t timeMs;
+  float value;
+};
+
+// Running statistics, updated per sample without a pass over stored data
+struct TrendStats {
+  uint32_t count;
+  float min;
+  float max;
+  double mean;
+  // Least-squares accumulators, t in seconds since capture start
+  double sumT, sumV, sumTT, sumTV;
+
+  double slopePerMinute() const;
+};
+
+// Fixed ring of samples plus running statistics for one characteristic
+class TrendChannel {
+public:
+  void reset(const char* name, const String& unit, uint32_t startMs);
+  void add(uint32_t timeMs, float value);
+
+  const char* name;
+  String unit;
+  TrendStats stats;
+  TrendSample samples[BATTERY_TREND_CAPACITY];
+  uint16_t head;  // next write position
+
+private:
+  uint32_t startMs;
+};
+
+// Battery test mode: subscribes to Battery Level (0x2A19) and any characteristic whose CPF unit
+// is volts or amperes, polls the ones that cannot notify, and reports a trend summary.
+class BatteryTrend {
+public:
+  // Runs on the GATT task. loop() leaves the capture alone until the worker is idle again,
+  // and notifications reach it only after start() has subscribed, its last step.
+  bool start(BLEClient* client);
+  // Call from loop(). Polls, prints periodic summaries and finishes after the capture window.
+  void update(bool connected);
+  void stop();
+  bool active() const { return running; }
+
+private:
+  struct Source {
+    BLERemoteCharacteristic* characteristic;
+    bool isLevel;
+    bool polled;
+    uint8_t format;
+    int8_t exponent;
+  };
+
+  void addSource(BLERemoteCharacteristic* pChar, bool isLevel, uint8_t format, int8_t exponent,
+                 uint16_t unitUUID);
+  void onNotify(BLERemoteCharacteristic* pChar, const NotifyEvent& event);
+  bool decodeSample(const Source& source, const std::string& raw, float& value);
+  void printSummary(bool final);
+
+  Source sources[BATTERY_TREND_CHANNELS];
+  TrendChannel channels[BATTERY_TREND_CHANNELS];
+  uint8_t channelCount = 0;
+  bool running = false;
+  uint32_t startMs = 0;
+  uint32_t lastPollMs = 0;
+  uint32_t lastReportMs = 0;
+};
+
+extern BatteryTrend batteryTrend;
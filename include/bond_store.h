@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <BLESecurity.h>
+
+// Bluedroid's bond storage (CONFIG_BT_SMP_MAX_BONDS); pairing fails once it is full
+#define BOND_STORE_MAX 15
+#define BOND_PAIRING_TIMEOUT_MS 10000
+#define BOND_RESUME_TIMEOUT_MS 1000
+
+// How the link of a session was secured; travels in ConnectTiming
+enum LinkSecurity : uint8_t {
+  SECURITY_NONE = 0,     // not attempted (link reused)
+  SECURITY_RESUMED = 1,  // encrypted with the LTK stored at pairing
+  SECURITY_PAIRED = 2,   // paired and bonded on this connect
+  SECURITY_FAILED = 3
+};
+
+const char* linkSecurityName(uint8_t security);
+
+// Bonds with the units so the Control Register, which production firmware only serves over
+// an encrypted link, is reachable. The keys stay in the stack's NVS bond storage, keyed by
+// identity address; this table tracks which units have one and when each was last used.
+// A bonded unit is re-encrypted with its stored LTK in a few connection events instead of
+// being paired again, which takes seconds. When storage is full the least recently used
+// bond makes room. The IRK of each bond goes to rpaResolver, so units that advertise
+// resolvable private addresses are still recognised.
+//
+// secure() runs on the GATT task; the table is only changed there.
+class BondStore {
+public:
+  // Security parameters and callbacks; must follow BLEDevice::init()
+  void begin();
+  LinkSecurity secure(BLEClient* client);
+  // Drops the bond of one unit, or every bond for a null address
+  void forget(const uint8_t* address);
+  void printStats();
+
+  // BLE host task
+  void onAuthComplete(const esp_ble_auth_cmpl_t& result);
+
+private:
+  struct Bond {
+    uint8_t address[6];
+    uint32_t lastUsed;  // useClock value; 0 for bonds found in storage at boot
+    uint32_t resumes;
+  };
+
+  int loadKeys(esp_ble_bond_dev_t* stored);
+  void adoptStored();
+  bool encrypt(esp_bd_addr_t address, uint32_t timeoutMs, BLEClient* client);
+  Bond* find(const uint8_t* address);
+  void remove(Bond* bond);
+  void evictOldest();
+
+  Bond bonds[BOND_STORE_MAX];
+  size_t count = 0;
+  uint32_t useClock = 0;
+
+  volatile bool authSuccess = false;
+  volatile uint8_t authReason = 0;
+
+  uint32_t pairings = 0;
+  uint32_t resumes = 0;
+  uint32_t keyMissing = 0;  // stored key the unit no longer had; paired again
+  uint32_t evictions = 0;
+  uint32_t failures = 0;
+  uint64_t pairingMsTotal = 0;
+  uint64_t resumeMsTotal = 0;
+};
+
+extern BondStore bondStore;
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <map>
+#include <string>
+
+// The session client plus the two the fleet audit alternates between
+#define CLIENT_POOL_SIZE 3
+#define CLIENT_TEARDOWN_MS 3000
+#define CONNECT_STATS_MAX 32  // units whose connect latency is kept
+
+// Where the time went between choosing a unit and having its services; travels from the
+// GATT task to loop() in the RECORD_CONNECTED data
+struct ConnectTiming {
+  uint32_t queuedMs;     // chosen -> GATT task starts the connect (includes a pending connect)
+  uint32_t linkMs;       // connect request -> link up
+  uint32_t securityMs;   // encryption, from a stored bond or by pairing
+  uint32_t discoveryMs;  // service discovery
+  uint8_t security;      // LinkSecurity
+};
+
+// BLE clients are created once and reused: Bluedroid keeps per-client state, deleting a
+// client right after its disconnect races the host task, and every delete/new pair also
+// leaked the callbacks object. acquire()/release() run on whichever side owns the client:
+// the GATT task while it has work, loop() otherwise.
+//
+// The connect latency table is loop()-side only.
+class ClientPool {
+public:
+  // An idle client with `callbacks` installed (null for none). Created on first use;
+  // when every client is closing, waits for one to finish. Null when all are taken.
+  BLEClient* acquire(BLEClientCallbacks* callbacks);
+  // Starts the disconnect if the link is up; no callback fires for this use any more
+  void release(BLEClient* client);
+  bool waitForTeardown(BLEClient* client, uint32_t timeoutMs = CLIENT_TEARDOWN_MS);
+
+  void recordConnect(const std::string& address, const ConnectTiming& timing);
+  void printStats();
+
+private:
+  struct Entry {
+    BLEClient* client;
+    bool taken;
+  };
+
+  struct Latency {
+    uint32_t count;
+    uint32_t lastMs;
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint32_t sumMs;
+    ConnectTiming last;
+  };
+
+  Entry entries[CLIENT_POOL_SIZE] = {};
+  size_t created = 0;
+  uint32_t acquired = 0;
+  uint32_t teardownWaits = 0;
+  std::map<std::string, Latency> latency;
+};
+
+extern ClientPool clientPool;
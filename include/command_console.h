@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <string>
+
+// Receive buffer: one whole text line, or one RPC frame (4 + 255 + 1 bytes) with room to spare
+#define CONSOLE_RX_SIZE 320
+#define CONSOLE_MAX_ARGS 8
+#define CONSOLE_FRAME_SYNC 0xA5  // same framing as the device list export
+#define CONSOLE_FRAME_MAX 255    // payload bytes per frame
+#define CONSOLE_OPCODE_EXIT 0x00 // RPC request: back to text mode
+
+// Frames sent in RPC mode; the device list export uses types 0-3 on the same link
+enum ConsoleFrameType : uint8_t {
+  FRAME_RESULT = 0x10,  // seq = request id; payload: opcode status data...
+  FRAME_TEXT = 0x11,    // seq = request id; console text produced while handling it
+  FRAME_NOTIFY = 0x12   // seq = running count; payload: handle(le16) value...
+};
+
+enum ConsoleStatus : uint8_t {
+  STATUS_OK = 0,
+  STATUS_BAD_ARGS = 1,
+  STATUS_BAD_STATE = 2,   // not connected, scan running, session busy
+  STATUS_NOT_FOUND = 3,   // no such device or characteristic
+  STATUS_GATT_ERROR = 4,
+  STATUS_BUSY = 5,        // another request is still waiting for its result
+  STATUS_UNKNOWN = 6,     // no such command or opcode
+  STATUS_BAD_FRAME = 7,   // checksum or argument encoding wrong
+  STATUS_PENDING = 0xFF   // handler return only: the result follows through complete()
+};
+
+// One argument, pointing into the receive buffer; valid until the handler returns
+struct ConsoleArg {
+  const char* data;
+  uint8_t length;
+
+  bool is(const char* word) const;  // case-insensitive
+  long toInt() const;
+  std::string str() const { return std::string(data, length); }
+};
+
+// A parsed command line or RPC frame. argv[0] is the command name in both modes.
+struct ConsoleRequest {
+  bool binary;
+  uint8_t id;      // RPC request id, echoed in the result
+  uint8_t opcode;  // 0 for text commands without an RPC opcode
+  uint8_t argc;
+  ConsoleArg argv[CONSOLE_MAX_ARGS];
+
+  // Argument as raw bytes: hex digits in text mode, taken as is in RPC mode
+  size_t bytes(uint8_t index, uint8_t* out, size_t capacity) const;
+};
+
+typedef uint8_t (*ConsoleHandler)(const ConsoleRequest& request);
+
+struct ConsoleCommand {
+  const char* name;
+  uint8_t opcode;  // 0: text alias only
+  ConsoleHandler handler;
+  const char* usage;
+};
+
+// Command interpreter on the USB serial console. Text mode takes one command per line for
+// people; "rpc" switches to length-prefixed frames for station scripts:
+//
+//   request  A5 | opcode | id | length | args | xor of opcode..args
+//   args     argLength arg argLength arg ...   (the same words as in text mode)
+//
+// Every request gets exactly one RESULT frame with its id. Handlers that need the GATT
+// task return STATUS_PENDING and the result follows when the work is done. Console text
+// a handler prints through consoleOut comes back in TEXT frames first. So does text printed
+// outside a handler, such as test plan progress, while a request is pending; with none
+// pending it is dropped. Nothing but frames reaches the link in RPC mode.
+//
+// Bytes are read from the UART in bulk into one buffer and parsed in place: arguments are
+// views into it, so neither mode copies or allocates per command.
+class CommandConsole {
+public:
+  // `fallback` gets text lines whose first word is not a command (device numbers)
+  void begin(const ConsoleCommand* table, size_t count, ConsoleHandler fallback);
+  void poll();
+
+  // Finishes the request whose handler returned STATUS_PENDING
+  void complete(uint8_t status, const uint8_t* data = nullptr, size_t length = 0);
+  bool pending() const { return waiting; }
+  bool rpcMode() const { return binary; }
+
+  // Value from a characteristic subscribed through the console
+  void notify(BLEUUID uuid, uint16_t handle, const uint8_t* data, size_t length);
+
+  void printHelp();
+  void printStats();
+
+private:
+  class TextFrames : public Print {
+  public:
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* data, size_t length) override;
+    uint8_t id = 0;
+  };
+
+  class NoText : public Print {
+  public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t*, size_t length) override { return length; }
+  };
+
+  size_t parseLine(size_t start);
+  size_t parseFrame(size_t start);
+  void run(ConsoleRequest& request);
+  const ConsoleCommand* find(const ConsoleArg& name) const;
+  const ConsoleCommand* find(uint8_t opcode) const;
+  // Points consoleOut at whatever should get text printed outside a handler right now
+  void restoreSink();
+  void sendFrame(uint8_t type, uint8_t seq, const uint8_t* head, size_t headLength, const uint8_t* data,
+                 size_t length);
+  void sendResult(uint8_t id, uint8_t opcode, uint8_t status, const uint8_t* data, size_t length);
+
+  const ConsoleCommand* commands = nullptr;
+  size_t commandCount = 0;
+  ConsoleHandler unmatched = nullptr;
+
+  char rx[CONSOLE_RX_SIZE];
+  size_t rxLength = 0;
+  bool binary = false;
+  bool discarding = false;  // text line overflowed; skip to its end
+
+  bool waiting = false;
+  bool waitingBinary = false;
+  uint8_t waitingId = 0;
+  uint8_t waitingOpcode = 0;
+  TextFrames textFrames;
+  NoText noText;
+  uint8_t notifySequence = 0;
+
+  uint32_t textCommands = 0;
+  uint32_t rpcRequests = 0;
+  uint32_t badFrames = 0;
+  uint32_t overflows = 0;
+  uint32_t bytesIn = 0;
+  size_t rxHighWater = 0;
+};
+
+extern CommandConsole commandConsole;
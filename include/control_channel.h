@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+#define CONTROL_QUEUE_DEPTH 32
+#define CONTROL_MAX_PAYLOAD 20
+#define CONTROL_DEFAULT_TIMEOUT_MS 1000
+#define CONTROL_DEFAULT_RETRIES 2
+
+// How a control register write is confirmed
+enum ControlConfirm : uint8_t {
+  CONFIRM_NONE = 0,       // write without response; consecutive ones are pipelined and only
+                          // the last of the batch can be read back
+  CONFIRM_RESPONSE = 1,   // write with response
+  CONFIRM_READBACK = 2,   // write with response, then read the register back and compare
+  CONFIRM_INDICATION = 3  // write with response, then wait for an indication echoing the value
+};
+
+struct ControlCommand {
+  const char* name;
+  uint8_t data[CONTROL_MAX_PAYLOAD];
+  uint8_t length;
+  ControlConfirm confirm;
+  uint8_t retries;
+  uint16_t timeoutMs;
+};
+
+enum ControlOutcome : uint8_t {
+  CONTROL_FAILED = 0,
+  CONTROL_OK = 1,
+  CONTROL_UNCONFIRMED = 2  // pipelined, and overwritten by a later write before it could be read back
+};
+
+struct ControlResult {
+  const char* name;
+  ControlOutcome outcome;
+  uint8_t attempts;
+  uint32_t latencyUs;  // first write to confirmation (pipelined commands share the batch time)
+};
+
+ControlCommand makeControlCommand(const char* name, const uint8_t* data, uint8_t length,
+                                  ControlConfirm confirm = CONFIRM_RESPONSE);
+
+// Queued, verified command layer over the Control Register characteristic
+class ControlChannel {
+public:
+  // Resolves the Control Register on the connected client; subscribes to indications if offered
+  bool attach(BLEClient* client);
+  void detach();
+  bool enqueue(const ControlCommand& command);
+  // Executes every queued command in order. Returns the number of failed commands;
+  // unconfirmed ones are not counted.
+  size_t run();
+  void printResults();
+  size_t lastResultCount() const { return resultCount; }
+  const ControlResult& lastResult(size_t i) const { return results[i]; }
+
+private:
+  bool writeAndConfirm(const ControlCommand& command);
+  bool readBackMatches(const ControlCommand& command, uint32_t waitMs);
+  size_t runPipelined(size_t first);
+  void onIndication(uint8_t* data, size_t length);
+
+  BLEClient* client = nullptr;
+  BLERemoteCharacteristic* controlReg = nullptr;
+  bool canPipeline = false;
+  bool canIndicate = false;
+
+  ControlCommand queue[CONTROL_QUEUE_DEPTH];
+  ControlResult results[CONTROL_QUEUE_DEPTH];
+  size_t queued = 0;
+  size_t resultCount = 0;
+
+  SemaphoreHandle_t indicationDone = nullptr;  // given from the BLE host task
+  uint8_t indication[CONTROL_MAX_PAYLOAD];
+  volatile size_t indicationLength = 0;
+};
+
+extern ControlChannel controlChannel;
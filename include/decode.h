@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <map>
+#include <string>
+
+// Unit mapping for CPF descriptor (unit UUID -> unit string)
+extern std::map<uint16_t, String> unitMap;
+
+// Service/characteristic names by UUID string; getUuidName falls back to the UUID itself
+extern std::map<std::string, std::string> uuidNames;
+String getUuidName(BLEUUID uuid);
+
+// IEEE-11073 reserved values; everything else is DECIMAL_FINITE
+enum DecimalSpecial : uint8_t {
+  DECIMAL_FINITE,
+  DECIMAL_NAN,
+  DECIMAL_NRES,      // not at this resolution
+  DECIMAL_POS_INF,
+  DECIMAL_NEG_INF,
+  DECIMAL_RESERVED
+};
+
+// A decoded value, mantissa * 10^exponent. Integers and IEEE-11073 values are exact and
+// keep the CPF's precision (2150 with exponent -2 prints as 21.50); float32 keeps 7
+// significant digits. The ESP32-S3 has no double FPU, so values stay integers from
+// decode through range checks to formatting.
+struct DecimalValue {
+  int64_t mantissa = 0;
+  int8_t exponent = 0;
+  DecimalSpecial special = DECIMAL_FINITE;
+
+  bool finite() const { return special == DECIMAL_FINITE; }
+};
+
+// Decode raw binary data using CPF descriptor parameters: boolean, integers of 16 to 48
+// bits, uint128 (to 18 digits), float32 and IEEE-11073 SFLOAT/FLOAT.
+// Returns false for formats that are not handled.
+bool decodeDecimal(const std::string& rawValue, uint8_t format, int8_t exponent, DecimalValue& value);
+
+// The value in units of 10^exponent, truncated toward zero and saturated to int64;
+// +/-INF saturate, the other special values give 0
+int64_t decimalAt(const DecimalValue& value, int exponent);
+
+// For the captures, which keep float samples; NaN and NRes give NaN
+float decimalToFloat(const DecimalValue& value);
+
+// Exact text of the value at its own precision, followed by `unit`; special values by name
+String formatDecimal(const DecimalValue& value, const char* unit = "");
+
+// Size in bytes of a value in a CPF format, 0 for formats whose values vary in length
+uint8_t cpfValueSize(uint8_t format);
+
+// Convert raw binary data using CPF descriptor parameters; "" when the format is not handled
+String convertRawValue(const std::string& rawValue, uint8_t format, int8_t exponent, uint16_t unitUUID);
+
+// Fallback conversion: attempt ASCII, otherwise decimal bytes.
+String fallbackConvert(const std::string& rawValue);
+
+// Read a characteristic's CPF descriptor. Returns false when it has none (or it is malformed).
+bool readCpf(BLERemoteCharacteristic* pChar, uint8_t& format, int8_t& exponent, uint16_t& unitUUID);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define DECODE_BENCH_ROUNDS 2000
+
+// Times the fixed-point value path against the double path it replaced: decode, range
+// check and formatting of a corpus of unit readings, in ns per value. Runs in place on
+// the calling task; host time on native builds, so the simulated clock does not count.
+void runDecodeBench(uint32_t rounds);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <functional>
+#include <map>
+#include <string>
+
+#define DEVICE_RSSI_HYSTERESIS 6  // dB a device must move before its RSSI is re-reported
+#define DEVICE_FRAME_SYNC 0xA5
+#define DEVICE_FRAME_MAX 48
+#define DEVICE_NAME_MAX 29
+
+// Delta frame types for the dashboard export
+enum DeviceDeltaType : uint8_t {
+  DELTA_RESET = 0,  // drop the current view; one NEW per listed device follows
+  DELTA_NEW = 1,
+  DELTA_RSSI = 2,
+  DELTA_LOST = 3
+};
+
+// Strongest first; values point at the keys of DeviceList::entries, which never move
+typedef std::multimap<int, const std::string*, std::greater<int>> RssiOrder;
+
+struct DeviceEntry {
+  BLEAdvertisedDevice* device;  // last advert, so the address it is connected by is current
+  int rssi;            // last reported RSSI, which is also the sort key
+  uint32_t scan;       // last scan the device was heard in
+  RssiOrder::iterator rank;
+};
+
+// Devices matching the target prefix, kept across scans, one entry per unit: a bonded unit
+// advertising resolvable private addresses is listed under its identity address, however
+// often it renews them. Each advertisement updates one entry and its place in the RSSI
+// order; only changes are exported:
+//   NEW   first time a device is heard
+//   RSSI  the reported RSSI moved by DEVICE_RSSI_HYSTERESIS or more
+//   LOST  the device was not heard in a completed scan
+//
+// Frame: A5 | type | seq | length | payload | xor of type..payload
+//   NEW   address[6] addressType rssi nameLength name   (address: the listed one, addressType:
+//         the advertised one)
+//   RSSI  address[6] rssi
+//   LOST  address[6]
+//   RESET deviceCount
+//
+// Adverts arrive on the BLE host task while loop() lists and picks devices, so a mutex
+// covers every access: lookups hand out copies, and the ranked walk runs under it.
+class DeviceList {
+public:
+  void begin();
+  void beginScan();
+  bool seen(BLEAdvertisedDevice& device);  // true when the device is new to the list
+  void endScan();
+  void clear();
+
+  size_t size();
+  // Calls `row` for every device, strongest first, with the list locked
+  void forEachRanked(const std::function<void(const std::string& address, const DeviceEntry& entry)>& row);
+  bool at(size_t index, BLEAdvertisedDevice& copy);  // 0 is the strongest
+  // By listed address, or by any resolvable private address of a bonded unit
+  bool find(const std::string& address, BLEAdvertisedDevice* copy = nullptr);
+  // The address a unit is listed under: its identity when `address` resolves to one
+  std::string unitAddress(BLEAddress address, uint8_t addressType);
+
+  // Frames go to `sink` while export is on; enabling it sends the full list first
+  void setExport(Print* exportSink);
+  void resync();
+  void printStats();
+
+private:
+  void emit(DeviceDeltaType type, const std::string& address, const DeviceEntry* entry);
+  void lock();
+  void unlock();
+
+  std::map<std::string, DeviceEntry> entries;
+  RssiOrder order;
+  uint32_t scanNumber = 0;
+  Print* sink = nullptr;
+  uint8_t sequence = 0;
+  uint32_t framesSent = 0;
+  uint32_t bytesSent = 0;
+  uint32_t updatesSuppressed = 0;  // RSSI changes inside the hysteresis band
+  SemaphoreHandle_t mutex = nullptr;
+};
+
+extern DeviceList deviceList;
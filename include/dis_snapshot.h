@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+// Field bits for DisSnapshot::presentMask and for selecting what readDisSnapshot() reads
+enum DisField : uint16_t {
+  DIS_MANUFACTURER = 1 << 0,  // 0x2A29
+  DIS_MODEL = 1 << 1,         // 0x2A24
+  DIS_SERIAL = 1 << 2,        // 0x2A25
+  DIS_HARDWARE_REV = 1 << 3,  // 0x2A27
+  DIS_FIRMWARE_REV = 1 << 4,  // 0x2A26
+  DIS_SOFTWARE_REV = 1 << 5,  // 0x2A28
+  DIS_SYSTEM_ID = 1 << 6,     // 0x2A23
+  DIS_PNP_ID = 1 << 7,        // 0x2A50
+  DIS_ALL = 0xFF
+};
+
+// Fixed-size Device Information record. Strings are NUL-padded (truncated if longer).
+struct __attribute__((packed)) DisSnapshot {
+  char manufacturer[24];
+  char model[24];
+  char serial[24];
+  char hardwareRev[16];
+  char firmwareRev[16];
+  char softwareRev[16];
+  uint8_t systemId[8];
+  uint8_t pnpId[7];
+  uint16_t presentMask;
+  uint32_t unitHash;    // every field: identifies one physical unit in one state
+  uint32_t configHash;  // manufacturer, model and revisions: identifies a firmware config
+};
+
+// Reads the selected DIS characteristics in a single pass over the service and hashes the result
+bool readDisSnapshot(BLERemoteService* dis, DisSnapshot& snapshot, uint16_t fields = DIS_ALL);
+
+// Records the snapshot's strings with the expectation checker
+void recordDisSnapshot(const DisSnapshot& snapshot);
+
+void printDisSnapshot(const DisSnapshot& snapshot);
+// Prints the fields that differ between two snapshots of the same unit
+void printDisDiff(const DisSnapshot& before, const DisSnapshot& after);
+
+uint32_t fnv1a(const void* data, size_t length, uint32_t hash = 2166136261UL);
+
+#define DIS_REGISTRY_SIZE 32
+
+// Recently tested units and firmware configs, used to dedupe and short-circuit repeat tests
+class DisRegistry {
+public:
+  // Previous snapshot with the same serial number (or nullptr)
+  const DisSnapshot* findUnit(const DisSnapshot& snapshot);
+  // Number of units of this firmware config that passed, or -1 if one failed
+  int configPasses(uint32_t configHash);
+  void remember(const DisSnapshot& snapshot, bool pass);
+
+private:
+  struct Entry {
+    DisSnapshot snapshot;
+    bool pass;
+  };
+  Entry entries[DIS_REGISTRY_SIZE];
+  size_t count = 0;
+  size_t next = 0;
+};
+
+extern DisRegistry disRegistry;
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include "decode.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Range checks compare integers in millionths; finer digits of a value are truncated
+#define EXPECT_EXPONENT -6
+
+// Kind of check applied to a characteristic value
+enum ExpectKind : uint8_t {
+  EXPECT_RANGE = 0,    // min <= value <= max
+  EXPECT_ENUM = 1,     // integer value is one of the bits set in enumMask (values 0..63)
+  EXPECT_PATTERN = 2   // text matches a glob pattern ('*' and '?')
+};
+
+// One limit as written by a station engineer. Matched by characteristic UUID, or by
+// CPF unit when uuid is null (a class default such as "every °C reading").
+struct ExpectationSpec {
+  const char* name;
+  const char* uuid;
+  uint16_t unit;
+  ExpectKind kind;
+  double min;
+  double max;
+  uint64_t enumMask;
+  const char* pattern;
+};
+
+// Result of evaluating one test session
+struct SessionVerdict {
+  bool pass;
+  uint16_t checked;
+  uint16_t failed;
+  uint32_t evalMicros;
+};
+
+// Pass/fail evaluator. The spec table is compiled once into flat per-slot arrays; a session
+// records values into contiguous arrays which are then checked in a single pass.
+class ExpectationChecker {
+public:
+  // Builds the slot tables. Pass nullptr to use the built-in station limits.
+  void compile(const ExpectationSpec* specs, size_t count);
+
+  void beginSession(const std::string& address);
+  // Records a value if any spec covers it. `number` is used when the value was decoded via
+  // its CPF descriptor; otherwise numeric specs read `raw` as a little-endian unsigned integer.
+  // NaN and NRes fail every numeric check.
+  void record(BLEUUID uuid, uint16_t unit, bool haveNumber, const DecimalValue& number, const std::string& raw);
+  SessionVerdict evaluate();
+  void printVerdict(const SessionVerdict& verdict);
+
+private:
+  int findSlot(BLEUUID& uuid, uint16_t unit);
+
+  // Compiled spec table, indexed by slot
+  std::map<std::string, uint8_t> slotByUuid;
+  std::map<uint16_t, uint8_t> slotByUnit;
+  std::vector<const char*> slotName;
+  std::vector<uint8_t> slotKind;
+  std::vector<int64_t> slotMin;  // at EXPECT_EXPONENT
+  std::vector<int64_t> slotMax;
+  std::vector<uint64_t> slotEnum;
+  std::vector<const char*> slotPattern;
+
+  // Per-session values, one entry per recorded characteristic
+  std::string sessionAddress;
+  std::vector<DecimalValue> numbers;  // as decoded, for the report
+  std::vector<int64_t> scaled;        // at EXPECT_EXPONENT; INT64_MIN for NaN and NRes
+  std::vector<uint8_t> numberSlot;
+  std::vector<uint8_t> numberOk;
+  std::vector<const char*> texts;  // copies in the session arena
+  std::vector<uint8_t> textSlot;
+  std::vector<uint8_t> textOk;
+};
+
+extern ExpectationChecker expectations;
+
+// Glob match supporting '*' (any run) and '?' (any single character)
+bool globMatch(const char* pattern, const char* text);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "device_list.h"
+
+#define FLEET_AUDIT_MAX_DEVICES 64
+
+enum AuditStatus : uint8_t {
+  AUDIT_OK = 0,
+  AUDIT_CONNECT_FAILED,
+  AUDIT_NO_DIS,
+  AUDIT_LINK_LOST
+};
+
+// One row of the audit table, fixed size so the whole fleet fits in a flat array
+struct AuditRow {
+  char address[18];
+  char name[16];
+  char model[24];
+  char firmware[16];
+  char software[16];
+  uint32_t configHash;  // DisSnapshot config hash over the fields read
+  uint16_t connectMs;
+  uint16_t totalMs;
+  AuditStatus status;
+};
+
+// Walks every device from a scan through connect -> Model/Firmware/Software Revision read ->
+// disconnect. Two clients alternate so the next connection is set up while the previous
+// link is still tearing down. run() is a GATT job; it publishes each finished row, and
+// loop() prints the rows and the table.
+class FleetAudit {
+public:
+  void run(DeviceList& devices);
+  void printRow(size_t index);
+  void printTable();
+
+private:
+  void auditOne(BLEClient* client, BLEAdvertisedDevice* device, AuditRow& row);
+
+  AuditRow rows[FLEET_AUDIT_MAX_DEVICES];
+  size_t rowCount = 0;
+  size_t deviceCount = 0;  // in the list when the run started
+  uint32_t elapsedMs = 0;
+};
+
+extern FleetAudit fleetAudit;
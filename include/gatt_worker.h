@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <atomic>
+#include "output.h"
+#include "spsc_queue.h"
+
+// Cores on the ESP32-S3: the Bluedroid host already runs on core 0, so the GATT work sits
+// next to it; loop() stays on core 1 for decode, evaluation, logging and serial output.
+#define GATT_TASK_CORE 0
+#define GATT_TASK_PRIORITY 3
+#define GATT_TASK_STACK 8192
+#define GATT_JOB_DEPTH 4
+#define SESSION_RECORD_DEPTH 32      // must be a power of two
+#define SESSION_RECORD_MAX_VALUE 64  // longer values are truncated in the record
+#define GATT_JOB_MAX_VALUE 20        // one ATT write at the default MTU
+#define GATT_TEXT_MAX 160            // longest console line the GATT task prints
+#define GATTC_HANDLERS_MAX 4
+
+// Work handed from loop() to the GATT task
+enum GattJobType : uint8_t {
+  JOB_SESSION,  // connect, discover, read every explored characteristic
+  JOB_CONTROL,  // write and confirm the Control Register
+  JOB_MODE,     // set up the selected test mode (subscriptions, captures, writes)
+  JOB_AUDIT,    // walk the device list reading firmware versions
+  JOB_READ,     // console requests on the current link, by characteristic UUID
+  JOB_WRITE,
+  JOB_SUBSCRIBE, // mode: 1 on, 0 off
+  JOB_POLL      // read whatever the monitoring schedule has due
+};
+
+// JOB_SESSION flags
+#define GATT_JOB_CONNECT_ONLY 0x01  // stop after discovery and keep the link for commands
+#define GATT_JOB_REUSE_LINK 0x02    // run the session on the link that is already up
+
+struct GattJob {
+  GattJobType type;
+  uint8_t mode = 0;
+  uint8_t flags = 0;
+  uint8_t addressType = 0;
+  char address[18] = "";
+  uint32_t chosenMs = 0;  // millis() when the unit was chosen
+  BLEUUID uuid;
+  uint8_t length = 0;
+  uint8_t data[GATT_JOB_MAX_VALUE];
+};
+
+// Results handed back from the GATT task to loop()
+enum SessionRecordType : uint8_t {
+  RECORD_CONNECT_FAILED,
+  RECORD_CONNECTED,     // link up and services discovered; flag = connect only, data = ConnectTiming
+  RECORD_SNAPSHOT,      // Device Information read into the worker's snapshot; flag = present
+  RECORD_SERVICE,       // the following values belong to `uuid`
+  RECORD_VALUE,         // one characteristic; flag = readable
+  RECORD_EXPLORED,      // every explored service has been read
+  RECORD_CONTROL_DONE,  // results are in controlChannel; flag = success
+  RECORD_MODE_DONE,     // flag = the test mode started, or its capture or sync succeeded
+  RECORD_AUDIT_ROW,     // fleetAudit has filled the row numbered data[0]
+  RECORD_AUDIT_DONE,
+  RECORD_REQUEST_DONE,  // console read/write/subscribe; status as ConsoleStatus, value in data
+  RECORD_POLL,          // one monitored value, with its CPF fields
+  RECORD_POLL_DONE,     // the JOB_POLL batch is read
+  RECORD_TEXT           // console text from the GATT task; status = OutputLevel, data = a piece of it
+};
+
+struct SessionRecord {
+  SessionRecordType type;
+  bool flag;
+  bool haveCpf;
+  uint8_t status;
+  uint8_t format;
+  int8_t exponent;
+  uint16_t unit;
+  uint16_t handle;  // attribute handle of a RECORD_VALUE or RECORD_POLL
+  uint16_t length;  // full value length; data holds at most SESSION_RECORD_MAX_VALUE bytes
+  BLEUUID uuid;
+  uint8_t data[SESSION_RECORD_MAX_VALUE];
+};
+
+typedef void (*GattJobHandler)(const GattJob& job);
+typedef void (*SessionRecordHandler)(const SessionRecord& record);
+
+// Owns the GATT task and the two rings between it and loop(). On native builds there is
+// no second task: poll() runs queued jobs inline before delivering their records.
+class GattWorker {
+public:
+  void begin(GattJobHandler jobHandler, SessionRecordHandler recordHandler);
+  bool post(const GattJob& job);
+  // GATT side: waits for room rather than dropping a value
+  void publish(const SessionRecord& record);
+  // GATT side: console text, published as RECORD_TEXT for loop() to print
+  void print(OutputLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+  // loop() side: delivers up to `budget` records
+  size_t poll(size_t budget = SESSION_RECORD_DEPTH);
+  // No job queued or running, so loop() may touch the client
+  bool idle() const { return jobs.empty() && !busy.load(std::memory_order_acquire); }
+
+  // loop() reports how long each pass worked, excluding its idle wait
+  void accountLoop(uint32_t busyUs);
+  void printStats();
+
+private:
+  static void taskMain(void* parameter);
+  void runJobs();
+  size_t deliver(size_t budget);
+
+  GattJobHandler onJob = nullptr;
+  SessionRecordHandler onRecord = nullptr;
+  SpscQueue<GattJob, GATT_JOB_DEPTH> jobs;
+  SpscQueue<SessionRecord, SESSION_RECORD_DEPTH> records;
+  std::atomic<bool> busy{false};
+  void* task = nullptr;
+
+  uint32_t statsStartMs = 0;
+  // Counted on the GATT task and printed from loop()
+  std::atomic<uint32_t> jobsRun{0};
+  std::atomic<uint32_t> gattBusyMs{0};
+  uint32_t gattBusyRemainderUs = 0;  // GATT task only: what has not made a whole ms yet
+  std::atomic<uint32_t> publishWaits{0};  // times the GATT task found the record ring full
+  uint32_t recordsDelivered = 0;
+  uint32_t loopPasses = 0;
+  uint64_t loopBusyUs = 0;
+};
+
+extern GattWorker gattWorker;
+
+// BLEDevice takes a single custom GATTC handler; modules that wait on raw GATTC events
+// register here and every event is passed to each of them
+void addGattcHandler(gattc_event_handler handler);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Upper bounds on how long loop() sleeps when nothing is signalled. The short one applies
+// while a capture polls its characteristics or log records wait for flash.
+#define LOOP_TICK_MS 100
+#define LOOP_IDLE_WAIT_MS 1000
+
+// Reasons for loop() to wake, signalled from the BLE host, UART and GATT tasks
+enum LoopEvent : uint8_t {
+  LOOP_EVENT_INPUT,       // bytes arrived on the console UART
+  LOOP_EVENT_PROMPT,      // the device list is shown and a selection is awaited
+  LOOP_EVENT_DISCONNECT,  // the peer dropped the link
+  LOOP_EVENT_RECORD,      // the GATT task published a record or finished its jobs
+  LOOP_EVENT_NOTIFY,      // a notification was queued
+  LOOP_EVENT_TARGET,      // the unit a pending connect waits for advertised
+  LOOP_EVENT_SCAN,        // a scan heard a new device or ran for its full duration
+  LOOP_EVENT_TICK,        // the wait ran out; periodic work is due
+  LOOP_EVENT_COUNT
+};
+
+// Event group loop() blocks on instead of polling with delay(). Every event carries the
+// time of its first signal since the last wake, so wake-up latency is measured for all of
+// them and reaction latency (signal to handled) for the ones loop() reports as handled.
+class LoopEvents {
+public:
+  void begin();
+  // Any task or callback; never blocks
+  void signal(LoopEvent event);
+  // Blocks until something is signalled or `timeoutMs` passes. Returns the woken events
+  // as a bit set (LOOP_EVENT_TICK on a timeout).
+  uint32_t wait(uint32_t timeoutMs);
+  // loop() finished acting on an event returned by wait()
+  void handled(LoopEvent event);
+  void printStats();
+
+private:
+  struct Latency {
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t sumUs;
+    void add(uint32_t us);
+  };
+
+  void* group = nullptr;
+  std::atomic<uint32_t> pending{0};                      // signalled since the last wake
+  std::atomic<uint32_t> signalledUs[LOOP_EVENT_COUNT];   // first signal of each pending event
+  uint32_t wokenUs[LOOP_EVENT_COUNT] = {};               // signal time of each woken event
+  uint32_t woken = 0;                                    // woken and not handled yet
+  uint32_t signals[LOOP_EVENT_COUNT] = {};
+  Latency wake[LOOP_EVENT_COUNT] = {};
+  Latency reaction[LOOP_EVENT_COUNT] = {};
+  uint32_t waits = 0;
+  uint64_t sleptUs = 0;
+  uint32_t statsStartMs = 0;
+};
+
+extern LoopEvents loopEvents;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Subsystem an allocation is charged to
+enum MemTag : uint8_t {
+  MEM_OTHER = 0,   // untagged (BLE stack internals, startup)
+  MEM_SCAN,        // advertisement handling and the device table
+  MEM_GATT,        // clients, discovery and characteristic reads
+  MEM_DECODE,      // value conversion
+  MEM_OUTPUT,      // console and report formatting
+  MEM_TAG_COUNT
+};
+
+struct MemCounters {
+  std::atomic<int32_t> liveBytes;
+  std::atomic<int32_t> peakBytes;
+  std::atomic<uint32_t> allocs;
+  std::atomic<uint32_t> allocBytes;  // requested in total; wraps, so only differences mean anything
+  std::atomic<uint32_t> frees;
+  // Net change of the system heap while the tag was active; covers malloc-based
+  // allocations (Arduino String) that operator new never sees
+  std::atomic<int32_t> heapDelta;
+};
+
+extern MemCounters memCounters[MEM_TAG_COUNT];
+// Hard budgets in live bytes per tag (0 = unlimited); exceeded budgets are flagged in reports
+extern int32_t memBudgetBytes[MEM_TAG_COUNT];
+
+// Charges every operator new/delete on this task to `tag` for the scope's lifetime.
+// Scopes nest; the previous tag is restored on exit.
+class MemScope {
+public:
+  explicit MemScope(MemTag tag);
+  ~MemScope();
+
+private:
+  MemTag previous;
+  uint32_t heapAtEntry;
+};
+
+MemTag currentMemTag();
+// Free heap, minimum free heap ever and largest free block (0 where the platform can't tell)
+void memHeapInfo(uint32_t& freeBytes, uint32_t& minFreeBytes, uint32_t& largestBlock);
+void printMemReport();
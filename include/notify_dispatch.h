@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <atomic>
+#include <functional>
+#include "spsc_queue.h"
+
+// ATT handles at or above this are not dispatched (our peripherals stay well below it)
+#define NOTIFY_MAX_HANDLE 256
+#define NOTIFY_MAX_SLOTS 16
+// Events buffered per characteristic between the BLE task and loop(); must be a power of two
+#define NOTIFY_QUEUE_DEPTH 16
+#define NOTIFY_MAX_VALUE 20
+#define NOTIFY_POLL_BUDGET 64
+
+struct NotifyEvent {
+  uint32_t stampUs;  // micros() when the BLE task received it
+  uint8_t length;
+  uint8_t data[NOTIFY_MAX_VALUE];
+};
+
+// Runs on the loop task for every delivered event
+typedef std::function<void(BLERemoteCharacteristic*, const NotifyEvent&)> NotifyHandler;
+
+// Fan-in for notifications and indications. The BLE callback finds its slot through a
+// table indexed by ATT handle and only copies the value into that slot's queue; handlers
+// run later from poll() on the loop task.
+//
+// Slots are set up on the GATT task while loop() delivers, so a mutex covers the slots'
+// handlers and queues between the two; handlers run under it and must not subscribe or
+// unsubscribe. The BLE callback never takes it: a slot is fully written before its handle
+// entry and slotCount are published, with release stores read back with acquire loads.
+class NotifyDispatcher {
+public:
+  NotifyDispatcher();
+  void begin();
+
+  // Enables notifications (or indications) and routes them to `handler`. Subscribing an
+  // already subscribed characteristic replaces its handler and drops the events still queued
+  // for the old one. A null handler counts only.
+  bool subscribe(BLERemoteCharacteristic* pChar, NotifyHandler handler = nullptr);
+  void unsubscribe(BLERemoteCharacteristic* pChar);
+  // Forgets every slot without GATT traffic, for use once the link is gone
+  void reset();
+  // Delivers up to `budget` queued events. Returns how many were delivered.
+  size_t poll(size_t budget = NOTIFY_POLL_BUDGET);
+  void printStats();
+
+private:
+  struct Slot {
+    BLERemoteCharacteristic* characteristic;
+    NotifyHandler handler;
+    SpscQueue<NotifyEvent, NOTIFY_QUEUE_DEPTH> queue;
+    std::atomic<uint32_t> received;
+    std::atomic<uint32_t> dropped;
+    uint32_t delivered;
+    uint32_t latencyMaxUs;
+    uint64_t latencySumUs;
+  };
+
+  static void onNotify(BLERemoteCharacteristic* pChar, uint8_t* data, size_t length, bool isNotify);
+  void lock();
+  void unlock();
+
+  std::atomic<uint8_t> slotByHandle[NOTIFY_MAX_HANDLE];
+  Slot slots[NOTIFY_MAX_SLOTS];
+  std::atomic<uint8_t> slotCount{0};
+  SemaphoreHandle_t mutex = nullptr;
+};
+
+extern NotifyDispatcher notifyDispatcher;
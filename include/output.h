@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+#include <cstdarg>
+
+// Size of the shared console block buffer (also used as the UART TX buffer size)
+#define OUTPUT_BUFFER_SIZE 2048
+
+// Console verbosity. Blocks above the current level are skipped before any formatting happens.
+enum OutputLevel : uint8_t {
+  OUT_QUIET = 0,    // prompts, errors and verdicts only
+  OUT_NORMAL = 1,   // scan results, device tables and service blocks
+  OUT_VERBOSE = 2   // extra diagnostics (descriptors, timings)
+};
+
+extern OutputLevel outputLevel;
+
+inline bool outputEnabled(OutputLevel level) {
+  return level <= outputLevel;
+}
+
+// Minimal printf-style formatter: %s %c %d %i %u %x %X %%, with optional '-', '0', width and 'l'.
+// Writes at most `capacity` bytes (no terminator) and returns the length the full output needs.
+size_t outputFormat(char* dst, size_t capacity, const char* format, va_list args);
+
+// Renders a block of console text into a preallocated buffer and emits it with a single
+// Serial.write(). Call begin() first; when it returns false the block is muted and every
+// printf()/print() is a no-op, so disabled output costs nothing but the level check.
+class OutputBuffer {
+public:
+  OutputBuffer(char* storage, size_t capacity);
+
+  bool begin(OutputLevel level);
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  void print(const char* text);
+  void flush();
+  // Sends flushed blocks to `target` instead of Serial; nullptr switches back
+  void redirect(Print* target) { sink = target; }
+
+private:
+  char* buffer;
+  size_t capacity;
+  size_t length;
+  bool active;
+  Print* sink = nullptr;
+};
+
+// Shared block buffer for the loop task. BLE callbacks must use their own OutputBuffer.
+extern OutputBuffer consoleOut;
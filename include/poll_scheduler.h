@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <atomic>
+
+#define POLL_MAX_ENTRIES 24
+#define POLL_RATE_RULES 16
+// Wheel resolution: two 7.5 ms connection events. Reads due within one tick share a batch.
+#define POLL_TICK_MS 15
+#define POLL_WHEEL_SLOTS 64     // ~1 s per turn; longer periods wait out whole turns
+#define POLL_READ_TIMEOUT_MS 2000
+
+// Default periods of the monitored services, until "poll" sets others
+#define POLL_BATTERY_MS 5000
+#define POLL_TEMPERATURE_MS 2000
+#define POLL_CSC_MS 10000
+#define POLL_USER_MS 30000
+
+// Monitoring mode for long burn-in runs: every readable characteristic of the Battery,
+// Temperature, CSC and User services is read at its own period.
+//
+// Entries sit in a hashed timer wheel. Everything due in the same tick is read as one
+// batch. Values whose length is fixed, by their CPF format or by their UUID, are
+// coalesced into Read Multiple requests that fit the MTU; the rest are read one by one. The GATT task runs one batch per JOB_POLL, and
+// loop() only posts the next job when the previous one is done. The bearer so never has
+// more than one request outstanding, and never sits idle while a read is due.
+//
+// Rates are loop()-side; everything else belongs to the GATT task between start() and
+// stop(), and loop() only looks at it while the task is idle.
+class PollScheduler {
+public:
+  // A characteristic UUID or a service UUID; 0 ms stops polling it
+  bool setRate(BLEUUID uuid, uint32_t periodMs);
+  void printRates();
+
+  // GATT task
+  bool start(BLEClient* client);
+  // Reads every entry that is due and publishes RECORD_POLL for each value
+  void runDue();
+
+  // loop()
+  bool active() const { return running; }
+  bool due() const { return running && (int32_t)(millis() - nextDueMs.load()) >= 0; }
+  uint32_t msUntilDue() const;
+  void stop();
+  void printStats();
+
+private:
+  struct Rule {
+    BLEUUID uuid;
+    uint32_t periodMs;
+  };
+
+  struct Entry {
+    BLERemoteCharacteristic* characteristic;
+    BLEUUID uuid;
+    uint16_t handle;
+    uint32_t periodMs;
+    uint32_t dueMs;      // since start()
+    uint32_t dueTick;
+    uint16_t rounds;     // wheel turns left before the entry's slot fires
+    int8_t next;         // next entry in the same slot, -1 at the end
+    uint8_t fixedLength; // value size set by the CPF format or the UUID; 0 when it may vary
+    bool haveCpf;
+    uint8_t format;
+    int8_t exponent;
+    uint16_t unit;
+    uint32_t reads;
+    uint32_t errors;
+    uint32_t late;       // read a tick or more after it was due
+    uint32_t lastReadMs;
+    uint64_t intervalSumMs;
+  };
+
+  uint32_t periodFor(BLEUUID characteristic, BLEUUID service);
+  void schedule(int8_t index, uint32_t dueMs);
+  void readBatch(int8_t* batch, uint8_t count);
+  bool readMultiple(int8_t* group, uint8_t count);
+  void readSingle(Entry& entry);
+  void deliver(Entry& entry, const uint8_t* data, size_t length, uint32_t nowMs);
+  void updateNextDue();
+
+  Rule rules[POLL_RATE_RULES];
+  uint8_t ruleCount = 0;
+
+  BLEClient* client = nullptr;
+  Entry entries[POLL_MAX_ENTRIES];
+  uint8_t entryCount = 0;
+  int8_t wheel[POLL_WHEEL_SLOTS];
+  uint32_t wheelTick = 0;  // next tick to be processed
+  uint32_t startMs = 0;
+  bool running = false;
+  std::atomic<uint32_t> nextDueMs{0};
+
+  uint32_t batches = 0;
+  uint32_t readMultiples = 0;
+  uint32_t coalescedReads = 0;  // values that came in a Read Multiple
+  uint32_t singleReads = 0;
+};
+
+extern PollScheduler pollScheduler;
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <string>
+#include <vector>
+
+#define PROFILE_WRITE_TIMEOUT_MS 2000
+
+// Desired value for one User Service characteristic. A unit may serve one UUID more than
+// once, so the handle tells them apart; units on the same firmware share their handles.
+struct ProfileEntry {
+  BLEUUID uuid;
+  uint16_t handle;
+  std::string value;
+};
+
+// Brings a unit's User Service in line with a desired profile. Only characteristics whose
+// current value differs are written; values longer than one ATT write are queued with
+// Prepare Write and committed together with a single Execute Write.
+class ProfileSync {
+public:
+  // Takes the desired profile from the connected (golden) unit's User Service
+  size_t capture(BLEClient* client);
+  // Returns true when every differing characteristic was written and verified. A GATT job;
+  // the counts stay here for loop() to print with printReport().
+  bool sync(BLEClient* client);
+  void printReport();
+  size_t size() const { return desired.size(); }
+
+private:
+  bool longWrite(BLEClient* client, std::vector<std::pair<BLERemoteCharacteristic*, const std::string*>>& writes);
+
+  std::vector<ProfileEntry> desired;
+
+  // The last sync that got as far as comparing values
+  struct SyncReport {
+    bool valid;
+    bool ok;
+    uint16_t checked, differing, written, bytes, longWrites, missing, verifyFailures;
+  } report = {};
+};
+
+extern ProfileSync profileSync;
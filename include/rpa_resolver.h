@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+#define RPA_MAX_KEYS 15      // one per bond (BOND_STORE_MAX)
+#define RPA_CACHE_SLOTS 32   // a scan's worth of units with room for rotation
+#define RPA_CACHE_PROBES 4   // slots an address may sit in, from its hash on
+
+// Resolves the resolvable private addresses (RPAs) of bonded units to their identity
+// address. An RPA is prand[3] | hash[3], most significant byte first, with the top two
+// bits of prand 01; it belongs to the unit whose IRK gives ah(IRK, prand) == hash.
+//
+// Each miss costs one AES-128 block per bonded unit, so results are cached per address,
+// unresolvable ones included. A unit keeps an RPA for many minutes and advertises it
+// several times a second, so nearly every advert is a cache hit. An address may sit in
+// any of RPA_CACHE_PROBES slots from its hash on, and a miss replaces the least recently
+// used of them, so addresses that hash alike do not evict each other. Any change to the
+// keys invalidates the cache, since an address no key resolved may now have one.
+//
+// Keys change on the GATT task (pairing, forgetting bonds) while adverts are resolved on
+// the BLE host task; a mutex covers both.
+class RpaResolver {
+public:
+  void begin();
+  // IRK in the byte order SMP distributes it (least significant first), as the stack stores it
+  void setKey(const uint8_t* identity, const uint8_t* irk);
+  // Drops the key of one unit, or every key for a null identity
+  void removeKey(const uint8_t* identity);
+
+  static bool resolvable(const uint8_t* address) { return (address[0] & 0xC0) == 0x40; }
+  // The identity behind `address`; false when it is not an RPA of a bonded unit
+  bool resolve(const uint8_t* address, uint8_t* identity);
+  void printStats();
+
+private:
+  struct Key {
+    uint8_t identity[6];
+    uint8_t irk[16];  // most significant byte first, as AES takes it
+  };
+
+  struct CacheSlot {
+    uint8_t address[6];
+    int8_t key;           // index into keys, -1 when no key resolves the address
+    uint32_t generation;  // keys generation the result was computed for; 0 never matches
+    uint32_t lastUsed;    // lookup count at its last use
+  };
+
+  bool matches(const Key& key, const uint8_t* address);
+  void lock();
+  void unlock();
+
+  Key keys[RPA_MAX_KEYS];
+  size_t keyCount = 0;
+  uint32_t generation = 1;
+  CacheSlot cache[RPA_CACHE_SLOTS] = {};
+  SemaphoreHandle_t mutex = nullptr;
+
+  uint32_t lookups = 0;
+  uint32_t hits = 0;
+  uint32_t resolved = 0;
+  uint32_t aesBlocks = 0;
+};
+
+extern RpaResolver rpaResolver;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define SESSION_ARENA_BYTES (16 * 1024)
+
+// Bump allocator owning everything we build during one test session. Memory is handed out
+// from one block reserved at startup and released all at once by reset() on disconnect, so
+// repeated sessions never leave holes in the heap. Requests that don't fit fall back to
+// the heap and are freed by the same reset().
+class SessionArena {
+public:
+  SessionArena(uint8_t* storage, size_t capacity);
+
+  void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+  // NUL-terminated copy of `length` bytes
+  char* copy(const void* data, size_t length);
+  char* copy(const std::string& value) { return copy(value.data(), value.size()); }
+  void reset();
+
+  size_t used() const { return offset; }
+  size_t highWater() const { return peak; }
+  size_t capacity() const { return size; }
+  uint32_t overflows() const { return overflowCount; }
+  void printStats();
+
+private:
+  uint8_t* base;
+  size_t size;
+  size_t offset = 0;
+  size_t peak = 0;
+  uint32_t overflowCount = 0;
+  std::vector<void*> overflowBlocks;
+};
+
+extern SessionArena sessionArena;
+
+// Releases everything the session kept in the arena in one step
+void endSessionData();
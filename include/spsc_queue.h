@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Lock-free ring with exactly one producer task and one consumer task. N must be a power
+// of two. Items are copied in and out, so T should be small and trivially copyable.
+template <typename T, uint32_t N>
+class SpscQueue {
+public:
+  bool push(const T& item) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) return false;
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    uint32_t depth = h + 1 - tail.load(std::memory_order_relaxed);
+    if (depth > highWater.load(std::memory_order_relaxed)) highWater.store(depth, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool pop(T& item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: drops everything queued so far
+  void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  // Written by the producer, read for stats from either side
+  uint32_t maxDepth() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head{0};  // written by the producer
+  std::atomic<uint32_t> tail{0};  // written by the consumer
+  std::atomic<uint32_t> highWater{0};
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "control_channel.h"
+#include "expectations.h"
+
+// Segments are written round robin; the oldest one is recycled when the log wraps
+#define LOG_SEGMENTS 8
+#define LOG_SEGMENT_BYTES (64 * 1024)
+// Records waiting for flash, and how much of them loop() writes per call
+#define LOG_PENDING_BYTES 4096
+#define LOG_SLICE_BYTES 512
+#define LOG_RECORD_MAGIC 0x4C54
+#define LOG_MAX_PAYLOAD 255
+
+enum LogRecordType : uint8_t {
+  LOG_SESSION = 1,  // start of a test session; indexed
+  LOG_VALUE = 2,    // uuid hash + raw characteristic value
+  LOG_CONTROL = 3,  // control register command result
+  LOG_VERDICT = 4   // session verdict and DIS config hash
+};
+
+struct __attribute__((packed)) LogRecordHeader {
+  uint16_t magic;
+  uint8_t type;
+  uint8_t length;      // payload bytes following the header
+  uint32_t sequence;   // monotonic across reboots
+  uint16_t boot;       // station boot counter
+  uint32_t uptimeMs;   // station uptime when the record was made
+  uint8_t address[6];
+  uint32_t checksum;   // FNV-1a over the header (checksum zeroed) and payload
+};
+
+// Where a session starts on flash, found by device address
+struct LogIndexEntry {
+  uint32_t sequence;
+  uint16_t boot;
+  uint32_t uptimeMs;
+  uint8_t segment;
+  uint32_t offset;
+  uint8_t verdict;  // 0 unknown, 1 pass, 2 fail
+};
+
+// Append-only session log on flash (LittleFS on the station, plain files on native builds).
+// Appends only copy into RAM; service() writes a bounded slice per call so the test loop
+// never waits on a full flash write.
+class TelemetryLog {
+public:
+  bool begin();
+  void beginSession(const std::string& address);
+  void logValue(BLEUUID uuid, const std::string& raw);
+  void logControl(const ControlResult& result);
+  void logVerdict(const SessionVerdict& verdict, uint32_t configHash);
+  void service();
+  void flushAll();
+  // Records are waiting in RAM for service()
+  bool backlog() const { return mounted && pendingLength != 0; }
+
+  // Drops value records of all but the newest `keepPerDevice` sessions of each device
+  void compact(size_t keepPerDevice);
+  void printSessions(const std::string& address);
+  // Hex dump of every stored record from `fromSequence` on, for host sync
+  void dump(uint32_t fromSequence);
+  void printStats();
+
+private:
+  void append(uint8_t type, const void* payload, size_t length);
+  bool writeRecord(const uint8_t* record, size_t length);
+  void openSegment(uint8_t segment, bool recycle);
+  void rebuildIndex();
+  void indexRecord(const LogRecordHeader& header, uint8_t segment, uint32_t offset, const uint8_t* payload);
+
+  bool mounted = false;
+  uint16_t boot = 0;
+  uint32_t nextSequence = 0;
+  uint8_t sessionAddress[6] = {0};
+  uint8_t activeSegment = 0;
+  uint32_t activeSize = 0;
+
+  uint8_t pending[LOG_PENDING_BYTES];
+  size_t pendingLength = 0;
+  uint32_t dropped = 0;
+
+  // Session index: device address -> sessions in log order
+  std::map<uint64_t, std::vector<LogIndexEntry>> index;
+};
+
+extern TelemetryLog telemetryLog;
+
+// "aa:bb:cc:dd:ee:ff" -> bytes; false if malformed
+bool parseAddress(const std::string& text, uint8_t out[6]);
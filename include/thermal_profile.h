@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include "notify_dispatch.h"
+
+#define THERMAL_CHANNELS 6
+// Buckets per channel. When they fill up, neighbours are merged and the bucket width doubles,
+// so memory stays fixed however long the run: 240 buckets hold 32 minutes at 8 s resolution.
+#define THERMAL_BUCKETS 240
+#define THERMAL_BUCKET_MS 1000
+#define THERMAL_DURATION_MS (30UL * 60UL * 1000UL)
+#define THERMAL_POLL_MS 1000
+// Points per channel in the downsampled output series
+#define THERMAL_OUTPUT_POINTS 60
+#define THERMAL_NAME_MAX 37  // a full 128-bit UUID string and its terminator
+
+struct ThermalBucket {
+  uint32_t startMs;
+  float min;
+  float max;
+  float sum;
+  uint32_t count;
+};
+
+// Bounded-memory min/max/mean decimation for one temperature characteristic
+class ThermalSeries {
+public:
+  void reset(const char* name, uint32_t startMs);
+  void add(uint32_t timeMs, float value);
+
+  char name[THERMAL_NAME_MAX];  // copied: the client's characteristic map goes with the link
+  ThermalBucket buckets[THERMAL_BUCKETS];
+  uint16_t used;
+  uint32_t widthMs;
+
+private:
+  void compact();
+  uint32_t startMs;
+};
+
+// Thermal profiling mode: subscribes to (or polls) every characteristic in the Temperature
+// Service for up to 30 minutes and prints an LTTB-downsampled series at the end or on demand.
+class ThermalProfile {
+public:
+  // A GATT job: update() and the console commands wait for the worker to be idle, and no
+  // notification is delivered before the subscriptions at the end of start().
+  bool start(BLEClient* client);
+  // Call from loop(). Polls characteristics that cannot notify and ends the run on timeout.
+  void update(bool connected);
+  void stop();
+  void printSeries();
+  bool active() const { return running; }
+
+private:
+  struct Source {
+    BLERemoteCharacteristic* characteristic;
+    bool polled;
+    bool haveCpf;
+    uint8_t format;
+    int8_t exponent;
+  };
+
+  void onNotify(BLERemoteCharacteristic* pChar, const NotifyEvent& event);
+  bool decodeSample(const Source& source, const std::string& raw, float& value);
+
+  Source sources[THERMAL_CHANNELS];
+  ThermalSeries series[THERMAL_CHANNELS];
+  uint8_t channelCount = 0;
+  bool running = false;
+  uint32_t startMs = 0;
+  uint32_t lastPollMs = 0;
+};
+
+extern ThermalProfile thermalProfile;
+
+// Largest-Triangle-Three-Buckets selection over (x, y) points. Writes up to `threshold`
+// chosen indices into `selected` (always including the first and last point) and returns the count.
+size_t lttbSelect(const float* x, const float* y, size_t count, size_t threshold, uint16_t* selected);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <BLEDevice.h>
+
+// Service UUID Definitions
+static BLEUUID DIS_UUID((uint16_t)0x180A);  // Device Information Service
+static BLEUUID TEMP_UUID("B1F8799E-4999-4F4A-AF05-B5A6FB6AB55D"); // Temperature Service
+static BLEUUID CSCP_UUID((uint16_t)0x1816); // Cycling Speed and Cadence Profile
+static BLEUUID USER_UUID("B1F879A7-4999-4F4A-AF05-B5A6FB6AB55D"); // User Service
+static BLEUUID BATTERY_UUID((uint16_t)0x180F); // Battery Service
+static BLEUUID CONTROL_UUID("B1F879B4-4999-4F4A-AF05-B5A6FB6AB55D"); // Control Service
+static BLEUUID CONTROL_REG_UUID("B1F879B5-4999-4F4A-AF05-B5A6FB6AB55D"); // Control Register
+
+// Descriptor UUID for Characteristic Presentation Format (CPF)
+static BLEUUID CPF_DESC_UUID((uint16_t)0x2904);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <string>
+
+#define VALUE_STORE_DEVICES 16
+#define VALUE_STORE_SLOTS 32  // characteristics remembered per device
+
+enum ValueChange : uint8_t {
+  VALUE_NEW,        // first time this characteristic is seen on the device
+  VALUE_CHANGED,
+  VALUE_UNCHANGED
+};
+
+// Last value of every explored characteristic per device, kept as a hash, so a repeated
+// sweep (a re-test, or a plan run again on the same link) only reports what changed.
+// The least recently swept device makes room for a new one. loop() only.
+class ValueStore {
+public:
+  // Starts a sweep of `address`; note() compares against the previous sweep of it
+  void beginSweep(const std::string& address);
+  // A slot is keyed by UUID and handle, since a unit may serve one UUID more than once
+  ValueChange note(BLEUUID uuid, uint16_t handle, const std::string& raw);
+  // One-line summary of the sweep: changed, new and unchanged counts
+  void endSweep();
+
+  // Delta-only reporting: unchanged values are counted instead of printed
+  bool deltaOnly() const { return delta; }
+  void setDeltaOnly(bool enable) { delta = enable; }
+  void clear();
+  void printStats();
+
+private:
+  struct Slot {
+    uint32_t uuidHash;
+    uint32_t valueHash;
+    uint16_t handle;
+  };
+
+  struct Device {
+    uint8_t address[6];
+    uint32_t sweeps;
+    uint32_t lastSweep;  // sweepClock when last swept; 0 for a free entry
+    uint8_t slotCount;
+    Slot slots[VALUE_STORE_SLOTS];
+  };
+
+  Device devices[VALUE_STORE_DEVICES] = {};
+  Device* current = nullptr;
+  uint32_t sweepClock = 0;
+  bool delta = true;
+
+  uint16_t sweepNew = 0;
+  uint16_t sweepChanged = 0;
+  uint16_t sweepUnchanged = 0;
+
+  uint32_t valuesNoted = 0;
+  uint32_t valuesUnchanged = 0;
+  uint32_t slotsFull = 0;  // characteristics not remembered because the device had no slot left
+};
+
+extern ValueStore valueStore;
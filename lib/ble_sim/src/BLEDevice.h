@@ -0,0 +1,302 @@
+#pragma once
+
+// Simulated ESP32 BLE client API. Only the surface the firmware uses is provided;
+// behaviour (latency, link loss, errors) comes from the peripherals and faults in ble_sim.h.
+
+#include <Arduino.h>
+#include <map>
+#include <vector>
+#include <string>
+
+typedef uint8_t esp_bd_addr_t[6];
+typedef enum {
+  BLE_ADDR_TYPE_PUBLIC = 0,
+  BLE_ADDR_TYPE_RANDOM = 1,
+  BLE_ADDR_TYPE_RPA_PUBLIC = 2,
+  BLE_ADDR_TYPE_RPA_RANDOM = 3
+} esp_ble_addr_type_t;
+
+#define ESP_UUID_LEN_16 2
+#define ESP_UUID_LEN_32 4
+#define ESP_UUID_LEN_128 16
+typedef struct {
+  uint16_t len;
+  union {
+    uint16_t uuid16;
+    uint32_t uuid32;
+    uint8_t uuid128[16];
+  } uuid;
+} esp_bt_uuid_t;
+
+#include "esp_gattc_api.h"
+#include "esp_gap_ble_api.h"
+
+class BLEUUID {
+public:
+  BLEUUID();
+  BLEUUID(std::string value);
+  BLEUUID(uint16_t uuid);
+  BLEUUID(uint32_t uuid);
+  BLEUUID(esp_bt_uuid_t uuid);
+
+  bool equals(BLEUUID other);
+  esp_bt_uuid_t* getNative() { return &native; }
+  uint8_t bitSize();
+  BLEUUID to128();
+  std::string toString();
+  static BLEUUID fromString(std::string value) { return BLEUUID(value); }
+
+private:
+  esp_bt_uuid_t native;
+  bool valueSet;
+};
+
+class BLEAddress {
+public:
+  BLEAddress(esp_bd_addr_t address);
+  BLEAddress(std::string address);
+  bool equals(BLEAddress other) { return memcmp(native, other.native, 6) == 0; }
+  esp_bd_addr_t* getNative() { return &native; }
+  std::string toString();
+
+private:
+  esp_bd_addr_t native;
+};
+
+class BLEAdvertisedDevice {
+public:
+  BLEAdvertisedDevice() : address(std::string("00:00:00:00:00:00")) {}
+
+  BLEAddress getAddress() { return address; }
+  esp_ble_addr_type_t getAddressType() { return addressType; }
+  std::string getName() { return name; }
+  int getRSSI() { return rssi; }
+  BLEUUID getServiceUUID() { return serviceUUID; }
+  std::string getManufacturerData() { return manufacturerData; }
+  bool haveName() { return !name.empty(); }
+  bool haveRSSI() { return true; }
+  bool haveServiceUUID() { return hasServiceUUID; }
+  bool haveManufacturerData() { return !manufacturerData.empty(); }
+  std::string toString() { return "Name: " + name + ", Address: " + address.toString(); }
+
+private:
+  friend class BLEScan;
+  friend class BleSim;
+  BLEAddress address;
+  esp_ble_addr_type_t addressType = BLE_ADDR_TYPE_PUBLIC;
+  std::string name;
+  int rssi = 0;
+  BLEUUID serviceUUID;
+  bool hasServiceUUID = false;
+  std::string manufacturerData;
+};
+
+class BLEAdvertisedDeviceCallbacks {
+public:
+  virtual ~BLEAdvertisedDeviceCallbacks() {}
+  virtual void onResult(BLEAdvertisedDevice advertisedDevice) = 0;
+};
+
+class BLEScanResults {
+public:
+  int getCount() { return devices.size(); }
+  BLEAdvertisedDevice getDevice(uint32_t index) { return devices.at(index); }
+
+private:
+  friend class BLEScan;
+  std::vector<BLEAdvertisedDevice> devices;
+};
+
+class BLEScan {
+public:
+  void setAdvertisedDeviceCallbacks(BLEAdvertisedDeviceCallbacks* callbacks, bool wantDuplicates = false,
+                                    bool shouldParse = true);
+  void setActiveScan(bool active) { activeScan = active; }
+  void setInterval(uint16_t intervalMs) { interval = intervalMs; }
+  void setWindow(uint16_t windowMs) { window = windowMs; }
+  bool start(uint32_t duration, void (*scanCompleteCB)(BLEScanResults), bool is_continue = false);
+  BLEScanResults start(uint32_t duration, bool is_continue = false);
+  void stop();
+  void clearResults() { results.devices.clear(); }
+  BLEScanResults getResults() { return results; }
+
+private:
+  friend class BleSim;
+  void deliver(const BLEAdvertisedDevice& device);
+  void complete(uint32_t generation);
+
+  BLEAdvertisedDeviceCallbacks* callbacks = nullptr;
+  bool wantDuplicates = false;
+  bool activeScan = false;
+  uint16_t interval = 100;
+  uint16_t window = 100;
+  bool scanning = false;
+  uint32_t generation = 0;  // bumps on every start/stop so stale scan events are ignored
+  void (*completeCB)(BLEScanResults) = nullptr;
+  BLEScanResults results;
+};
+
+class BLEClient;
+class BLERemoteService;
+class BLERemoteCharacteristic;
+struct SimCharacteristic;
+struct SimService;
+struct SimPeripheral;
+
+class BLERemoteDescriptor {
+public:
+  uint16_t getHandle() { return handle; }
+  BLEUUID getUUID() { return uuid; }
+  std::string readValue();
+  void writeValue(uint8_t* data, size_t length, bool response = false);
+  BLERemoteCharacteristic* getRemoteCharacteristic() { return characteristic; }
+
+private:
+  friend class BLERemoteCharacteristic;
+  BLERemoteDescriptor(BLERemoteCharacteristic* owner, BLEUUID descriptorUUID, uint16_t descriptorHandle,
+                      const std::string* descriptorValue)
+    : characteristic(owner), uuid(descriptorUUID), handle(descriptorHandle), value(descriptorValue) {}
+
+  BLERemoteCharacteristic* characteristic;
+  BLEUUID uuid;
+  uint16_t handle;
+  const std::string* value;  // nullptr for the CCCD, which is written, not read
+};
+
+typedef std::function<void(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length,
+                           bool isNotify)> notify_callback;
+
+class BLERemoteCharacteristic {
+public:
+  ~BLERemoteCharacteristic();
+
+  bool canBroadcast() { return properties & 0x01; }
+  bool canRead() { return properties & 0x02; }
+  bool canWriteNoResponse() { return properties & 0x04; }
+  bool canWrite() { return properties & 0x08; }
+  bool canNotify() { return properties & 0x10; }
+  bool canIndicate() { return properties & 0x20; }
+
+  BLERemoteDescriptor* getDescriptor(BLEUUID uuid);
+  std::map<std::string, BLERemoteDescriptor*>* getDescriptors();
+  uint16_t getHandle() { return handle; }
+  BLEUUID getUUID() { return uuid; }
+  BLERemoteService* getRemoteService() { return service; }
+
+  std::string readValue();
+  void writeValue(uint8_t* data, size_t length, bool response = false);
+  void writeValue(std::string value, bool response = false);
+  void registerForNotify(notify_callback callback, bool notifications = true,
+                         bool descriptorRequiresRegistration = true);
+
+private:
+  friend class BLERemoteService;
+  friend class BleSim;
+  BLERemoteCharacteristic(BLERemoteService* owner, SimCharacteristic* characteristicModel);
+
+  BLERemoteService* service;
+  SimCharacteristic* model;
+  BLEUUID uuid;
+  uint16_t handle;
+  uint8_t properties;
+  notify_callback notifyCallback;
+  bool notifications = true;
+  std::map<std::string, BLERemoteDescriptor*> descriptors;
+  bool descriptorsDiscovered = false;
+};
+
+class BLERemoteService {
+public:
+  ~BLERemoteService();
+
+  BLERemoteCharacteristic* getCharacteristic(BLEUUID uuid);
+  std::map<std::string, BLERemoteCharacteristic*>* getCharacteristics();
+  // Every characteristic, including a second one with a UUID already in the map above
+  std::map<uint16_t, BLERemoteCharacteristic*>* getCharacteristicsByHandle();
+  BLEUUID getUUID() { return uuid; }
+  BLEClient* getClient() { return client; }
+
+private:
+  friend class BLEClient;
+  BLERemoteService(BLEClient* owner, SimService* serviceModel);
+
+  BLEClient* client;
+  SimService* model;
+  BLEUUID uuid;
+  std::map<std::string, BLERemoteCharacteristic*> characteristics;
+  std::map<uint16_t, BLERemoteCharacteristic*> characteristicsByHandle;
+  bool characteristicsDiscovered = false;
+};
+
+class BLEClientCallbacks {
+public:
+  virtual ~BLEClientCallbacks() {}
+  virtual void onConnect(BLEClient* pClient) = 0;
+  virtual void onDisconnect(BLEClient* pClient) = 0;
+};
+
+class BLEClient {
+public:
+  BLEClient();
+  ~BLEClient();
+
+  bool connect(BLEAdvertisedDevice* device);
+  bool connect(BLEAddress address, esp_ble_addr_type_t type = BLE_ADDR_TYPE_PUBLIC);
+  void disconnect();
+  bool isConnected() { return connected; }
+  void setClientCallbacks(BLEClientCallbacks* clientCallbacks) { callbacks = clientCallbacks; }
+
+  std::map<std::string, BLERemoteService*>* getServices();
+  BLERemoteService* getService(BLEUUID uuid);
+  BLEAddress getPeerAddress();
+  int getRssi();
+  uint16_t getConnId() { return connId; }
+  esp_gatt_if_t getGattcIf() { return 3; }
+  bool setMTU(uint16_t size) { mtu = size; return true; }
+  uint16_t getMTU() { return mtu; }
+
+private:
+  friend class BleSim;
+  void clearServices();
+
+  SimPeripheral* peer = nullptr;
+  BLEClientCallbacks* callbacks = nullptr;
+  bool connected = false;
+  bool closing = false;
+  bool encrypted = false;  // link encryption started with a paired or stored key
+  uint64_t droppedAtUs = 0;  // onDisconnect for a link the peer dropped, until the client is released
+  uint16_t connId = 0;
+  uint16_t mtu = 23;
+  std::map<std::string, BLERemoteService*> services;
+  bool servicesDiscovered = false;
+};
+
+class BLESecurityCallbacks {
+public:
+  virtual ~BLESecurityCallbacks() {}
+  virtual uint32_t onPassKeyRequest() = 0;
+  virtual void onPassKeyNotify(uint32_t passKey) = 0;
+  virtual bool onSecurityRequest() = 0;
+  virtual void onAuthenticationComplete(esp_ble_auth_cmpl_t result) = 0;
+  virtual bool onConfirmPIN(uint32_t pin) = 0;
+};
+
+// Pairing parameters are accepted and ignored: the simulated units pair Just Works
+class BLESecurity {
+public:
+  void setAuthenticationMode(esp_ble_auth_req_t authReq) { (void)authReq; }
+  void setCapability(esp_ble_io_cap_t ioCap) { (void)ioCap; }
+  void setInitEncryptionKey(uint8_t initKey) { (void)initKey; }
+  void setRespEncryptionKey(uint8_t respKey) { (void)respKey; }
+  void setKeySize(uint8_t keySize = 16) { (void)keySize; }
+};
+
+class BLEDevice {
+public:
+  static void init(std::string deviceName) { (void)deviceName; }
+  static void deinit(bool releaseMemory = false) { (void)releaseMemory; }
+  static BLEScan* getScan();
+  static BLEClient* createClient() { return new BLEClient(); }
+  static void setCustomGattcHandler(gattc_event_handler handler);
+  static void setSecurityCallbacks(BLESecurityCallbacks* callbacks);
+};
@@ -0,0 +1,296 @@
+#include <Arduino.h>
+#include <queue>
+#include <vector>
+#include "ble_sim.h"
+
+HardwareSerial Serial;
+SimConsole simConsole;
+
+// ---- Virtual time --------------------------------------------------------------------
+
+struct SimEvent {
+  uint64_t atUs;
+  uint64_t sequence;  // keeps events scheduled for the same instant in FIFO order
+  std::function<void()> action;
+  bool operator>(const SimEvent& other) const {
+    return atUs != other.atUs ? atUs > other.atUs : sequence > other.sequence;
+  }
+};
+
+static uint64_t nowUs = 0;
+static uint64_t eventSequence = 0;
+static std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> events;
+
+uint64_t simNowUs() {
+  return nowUs;
+}
+
+void simSchedule(uint64_t delayUs, std::function<void()> action) {
+  events.push({nowUs + delayUs, eventSequence++, action});
+}
+
+void simAdvance(uint64_t us) {
+  uint64_t target = nowUs + us;
+  while (!events.empty() && events.top().atUs <= target) {
+    SimEvent event = events.top();
+    events.pop();
+    if (event.atUs > nowUs) nowUs = event.atUs;
+    event.action();
+  }
+  // A handler may itself have waited past the target
+  if (target > nowUs) nowUs = target;
+}
+
+void simResetClock() {
+  while (!events.empty()) events.pop();
+  nowUs = 0;
+}
+
+unsigned long millis() {
+  return nowUs / 1000;
+}
+
+unsigned long micros() {
+  return nowUs;
+}
+
+void delay(unsigned long ms) {
+  simAdvance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simAdvance(us);
+}
+
+void yield() {
+}
+
+// ---- Semaphores ----------------------------------------------------------------------
+
+struct SimSemaphore {
+  int count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new SimSemaphore{0};
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new SimSemaphore{1};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  // Waiting lets simulated time pass so the completion that gives the semaphore can arrive
+  for (TickType_t waited = 0; semaphore->count == 0; waited++) {
+    if (waited >= ticks || events.empty()) return pdFALSE;
+    simAdvance(1000);
+  }
+  semaphore->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  if (semaphore->count > 0) return pdFALSE;
+  semaphore->count = 1;
+  return pdTRUE;
+}
+
+// ---- Event groups --------------------------------------------------------------------
+
+struct SimEventGroup {
+  EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+  return new SimEventGroup{0};
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  group->bits |= bits;
+  return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t ticks) {
+  // Jump from one scheduled event to the next until one of them sets the bits, so the
+  // waiter wakes at the exact virtual time it was signalled
+  uint64_t deadline = ticks == portMAX_DELAY ? UINT64_MAX : nowUs + (uint64_t)ticks * 1000;
+  for (;;) {
+    EventBits_t set = group->bits & bits;
+    if (waitForAll ? set == bits : set != 0) {
+      EventBits_t result = group->bits;
+      if (clearOnExit) group->bits &= ~bits;
+      return result;
+    }
+    if (nowUs >= deadline) return group->bits;
+    if (events.empty()) {
+      // Nothing left that could signal; a bounded wait still lets its time pass
+      if (deadline != UINT64_MAX) nowUs = deadline;
+      return group->bits;
+    }
+    uint64_t next = std::max(nowUs, std::min(events.top().atUs, deadline));
+    simAdvance(next - nowUs);
+  }
+}
+
+// ---- String --------------------------------------------------------------------------
+
+String::String(double number, unsigned int decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, number);
+  value = buffer;
+}
+
+void String::trim() {
+  size_t first = value.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) {
+    value.clear();
+    return;
+  }
+  size_t last = value.find_last_not_of(" \t\r\n");
+  value = value.substr(first, last - first + 1);
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t found = value.find(c, from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::indexOf(const String& text, unsigned int from) const {
+  size_t found = value.find(text.value, from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+String String::substring(unsigned int from) const {
+  return from >= value.size() ? String() : String(value.substr(from));
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (to > value.size()) to = value.size();
+  return from >= to ? String() : String(value.substr(from, to - from));
+}
+
+bool String::equalsIgnoreCase(const String& other) const {
+  if (value.size() != other.value.size()) return false;
+  for (size_t i = 0; i < value.size(); i++) {
+    if (tolower((unsigned char)value[i]) != tolower((unsigned char)other.value[i])) return false;
+  }
+  return true;
+}
+
+bool String::endsWith(const String& suffix) const {
+  return value.size() >= suffix.value.size() &&
+         value.compare(value.size() - suffix.value.size(), suffix.value.size(), suffix.value) == 0;
+}
+
+void String::toLowerCase() {
+  for (char& c : value) c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char& c : value) c = toupper((unsigned char)c);
+}
+
+String operator+(const String& a, const String& b) {
+  String result(a);
+  result += b;
+  return result;
+}
+
+String operator+(const String& a, const char* b) {
+  String result(a);
+  result += b;
+  return result;
+}
+
+String operator+(const char* a, const String& b) {
+  String result(a);
+  result += b;
+  return result;
+}
+
+// ---- Print / Stream ------------------------------------------------------------------
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) return 0;
+  return write(reinterpret_cast<const uint8_t*>(buffer), std::min<size_t>(length, sizeof(buffer) - 1));
+}
+
+String Stream::readStringUntil(char terminator) {
+  std::string text;
+  while (available()) {
+    char c = read();
+    if (c == terminator) break;
+    text += c;
+  }
+  return String(text);
+}
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && available()) buffer[count++] = read();
+  return count;
+}
+
+// ---- Serial --------------------------------------------------------------------------
+
+static OnReceiveCb receiveCallback;
+
+void HardwareSerial::onReceive(OnReceiveCb callback, bool onlyOnTimeout) {
+  (void)onlyOnTimeout;
+  receiveCallback = callback;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  simConsole.bytesOut += size;
+  simConsole.writes++;
+  if (simConsole.echo) fwrite(buffer, 1, size, stdout);
+  if (simConsole.onWrite) {
+    simConsole.onWrite(buffer, size);
+    return size;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    char c = buffer[i];
+    if (c == '\n') {
+      if (!simConsole.partial.empty() && simConsole.partial.back() == '\r') simConsole.partial.pop_back();
+      if (simConsole.onLine) simConsole.onLine(simConsole.partial);
+      simConsole.partial.clear();
+    } else {
+      simConsole.partial += c;
+    }
+  }
+  return size;
+}
+
+int HardwareSerial::available() {
+  return simConsole.input.size();
+}
+
+int HardwareSerial::read() {
+  if (simConsole.input.empty()) return -1;
+  uint8_t c = simConsole.input[0];
+  simConsole.input.erase(0, 1);
+  if (c == '\n' && !simConsole.lineQueuedUs.empty()) {
+    simConsole.inputReactionUs.push_back(nowUs - simConsole.lineQueuedUs.front());
+    simConsole.lineQueuedUs.pop_front();
+  }
+  return c;
+}
+
+int HardwareSerial::peek() {
+  return simConsole.input.empty() ? -1 : (uint8_t)simConsole.input[0];
+}
+
+void simConsoleInput(const std::string& text) {
+  simConsole.input += text;
+  for (char c : text) {
+    if (c == '\n') simConsole.lineQueuedUs.push_back(nowUs);
+  }
+  if (receiveCallback) receiveCallback();
+}
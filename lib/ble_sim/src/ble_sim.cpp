@@ -0,0 +1,1050 @@
+#include "ble_sim.h"
+#include <algorithm>
+#include "mbedtls/aes.h"
+
+// Link events are delivered the next time simulated time moves (delay(), an ATT wait),
+// which stands in for the BLE host task running alongside loop() on the target.
+
+BleSim bleSim;
+
+static const char* BASE_UUID_SUFFIX = "-0000-1000-8000-00805f9b34fb";
+
+// ---- BLEUUID -------------------------------------------------------------------------
+
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+BLEUUID::BLEUUID() : valueSet(false) {
+  memset(&native, 0, sizeof(native));
+}
+
+BLEUUID::BLEUUID(std::string value) : BLEUUID() {
+  std::string hex;
+  for (char c : value) {
+    if (hexNibble(c) >= 0) hex += c;
+  }
+  if (value.size() == 4 || value.size() == 8) {
+    uint32_t number = strtoul(value.c_str(), nullptr, 16);
+    native.len = value.size() == 4 ? ESP_UUID_LEN_16 : ESP_UUID_LEN_32;
+    if (native.len == ESP_UUID_LEN_16) native.uuid.uuid16 = number;
+    else native.uuid.uuid32 = number;
+    valueSet = true;
+  } else if (hex.size() == 32) {
+    // Stored least significant byte first, as the ESP-IDF does
+    native.len = ESP_UUID_LEN_128;
+    for (int i = 0; i < 16; i++) {
+      native.uuid.uuid128[15 - i] = hexNibble(hex[2 * i]) << 4 | hexNibble(hex[2 * i + 1]);
+    }
+    valueSet = true;
+  }
+}
+
+BLEUUID::BLEUUID(uint16_t uuid) : BLEUUID() {
+  native.len = ESP_UUID_LEN_16;
+  native.uuid.uuid16 = uuid;
+  valueSet = true;
+}
+
+BLEUUID::BLEUUID(uint32_t uuid) : BLEUUID() {
+  native.len = ESP_UUID_LEN_32;
+  native.uuid.uuid32 = uuid;
+  valueSet = true;
+}
+
+BLEUUID::BLEUUID(esp_bt_uuid_t uuid) : native(uuid), valueSet(true) {
+}
+
+bool BLEUUID::equals(BLEUUID other) {
+  return valueSet && other.valueSet && toString() == other.toString();
+}
+
+uint8_t BLEUUID::bitSize() {
+  return valueSet ? native.len * 8 : 0;
+}
+
+BLEUUID BLEUUID::to128() {
+  if (!valueSet || native.len == ESP_UUID_LEN_128) return *this;
+  return BLEUUID(toString());
+}
+
+std::string BLEUUID::toString() {
+  if (!valueSet) return "<NULL>";
+  char text[40];
+  if (native.len == ESP_UUID_LEN_16) {
+    snprintf(text, sizeof(text), "0000%04x%s", native.uuid.uuid16, BASE_UUID_SUFFIX);
+  } else if (native.len == ESP_UUID_LEN_32) {
+    snprintf(text, sizeof(text), "%08x%s", native.uuid.uuid32, BASE_UUID_SUFFIX);
+  } else {
+    const uint8_t* b = native.uuid.uuid128;
+    snprintf(text, sizeof(text), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[15], b[14], b[13], b[12], b[11], b[10], b[9], b[8], b[7], b[6], b[5], b[4], b[3], b[2],
+             b[1], b[0]);
+  }
+  return text;
+}
+
+// ---- BLEAddress ----------------------------------------------------------------------
+
+BLEAddress::BLEAddress(esp_bd_addr_t address) {
+  memcpy(native, address, 6);
+}
+
+BLEAddress::BLEAddress(std::string address) {
+  memset(native, 0, 6);
+  for (int i = 0; i < 6 && (size_t)(i * 3 + 1) < address.size(); i++) {
+    int high = hexNibble(address[i * 3]);
+    int low = hexNibble(address[i * 3 + 1]);
+    if (high < 0 || low < 0) break;
+    native[i] = high << 4 | low;
+  }
+}
+
+std::string BLEAddress::toString() {
+  char text[18];
+  snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", native[0], native[1], native[2], native[3],
+           native[4], native[5]);
+  return text;
+}
+
+// ---- BLEScan -------------------------------------------------------------------------
+
+BLEScan* BLEDevice::getScan() {
+  static BLEScan scan;
+  return &scan;
+}
+
+void BLEDevice::setCustomGattcHandler(gattc_event_handler handler) {
+  bleSim.customHandler = handler;
+}
+
+void BLEDevice::setSecurityCallbacks(BLESecurityCallbacks* callbacks) {
+  bleSim.securityCallbacks = callbacks;
+}
+
+void BLEScan::setAdvertisedDeviceCallbacks(BLEAdvertisedDeviceCallbacks* deviceCallbacks, bool duplicates,
+                                           bool shouldParse) {
+  (void)shouldParse;
+  callbacks = deviceCallbacks;
+  wantDuplicates = duplicates;
+}
+
+bool BLEScan::start(uint32_t duration, void (*scanCompleteCB)(BLEScanResults), bool is_continue) {
+  if (!is_continue) results.devices.clear();
+  completeCB = scanCompleteCB;
+  bleSim.startScan(this, duration * 1000);
+  return true;
+}
+
+BLEScanResults BLEScan::start(uint32_t duration, bool is_continue) {
+  start(duration, nullptr, is_continue);
+  while (scanning) simAdvance(10000);
+  return results;
+}
+
+void BLEScan::stop() {
+  scanning = false;
+  generation++;
+}
+
+void BLEScan::deliver(const BLEAdvertisedDevice& device) {
+  BLEAdvertisedDevice copy = device;
+  bool seen = false;
+  for (auto& known : results.devices) {
+    if (known.getAddress().equals(copy.getAddress())) seen = true;
+  }
+  // Without duplicates the host filters repeat reports of an address it already has
+  if (seen && !wantDuplicates) return;
+  if (!seen) results.devices.push_back(copy);
+  bleSim.stats.advertsDelivered++;
+  if (callbacks) callbacks->onResult(copy);
+}
+
+void BLEScan::complete(uint32_t scanGeneration) {
+  if (!scanning || scanGeneration != generation) return;
+  scanning = false;
+  bleSim.stats.scansCompleted++;
+  if (completeCB) completeCB(results);
+}
+
+// ---- BLERemoteDescriptor -------------------------------------------------------------
+
+std::string BLERemoteDescriptor::readValue() {
+  BLEClient* client = characteristic->getRemoteService()->getClient();
+  if (!value || !bleSim.attRequest(client, true)) return "";
+  return *value;
+}
+
+void BLERemoteDescriptor::writeValue(uint8_t* data, size_t length, bool response) {
+  (void)data;
+  (void)length;
+  (void)response;
+  bleSim.attRequest(characteristic->getRemoteService()->getClient(), false);
+}
+
+// ---- BLERemoteCharacteristic ---------------------------------------------------------
+
+BLERemoteCharacteristic::BLERemoteCharacteristic(BLERemoteService* owner, SimCharacteristic* characteristicModel)
+  : service(owner), model(characteristicModel), uuid(characteristicModel->uuid),
+    handle(characteristicModel->handle), properties(characteristicModel->properties) {
+}
+
+BLERemoteCharacteristic::~BLERemoteCharacteristic() {
+  bleSim.forget(this);
+  for (auto& descriptor : descriptors) delete descriptor.second;
+}
+
+std::map<std::string, BLERemoteDescriptor*>* BLERemoteCharacteristic::getDescriptors() {
+  if (!descriptorsDiscovered && bleSim.attRequest(service->getClient(), false)) {
+    descriptorsDiscovered = true;
+    uint16_t next = handle + 1;
+    if (!model->cpf.empty()) {
+      BLEUUID cpfUUID((uint16_t)0x2904);
+      descriptors[cpfUUID.toString()] = new BLERemoteDescriptor(this, cpfUUID, next++, &model->cpf);
+    }
+    if (canNotify() || canIndicate()) {
+      BLEUUID cccdUUID((uint16_t)0x2902);
+      descriptors[cccdUUID.toString()] = new BLERemoteDescriptor(this, cccdUUID, next++, nullptr);
+    }
+  }
+  return &descriptors;
+}
+
+BLERemoteDescriptor* BLERemoteCharacteristic::getDescriptor(BLEUUID descriptorUUID) {
+  auto found = getDescriptors()->find(descriptorUUID.toString());
+  return found == descriptors.end() ? nullptr : found->second;
+}
+
+std::string BLERemoteCharacteristic::readValue() {
+  if (!bleSim.attRequest(service->getClient(), true)) return "";
+  // Insufficient authentication comes back as an error response, like any failed read
+  if (bleSim.refused(service->getClient(), model)) return "";
+  return model->value;
+}
+
+void BLERemoteCharacteristic::writeValue(uint8_t* data, size_t length, bool response) {
+  bleSim.write(service->getClient(), model, data, length, response);
+}
+
+void BLERemoteCharacteristic::writeValue(std::string value, bool response) {
+  writeValue(reinterpret_cast<uint8_t*>(&value[0]), value.size(), response);
+}
+
+void BLERemoteCharacteristic::registerForNotify(notify_callback callback, bool useNotifications,
+                                                bool descriptorRequiresRegistration) {
+  notifyCallback = callback;
+  notifications = useNotifications;
+  if (descriptorRequiresRegistration && !bleSim.attRequest(service->getClient(), false)) return;
+  bleSim.subscribe(this, callback != nullptr);
+}
+
+// ---- BLERemoteService ----------------------------------------------------------------
+
+BLERemoteService::BLERemoteService(BLEClient* owner, SimService* serviceModel)
+  : client(owner), model(serviceModel), uuid(serviceModel->uuid) {
+}
+
+BLERemoteService::~BLERemoteService() {
+  for (auto& characteristic : characteristicsByHandle) delete characteristic.second;
+}
+
+std::map<std::string, BLERemoteCharacteristic*>* BLERemoteService::getCharacteristics() {
+  if (!characteristicsDiscovered) {
+    // One discovery round trip per characteristic; a failure leaves the map partial
+    for (auto& characteristic : model->characteristics) {
+      if (!bleSim.attRequest(client, false)) return &characteristics;
+      BLERemoteCharacteristic* remote = new BLERemoteCharacteristic(this, &characteristic);
+      // As in Bluedroid, the UUID map keeps the first of a repeated UUID
+      characteristics.insert(std::make_pair(characteristic.uuid.toString(), remote));
+      characteristicsByHandle[remote->getHandle()] = remote;
+    }
+    characteristicsDiscovered = true;
+  }
+  return &characteristics;
+}
+
+std::map<uint16_t, BLERemoteCharacteristic*>* BLERemoteService::getCharacteristicsByHandle() {
+  getCharacteristics();
+  return &characteristicsByHandle;
+}
+
+BLERemoteCharacteristic* BLERemoteService::getCharacteristic(BLEUUID characteristicUUID) {
+  auto found = getCharacteristics()->find(characteristicUUID.toString());
+  return found == characteristics.end() ? nullptr : found->second;
+}
+
+// ---- BLEClient -----------------------------------------------------------------------
+
+BLEClient::BLEClient() {
+  bleSim.stats.clientsCreated++;
+  bleSim.track(this);
+}
+
+BLEClient::~BLEClient() {
+  if (droppedAtUs) bleSim.stats.disconnectReactionUs.push_back(simNowUs() - droppedAtUs);
+  clearServices();
+  bleSim.forget(this);
+}
+
+void BLEClient::clearServices() {
+  for (auto& service : services) delete service.second;
+  services.clear();
+  servicesDiscovered = false;
+}
+
+bool BLEClient::connect(BLEAdvertisedDevice* device) {
+  return connect(device->getAddress(), device->getAddressType());
+}
+
+bool BLEClient::connect(BLEAddress address, esp_ble_addr_type_t type) {
+  (void)type;
+  clearServices();
+  return bleSim.connect(this, bleSim.find(address.toString()));
+}
+
+void BLEClient::disconnect() {
+  // The firmware releasing a client the peer dropped, whether it deletes or reuses it
+  if (droppedAtUs) bleSim.stats.disconnectReactionUs.push_back(simNowUs() - droppedAtUs);
+  droppedAtUs = 0;
+  bleSim.disconnect(this);
+}
+
+std::map<std::string, BLERemoteService*>* BLEClient::getServices() {
+  if (!servicesDiscovered) {
+    if (!connected) return nullptr;
+    for (auto& service : peer->services) {
+      if (!bleSim.attRequest(this, false)) {
+        clearServices();
+        return nullptr;
+      }
+      services[service.uuid.toString()] = new BLERemoteService(this, &service);
+    }
+    servicesDiscovered = true;
+  }
+  return &services;
+}
+
+BLERemoteService* BLEClient::getService(BLEUUID uuid) {
+  auto all = getServices();
+  if (!all) return nullptr;
+  auto found = all->find(uuid.toString());
+  return found == all->end() ? nullptr : found->second;
+}
+
+BLEAddress BLEClient::getPeerAddress() {
+  return BLEAddress(peer ? peer->address : std::string("00:00:00:00:00:00"));
+}
+
+int BLEClient::getRssi() {
+  return peer && connected ? peer->rssi : 0;
+}
+
+// ---- Queued writes -------------------------------------------------------------------
+
+struct PreparedWrite {
+  uint16_t connId;
+  SimCharacteristic* target;
+  uint16_t offset;
+  std::string data;
+};
+static std::vector<PreparedWrite> preparedWrites;
+
+esp_err_t esp_ble_gattc_prepare_write(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t offset,
+                                      uint16_t value_len, uint8_t* value, esp_gatt_auth_req_t auth_req) {
+  (void)auth_req;
+  BLEClient* client = bleSim.clientByConnId(conn_id);
+  if (!client || !client->isConnected()) return ESP_FAIL;
+  SimCharacteristic* target = bleSim.findHandle(bleSim.find(client->getPeerAddress().toString()), handle);
+  if (!target) return ESP_FAIL;
+
+  preparedWrites.push_back({conn_id, target, offset, std::string(reinterpret_cast<char*>(value), value_len)});
+  simSchedule(SIM_ATT_ROUND_TRIP_MS * 1000, [=]() {
+    if (!bleSim.customHandler) return;
+    esp_ble_gattc_cb_param_t param;
+    param.write.status = ESP_GATT_OK;
+    param.write.conn_id = conn_id;
+    param.write.handle = handle;
+    param.write.offset = offset;
+    bleSim.customHandler(ESP_GATTC_PREP_WRITE_EVT, gattc_if, &param);
+  });
+  return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_execute_write(esp_gatt_if_t gattc_if, uint16_t conn_id, bool is_execute) {
+  BLEClient* client = bleSim.clientByConnId(conn_id);
+  if (!client || !client->isConnected()) return ESP_FAIL;
+
+  simSchedule(SIM_ATT_ROUND_TRIP_MS * 1000, [=]() {
+    for (auto it = preparedWrites.begin(); it != preparedWrites.end();) {
+      if (it->connId != conn_id) {
+        ++it;
+        continue;
+      }
+      if (is_execute) {
+        std::string& value = it->target->value;
+        if (value.size() < it->offset + it->data.size()) value.resize(it->offset + it->data.size());
+        value.replace(it->offset, it->data.size(), it->data);
+      }
+      it = preparedWrites.erase(it);
+    }
+    if (!bleSim.customHandler) return;
+    esp_ble_gattc_cb_param_t param;
+    param.exec_cmpl.status = ESP_GATT_OK;
+    param.exec_cmpl.conn_id = conn_id;
+    bleSim.customHandler(ESP_GATTC_EXEC_EVT, gattc_if, &param);
+  });
+  return ESP_OK;
+}
+
+// ---- Read Multiple -------------------------------------------------------------------
+
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                  esp_gatt_auth_req_t auth_req) {
+  (void)auth_req;
+  BLEClient* client = bleSim.clientByConnId(conn_id);
+  if (!client || !client->isConnected()) return ESP_FAIL;
+  SimCharacteristic* target = bleSim.findHandle(bleSim.find(client->getPeerAddress().toString()), handle);
+  if (!target) return ESP_FAIL;
+
+  esp_gatt_status_t status = bleSim.attRequest(client, true) && !bleSim.refused(client, target) &&
+                                     (target->properties & SIM_READ)
+                                 ? ESP_GATT_OK
+                                 : ESP_GATT_ERROR;
+  std::string value = status == ESP_GATT_OK ? target->value : std::string();
+  simSchedule(0, [=]() {
+    if (!bleSim.customHandler) return;
+    std::string copy = value;
+    esp_ble_gattc_cb_param_t param;
+    param.read.status = status;
+    param.read.conn_id = conn_id;
+    param.read.handle = handle;
+    param.read.value = reinterpret_cast<uint8_t*>(&copy[0]);
+    param.read.value_len = copy.size();
+    bleSim.customHandler(ESP_GATTC_READ_CHAR_EVT, gattc_if, &param);
+  });
+  return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_read_multiple(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gattc_multi_t* read_multi,
+                                      esp_gatt_auth_req_t auth_req) {
+  (void)auth_req;
+  BLEClient* client = bleSim.clientByConnId(conn_id);
+  if (!client || !client->isConnected() || read_multi->num_attr > ESP_GATT_MAX_READ_MULTI_HANDLES) return ESP_FAIL;
+  SimPeripheral* peripheral = bleSim.find(client->getPeerAddress().toString());
+
+  // One request and one response, however many handles: the values are concatenated and
+  // cut at MTU - 1, so only the last one may be variable length
+  esp_gatt_status_t status = bleSim.attRequest(client, true) ? ESP_GATT_OK : ESP_GATT_ERROR;
+  std::string value;
+  for (uint8_t i = 0; i < read_multi->num_attr && status == ESP_GATT_OK; i++) {
+    SimCharacteristic* target = bleSim.findHandle(peripheral, read_multi->handles[i]);
+    if (!target || !(target->properties & SIM_READ) || bleSim.refused(client, target)) {
+      status = ESP_GATT_ERROR;
+      break;
+    }
+    value += target->value;
+  }
+  if (value.size() > (size_t)client->getMTU() - 1) value.resize(client->getMTU() - 1);
+  bleSim.stats.readMultiples++;
+
+  uint16_t first = read_multi->num_attr ? read_multi->handles[0] : 0;
+  simSchedule(0, [=]() {
+    if (!bleSim.customHandler) return;
+    std::string copy = value;
+    esp_ble_gattc_cb_param_t param;
+    param.read.status = status;
+    param.read.conn_id = conn_id;
+    param.read.handle = first;
+    param.read.value = reinterpret_cast<uint8_t*>(&copy[0]);
+    param.read.value_len = copy.size();
+    bleSim.customHandler(ESP_GATTC_READ_MULTIPLE_EVT, gattc_if, &param);
+  });
+  return ESP_OK;
+}
+
+// ---- GAP security --------------------------------------------------------------------
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act) {
+  (void)sec_act;
+  return bleSim.encrypt(BLEAddress(bd_addr).toString()) ? ESP_OK : ESP_FAIL;
+}
+
+int esp_ble_get_bond_device_num(void) {
+  return bleSim.bonds().size();
+}
+
+esp_err_t esp_ble_get_bond_device_list(int* dev_num, esp_ble_bond_dev_t* dev_list) {
+  std::vector<std::string>& bonds = bleSim.bonds();
+  int count = std::min<int>(*dev_num, bonds.size());
+  for (int i = 0; i < count; i++) {
+    esp_ble_bond_dev_t& entry = dev_list[i];
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.bd_addr, *BLEAddress(bonds[i]).getNative(), 6);
+    entry.bond_key.key_mask = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    entry.bond_key.pid_key.addr_type = BLE_ADDR_TYPE_PUBLIC;
+    memcpy(entry.bond_key.pid_key.static_addr, entry.bd_addr, 6);
+    for (auto& peripheral : bleSim.peripherals()) {
+      if (peripheral.identity == bonds[i]) memcpy(entry.bond_key.pid_key.irk, peripheral.irk, 16);
+    }
+  }
+  *dev_num = count;
+  return ESP_OK;
+}
+
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr) {
+  std::vector<std::string>& bonds = bleSim.bonds();
+  auto found = std::find(bonds.begin(), bonds.end(), BLEAddress(bd_addr).toString());
+  if (found == bonds.end()) return ESP_FAIL;
+  bonds.erase(found);
+  return ESP_OK;
+}
+
+// ---- BleSim --------------------------------------------------------------------------
+
+uint32_t BleSim::random(uint32_t bound) {
+  // xorshift32: runs are reproducible for a given seed
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return bound ? rng % bound : 0;
+}
+
+bool BleSim::chance(float probability) {
+  return probability > 0 && random(1000000) < probability * 1000000;
+}
+
+static std::string le16(uint16_t value) {
+  return std::string{(char)(value & 0xFF), (char)(value >> 8)};
+}
+
+static std::string cpf(uint8_t format, int8_t exponent, uint16_t unit) {
+  return std::string{(char)format, (char)exponent, (char)(unit & 0xFF), (char)(unit >> 8), 0x01, 0x00, 0x00};
+}
+
+static SimCharacteristic makeCharacteristic(const char* uuid, uint8_t properties, const std::string& value,
+                                            const std::string& format = std::string(), uint32_t periodMs = 0) {
+  SimCharacteristic characteristic;
+  characteristic.uuid = BLEUUID(std::string(uuid));
+  characteristic.properties = properties;
+  characteristic.handle = 0;
+  characteristic.value = value;
+  characteristic.cpf = format;
+  characteristic.notifyPeriodMs = periodMs;
+  characteristic.isControl = false;
+  characteristic.subscribed = false;
+  characteristic.notifyScheduled = false;
+  return characteristic;
+}
+
+// Nudges a little-endian 16-bit reading by up to +/-step, kept within [low, high]
+static std::function<void(SimCharacteristic&)> drift(int16_t step, int16_t low, int16_t high) {
+  return [=](SimCharacteristic& c) {
+    int16_t value = (uint8_t)c.value[0] | (uint8_t)c.value[1] << 8;
+    value += (int16_t)bleSim.random(2 * step + 1) - step;
+    value = std::max(low, std::min(high, value));
+    c.value = le16(value);
+  };
+}
+
+void BleSim::createFleet(size_t count, uint32_t seed) {
+  rng = seed ? seed : 1;
+  fleet.clear();
+  clients.clear();
+  listeners.clear();
+  bondList.clear();
+  stats = SimStats();
+
+  for (size_t n = 0; n < count; n++) {
+    SimPeripheral bike;
+    char text[32];
+    snprintf(text, sizeof(text), "c4:de:e2:%02x:%02x:%02x", (unsigned)(n >> 8) & 0xFF, (unsigned)n & 0xFF,
+             (unsigned)random(256));
+    bike.address = text;
+    bike.addressType = BLE_ADDR_TYPE_PUBLIC;
+    bike.identity = bike.address;
+    for (int i = 0; i < 16; i++) bike.irk[i] = (uint8_t)(0x3C + 29 * n + 71 * i);  // leaves the RNG alone
+    bike.addressSinceUs = 0;
+    snprintf(text, sizeof(text), "Skp-%04u", (unsigned)(n + 1));
+    bike.name = text;
+    bike.rssi = -45 - (int)random(45);
+    bike.link = nullptr;
+    bike.disconnectAfterControlMs = 500;
+    bike.idleTimeoutMs = 30000;
+    bike.lastActivityUs = 0;
+    bike.encryptionRequired = true;  // production firmware
+    bike.bonded = false;
+
+    SimService dis;
+    dis.uuid = BLEUUID((uint16_t)0x180A);
+    snprintf(text, sizeof(text), "SKP%06u", (unsigned)(100000 + n));
+    dis.characteristics.push_back(makeCharacteristic("2A29", SIM_READ, "Skarper Ltd"));
+    dis.characteristics.push_back(makeCharacteristic("2A24", SIM_READ, "DiscDrive"));
+    dis.characteristics.push_back(makeCharacteristic("2A25", SIM_READ, text));
+    dis.characteristics.push_back(makeCharacteristic("2A27", SIM_READ, "C"));
+    dis.characteristics.push_back(makeCharacteristic("2A26", SIM_READ, "2.4.1"));
+    dis.characteristics.push_back(makeCharacteristic("2A28", SIM_READ, "1.9.0"));
+    bike.services.push_back(dis);
+
+    SimService battery;
+    battery.uuid = BLEUUID((uint16_t)0x180F);
+    SimCharacteristic level = makeCharacteristic("2A19", SIM_READ | SIM_NOTIFY,
+                                                 std::string(1, (char)(60 + random(40))), "", 1000);
+    level.update = [](SimCharacteristic& c) {
+      if (bleSim.random(30) == 0 && (uint8_t)c.value[0] > 5) c.value[0]--;
+    };
+    battery.characteristics.push_back(level);
+    SimCharacteristic voltage = makeCharacteristic("B1F879A3-4999-4F4A-AF05-B5A6FB6AB55D", SIM_READ | SIM_NOTIFY,
+                                                   le16(3650 + random(200)), cpf(0x06, -2, 0x27AE), 1000);
+    voltage.update = drift(3, 3000, 4200);
+    battery.characteristics.push_back(voltage);
+    SimCharacteristic current = makeCharacteristic("B1F879A4-4999-4F4A-AF05-B5A6FB6AB55D", SIM_READ | SIM_NOTIFY,
+                                                   le16(120), cpf(0x0A, -2, 0x27AC), 1000);
+    current.update = drift(40, -2000, 2000);
+    battery.characteristics.push_back(current);
+    bike.services.push_back(battery);
+
+    SimService temperature;
+    temperature.uuid = BLEUUID(std::string("B1F8799E-4999-4F4A-AF05-B5A6FB6AB55D"));
+    SimCharacteristic motor = makeCharacteristic("B1F8799F-4999-4F4A-AF05-B5A6FB6AB55D", SIM_READ | SIM_NOTIFY,
+                                                 le16(2450 + random(300)), cpf(0x0A, -2, 0x27B1), 2000);
+    motor.update = drift(15, -1000, 8000);
+    temperature.characteristics.push_back(motor);
+    SimCharacteristic pack = makeCharacteristic("B1F879A0-4999-4F4A-AF05-B5A6FB6AB55D", SIM_READ | SIM_NOTIFY,
+                                                le16(2200 + random(300)), cpf(0x0A, -2, 0x27B1), 2000);
+    pack.update = drift(5, -1000, 6000);
+    temperature.characteristics.push_back(pack);
+    bike.services.push_back(temperature);
+
+    SimService csc;
+    csc.uuid = BLEUUID((uint16_t)0x1816);
+    SimCharacteristic measurement = makeCharacteristic("2A5B", SIM_NOTIFY, std::string(11, '\0'), "", 1000);
+    measurement.value[0] = 0x03;
+    measurement.update = [](SimCharacteristic& c) {
+      uint8_t* bytes = reinterpret_cast<uint8_t*>(&c.value[0]);
+      for (int i = 1; i < 5 && ++bytes[i] == 0; i++) {}  // cumulative wheel revolutions
+    };
+    csc.characteristics.push_back(measurement);
+    csc.characteristics.push_back(makeCharacteristic("2A5C", SIM_READ, le16(0x0003)));
+    bike.services.push_back(csc);
+
+    SimService user;
+    user.uuid = BLEUUID(std::string("B1F879A7-4999-4F4A-AF05-B5A6FB6AB55D"));
+    user.characteristics.push_back(makeCharacteristic("B1F879A8-4999-4F4A-AF05-B5A6FB6AB55D",
+                                                      SIM_READ | SIM_WRITE, le16(7500)));
+    user.characteristics.push_back(makeCharacteristic("B1F879A9-4999-4F4A-AF05-B5A6FB6AB55D",
+                                                      SIM_READ | SIM_WRITE, std::string(1, '\x02')));
+    user.characteristics.push_back(makeCharacteristic("B1F879AA-4999-4F4A-AF05-B5A6FB6AB55D",
+                                                      SIM_READ | SIM_WRITE, le16(2155)));
+    bike.services.push_back(user);
+
+    SimService control;
+    control.uuid = BLEUUID(std::string("B1F879B4-4999-4F4A-AF05-B5A6FB6AB55D"));
+    SimCharacteristic reg = makeCharacteristic("B1F879B5-4999-4F4A-AF05-B5A6FB6AB55D",
+                                               SIM_READ | SIM_WRITE | SIM_WRITE_NR, std::string(4, '\0'));
+    reg.isControl = true;
+    control.characteristics.push_back(reg);
+    bike.services.push_back(control);
+
+    // Attribute handles in declaration order: service, then declaration, value and descriptors
+    uint16_t handle = 1;
+    for (auto& service : bike.services) {
+      handle++;
+      for (auto& characteristic : service.characteristics) {
+        characteristic.handle = handle + 1;
+        handle += 2 + !characteristic.cpf.empty() +
+                  ((characteristic.properties & (SIM_NOTIFY | SIM_INDICATE)) != 0);
+      }
+    }
+    fleet.push_back(bike);
+  }
+}
+
+SimPeripheral* BleSim::find(const std::string& address) {
+  for (auto& peripheral : fleet) {
+    if (peripheral.address == address) return &peripheral;
+  }
+  return nullptr;
+}
+
+SimCharacteristic* BleSim::findHandle(SimPeripheral* peripheral, uint16_t handle) {
+  if (!peripheral) return nullptr;
+  for (auto& service : peripheral->services) {
+    for (auto& characteristic : service.characteristics) {
+      if (characteristic.handle == handle) return &characteristic;
+    }
+  }
+  return nullptr;
+}
+
+BLEClient* BleSim::clientByConnId(uint16_t connId) {
+  for (BLEClient* client : clients) {
+    if (client->connId == connId) return client;
+  }
+  return nullptr;
+}
+
+bool BleSim::alive(BLEClient* client) {
+  return std::find(clients.begin(), clients.end(), client) != clients.end();
+}
+
+void BleSim::forget(BLEClient* client) {
+  if (client->peer && client->peer->link == client) releaseLink(client->peer);
+  clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+}
+
+void BleSim::forget(BLERemoteCharacteristic* characteristic) {
+  listeners.erase(std::remove(listeners.begin(), listeners.end(), characteristic), listeners.end());
+}
+
+void BleSim::noteFault() {
+  if (stats.faultPending) return;
+  stats.faultPending = true;
+  stats.rescanPending = true;
+  stats.faultStartUs = simNowUs();
+}
+
+void BleSim::touch(SimPeripheral* peripheral) {
+  peripheral->lastActivityUs = simNowUs();
+  BLEClient* client = peripheral->link;
+  uint64_t idleUs = (uint64_t)peripheral->idleTimeoutMs * 1000;
+  simSchedule(idleUs, [=]() {
+    if (peripheral->link != client || !alive(client) || !client->connected) return;
+    if (simNowUs() - peripheral->lastActivityUs < idleUs) return;
+    stats.idleDisconnects++;
+    dropLink(client, false);
+  });
+}
+
+void BleSim::releaseLink(SimPeripheral* peripheral) {
+  // Without bonding the unit forgets its CCCDs along with the link, and it has acted on
+  // (and cleared) whatever was in the Control Register
+  for (auto& service : peripheral->services) {
+    for (auto& characteristic : service.characteristics) {
+      characteristic.subscribed = false;
+      if (characteristic.isControl) characteristic.value.assign(characteristic.value.size(), '\0');
+    }
+  }
+  peripheral->link = nullptr;
+}
+
+bool BleSim::connect(BLEClient* client, SimPeripheral* peripheral) {
+  stats.connectAttempts++;
+  // Gone out of range, already taken by another central, or the request was lost
+  if (!peripheral || peripheral->link || chance(faults.connectFailRate)) {
+    noteFault();
+    simAdvance((uint64_t)SIM_CONNECT_TIMEOUT_MS * 1000);
+    stats.connectFailures++;
+    return false;
+  }
+
+  simAdvance((uint64_t)(SIM_CONNECT_MS + random(20)) * 1000);
+  client->peer = peripheral;
+  client->connected = true;
+  client->closing = false;
+  client->encrypted = false;
+  client->droppedAtUs = 0;
+  client->connId = nextConnId++;
+  client->mtu = 23;
+  peripheral->link = client;
+  touch(peripheral);
+  stats.connects++;
+  if (stats.faultPending) {
+    stats.recoveryMs.push_back((simNowUs() - stats.faultStartUs) / 1000);
+    stats.faultPending = false;
+  }
+  if (client->callbacks) client->callbacks->onConnect(client);
+  return true;
+}
+
+void BleSim::disconnect(BLEClient* client) {
+  if (!client->connected || client->closing) return;
+  client->closing = true;
+  simSchedule(SIM_TEARDOWN_MS * 1000, [=]() {
+    if (!alive(client) || !client->closing) return;
+    client->closing = false;
+    client->connected = false;
+    client->encrypted = false;
+    if (client->peer && client->peer->link == client) releaseLink(client->peer);
+    if (client->callbacks) client->callbacks->onDisconnect(client);
+  });
+}
+
+void BleSim::dropLink(BLEClient* client, bool fault) {
+  if (fault) stats.linkDrops++;
+  client->connected = false;
+  client->closing = false;
+  client->encrypted = false;
+  if (client->peer && client->peer->link == client) releaseLink(client->peer);
+  simSchedule(1000, [=]() {
+    if (!alive(client)) return;
+    client->droppedAtUs = simNowUs();
+    if (client->callbacks) client->callbacks->onDisconnect(client);
+  });
+}
+
+bool BleSim::attRequest(BLEClient* client, bool isRead) {
+  if (!client || !alive(client) || !client->connected) return false;
+  stats.attRequests++;
+  touch(client->peer);
+
+  if (isRead && chance(faults.dropPerRead)) {
+    // The request never completes; the link is declared lost after the supervision timeout
+    noteFault();
+    simAdvance((uint64_t)SIM_SUPERVISION_TIMEOUT_MS * 1000);
+    if (alive(client) && client->connected) dropLink(client, true);
+    return false;
+  }
+
+  uint32_t latencyMs = SIM_ATT_ROUND_TRIP_MS + faults.attLatencyMs + random(faults.attJitterMs + 1);
+  simAdvance((uint64_t)latencyMs * 1000);
+  if (!alive(client) || !client->connected) return false;
+
+  if (isRead && chance(faults.readErrorRate)) {
+    stats.readErrors++;
+    return false;
+  }
+  return true;
+}
+
+bool BleSim::write(BLEClient* client, SimCharacteristic* target, const uint8_t* data, size_t length,
+                   bool response) {
+  if (response) {
+    if (!attRequest(client, false)) return false;
+  } else {
+    // Write without response is queued locally and leaves in the next connection event
+    if (!client || !alive(client) || !client->connected) return false;
+    stats.attRequests++;
+    touch(client->peer);
+    simAdvance(1000);
+  }
+
+  if (refused(client, target)) return false;
+  if (target->isControl && chance(faults.controlWriteFailRate)) {
+    stats.writesDropped++;
+    return false;
+  }
+  target->value.assign(reinterpret_cast<const char*>(data), length);
+
+  static const uint8_t magic[] = {0x33, 0x74, 0x12, 0xE4};
+  SimPeripheral* peripheral = client->peer;
+  if (target->isControl && length == sizeof(magic) && memcmp(data, magic, length) == 0 &&
+      peripheral->disconnectAfterControlMs) {
+    simSchedule((uint64_t)peripheral->disconnectAfterControlMs * 1000, [=]() {
+      if (peripheral->link == client && alive(client) && client->connected) dropLink(client, false);
+    });
+  }
+  return true;
+}
+
+bool BleSim::refused(BLEClient* client, SimCharacteristic* target) {
+  if (!target->isControl || !client->peer->encryptionRequired || client->encrypted) return false;
+  stats.authRefused++;
+  return true;
+}
+
+bool BleSim::encrypt(const std::string& address) {
+  BLEClient* client = nullptr;
+  for (BLEClient* candidate : clients) {
+    // The stack takes the identity address of a bonded unit as well as the one it connected to
+    if (candidate->connected && candidate->peer &&
+        (candidate->peer->address == address || candidate->peer->identity == address)) {
+      client = candidate;
+    }
+  }
+  if (!client) return false;
+  SimPeripheral* peripheral = client->peer;
+  if (client->encrypted) {
+    simSchedule(1000, [=]() { authComplete(client, true, 0); });
+    return true;
+  }
+
+  bool stored = std::find(bondList.begin(), bondList.end(), peripheral->identity) != bondList.end();
+  if (stored) {
+    // The unit answers with its copy of the LTK, unless it was reflashed since it paired
+    if (peripheral->bonded && chance(faults.bondLossRate)) peripheral->bonded = false;
+    bool resumed = peripheral->bonded;
+    simSchedule((uint64_t)SIM_ENCRYPT_MS * 1000, [=]() {
+      if (resumed) stats.encryptions++;
+      else stats.keyMissing++;
+      authComplete(client, resumed, resumed ? 0 : 0x06);  // PIN or key missing
+    });
+    return true;
+  }
+
+  simSchedule((uint64_t)SIM_PAIRING_MS * 1000, [=]() {
+    // Bluedroid refuses to pair once its bond storage is full
+    if (bondList.size() >= SIM_MAX_BONDS) {
+      stats.pairingFailures++;
+      authComplete(client, false, 0x08);  // unspecified reason
+      return;
+    }
+    stats.pairings++;
+    bondList.push_back(peripheral->identity);
+    peripheral->bonded = true;
+    authComplete(client, true, 0);
+  });
+  return true;
+}
+
+void BleSim::authComplete(BLEClient* client, bool success, uint8_t reason) {
+  if (!alive(client) || !client->connected) return;
+  client->encrypted = success;
+  if (!securityCallbacks) return;
+  esp_ble_auth_cmpl_t result;
+  memset(&result, 0, sizeof(result));
+  memcpy(result.bd_addr, *client->getPeerAddress().getNative(), 6);
+  result.key_present = success;
+  result.success = success;
+  result.fail_reason = reason;
+  result.addr_type = client->peer->addressType;
+  result.auth_mode = ESP_LE_AUTH_REQ_SC_BOND;
+  securityCallbacks->onAuthenticationComplete(result);
+}
+
+void BleSim::subscribe(BLERemoteCharacteristic* characteristic, bool enable) {
+  forget(characteristic);
+  BLEClient* client = characteristic->getRemoteService()->getClient();
+  if (!alive(client) || !client->connected) return;
+
+  SimCharacteristic* model = characteristic->model;
+  model->subscribed = enable;
+  if (!enable) return;
+  listeners.push_back(characteristic);
+  scheduleNotify(client->peer, model);
+}
+
+void BleSim::scheduleNotify(SimPeripheral* peripheral, SimCharacteristic* characteristic) {
+  if (characteristic->notifyScheduled || characteristic->notifyPeriodMs == 0) return;
+  characteristic->notifyScheduled = true;
+  simSchedule((uint64_t)characteristic->notifyPeriodMs * 1000, [=]() {
+    characteristic->notifyScheduled = false;
+    if (!characteristic->subscribed || !peripheral->link) return;
+    if (characteristic->update) characteristic->update(*characteristic);
+
+    std::string value = characteristic->value;
+    for (size_t i = 0; i < listeners.size(); i++) {
+      BLERemoteCharacteristic* listener = listeners[i];
+      if (listener->model != characteristic || listener->getRemoteService()->getClient() != peripheral->link) {
+        continue;
+      }
+      stats.notifications++;
+      if (listener->notifyCallback) {
+        listener->notifyCallback(listener, reinterpret_cast<uint8_t*>(&value[0]), value.size(),
+                                 listener->notifications);
+      }
+    }
+    scheduleNotify(peripheral, characteristic);
+  });
+}
+
+BLEAdvertisedDevice BleSim::advert(const std::string& address, const std::string& name, int rssi,
+                                   esp_ble_addr_type_t addressType) {
+  BLEAdvertisedDevice device;
+  device.address = BLEAddress(address);
+  device.addressType = addressType;
+  device.name = name;
+  device.rssi = rssi;
+  return device;
+}
+
+// prand with its top bits 01, then ah(IRK, prand) = e(IRK, 0^104 | prand) mod 2^24
+std::string BleSim::privateAddress(const uint8_t* irk) {
+  uint8_t key[16];
+  for (int i = 0; i < 16; i++) key[i] = irk[15 - i];
+  uint8_t block[16] = {0};
+  block[13] = 0x40 | random(0x40);
+  block[14] = random(256);
+  block[15] = random(256);
+  esp_bd_addr_t address;
+  memcpy(address, block + 13, 3);
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, key, 128);
+  mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, block, block);
+  mbedtls_aes_free(&aes);
+  memcpy(address + 3, block + 13, 3);
+  return BLEAddress(address).toString();
+}
+
+void BleSim::renewAddress(SimPeripheral& peripheral) {
+  peripheral.address = privateAddress(peripheral.irk);
+  peripheral.addressType = BLE_ADDR_TYPE_RANDOM;
+  peripheral.addressSinceUs = simNowUs();
+  stats.addressRotations++;
+}
+
+BLEAdvertisedDevice BleSim::advertOf(const SimPeripheral& peripheral) {
+  BLEAdvertisedDevice device;
+  device.address = BLEAddress(peripheral.address);
+  device.addressType = peripheral.addressType;
+  device.name = peripheral.name;
+  device.rssi = peripheral.rssi - 3 + (int)random(7);
+  device.serviceUUID = BLEUUID((uint16_t)0x1816);
+  device.hasServiceUUID = true;
+  return device;
+}
+
+void BleSim::startScan(BLEScan* scan, uint32_t durationMs) {
+  stats.scanStarts++;
+  if (scan->scanning) stats.overlappingScanStarts++;
+  if (stats.faultPending) stats.recoveryScanStarts++;
+  if (stats.rescanPending) {
+    stats.rescanMs.push_back((simNowUs() - stats.faultStartUs) / 1000);
+    stats.rescanPending = false;
+  }
+  scan->scanning = true;
+  uint32_t generation = ++scan->generation;
+
+  auto advertise = [=](const BLEAdvertisedDevice& device, uint32_t atMs) {
+    simSchedule((uint64_t)atMs * 1000, [=]() {
+      if (scan->scanning && scan->generation == generation) scan->deliver(device);
+    });
+  };
+
+  // Every unit in range is heard within its first few advertising intervals
+  uint32_t firstHeardMs = std::min<uint32_t>(durationMs, 1000);
+  uint64_t rotateUs = (uint64_t)faults.rpaRotateMs * 1000;
+  for (auto& peripheral : fleet) {
+    if (peripheral.link) continue;  // connected units stop advertising
+    if (rotateUs && (peripheral.addressType != BLE_ADDR_TYPE_RANDOM ||
+                     simNowUs() - peripheral.addressSinceUs >= rotateUs)) {
+      renewAddress(peripheral);
+    }
+    BLEAdvertisedDevice device = advertOf(peripheral);
+    advertise(device, random(firstHeardMs));
+
+    // A unit whose address expires during the scan is heard again under the new one
+    if (!rotateUs) continue;
+    uint64_t expiresUs = peripheral.addressSinceUs + rotateUs;
+    if (expiresUs >= simNowUs() + (uint64_t)durationMs * 1000) continue;
+    SimPeripheral* unit = &peripheral;
+    simSchedule(expiresUs - simNowUs(), [=]() {
+      if (!scan->scanning || scan->generation != generation || unit->link) return;
+      renewAddress(*unit);
+      BLEAdvertisedDevice device = advertOf(*unit);
+      advertise(device, random(100));
+    });
+  }
+
+  for (uint32_t i = 0; i < faults.floodAdverts; i++) {
+    BLEAdvertisedDevice device;
+    esp_bd_addr_t address;
+    for (int b = 0; b < 6; b++) address[b] = random(256);
+    address[0] |= 0xC0;  // static random
+    device.address = BLEAddress(address);
+    device.addressType = BLE_ADDR_TYPE_RANDOM;
+    char name[16];
+    bool matching = chance(faults.floodMatchingRate);
+    snprintf(name, sizeof(name), matching ? "Skp-X%03u" : "Dev-%04u", (unsigned)random(10000));
+    device.name = random(4) ? name : "";
+    if (matching) device.name = name;
+    device.rssi = -35 - (int)random(65);
+    device.manufacturerData = std::string(20, (char)random(256));
+    advertise(device, random(durationMs ? durationMs : 1));
+  }
+
+  simSchedule((uint64_t)durationMs * 1000, [=]() { scan->complete(generation); });
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+// Simulated BLE radio for native builds: a virtual clock, a fleet of peripherals and
+// configurable faults. The firmware runs unmodified against it through the fake BLE API.
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ---- Virtual time --------------------------------------------------------------------
+
+uint64_t simNowUs();
+// Run everything scheduled up to now + us, then leave the clock there
+void simAdvance(uint64_t us);
+void simSchedule(uint64_t delayUs, std::function<void()> action);
+void simResetClock();
+
+// ---- Console -------------------------------------------------------------------------
+
+struct SimConsole {
+  bool echo = false;
+  std::function<void(const std::string&)> onLine;  // every complete output line
+  std::function<void(const uint8_t*, size_t)> onWrite;  // raw output instead, when set (RPC frames)
+  std::string input;                               // bytes the firmware will read from Serial
+  std::string partial;
+  uint64_t bytesOut = 0;
+  uint32_t writes = 0;
+  std::deque<uint64_t> lineQueuedUs;       // when each queued input line arrived
+  std::vector<uint32_t> inputReactionUs;   // arrival to the firmware reading its newline
+};
+extern SimConsole simConsole;
+
+// Queue operator input; fires the Serial onReceive callback like the UART driver would
+void simConsoleInput(const std::string& text);
+
+// ---- Peripherals ---------------------------------------------------------------------
+
+enum SimProperty : uint8_t {
+  SIM_READ = 0x02,
+  SIM_WRITE_NR = 0x04,
+  SIM_WRITE = 0x08,
+  SIM_NOTIFY = 0x10,
+  SIM_INDICATE = 0x20
+};
+
+struct SimCharacteristic {
+  BLEUUID uuid;
+  uint8_t properties;
+  uint16_t handle;
+  std::string value;
+  std::string cpf;               // 7-byte Characteristic Presentation Format, empty if none
+  uint32_t notifyPeriodMs;       // 0: never notifies on its own
+  std::function<void(SimCharacteristic&)> update;  // advances the value before each notification
+  bool isControl;                // writes to it are subject to the control write fault
+  bool subscribed;
+  bool notifyScheduled;
+};
+
+struct SimService {
+  BLEUUID uuid;
+  std::vector<SimCharacteristic> characteristics;
+};
+
+struct SimPeripheral {
+  std::string address;                // what it advertises and is connected by
+  esp_ble_addr_type_t addressType;
+  std::string identity;               // identity address; `address` too unless it uses privacy
+  uint8_t irk[16];                    // identity resolving key, least significant byte first
+  uint64_t addressSinceUs;            // when the current resolvable private address was generated
+  std::string name;
+  int rssi;
+  std::vector<SimService> services;
+  BLEClient* link;
+  uint32_t disconnectAfterControlMs;  // the unit drops the link once it has taken the magic word
+  uint32_t idleTimeoutMs;             // ...or once the central has been silent this long
+  uint64_t lastActivityUs;
+  bool encryptionRequired;            // the Control Register refuses access over a plain link
+  bool bonded;                        // the unit holds keys from pairing with the station
+};
+
+// Radio timing without faults
+#define SIM_ATT_ROUND_TRIP_MS 15        // two 7.5 ms connection events
+#define SIM_CONNECT_MS 60               // establishment plus MTU exchange
+#define SIM_CONNECT_TIMEOUT_MS 20000    // the stack gives up on an unanswered connection
+#define SIM_SUPERVISION_TIMEOUT_MS 4000 // how long a lost link takes to be noticed
+#define SIM_TEARDOWN_MS 15              // local disconnect to disconnect event
+#define SIM_PAIRING_MS 2400             // SMP pairing and key distribution, Just Works
+#define SIM_ENCRYPT_MS 25               // LL encryption start with a stored LTK
+#define SIM_MAX_BONDS 15                // the station's bond storage (CONFIG_BT_SMP_MAX_BONDS)
+
+// ---- Faults --------------------------------------------------------------------------
+
+struct SimFaults {
+  float connectFailRate = 0;       // connection attempts that time out
+  float dropPerRead = 0;           // chance that the link is lost during any one ATT read
+  uint32_t attLatencyMs = 0;       // extra delay on every ATT round trip
+  uint32_t attJitterMs = 0;        // ...plus up to this much at random
+  float readErrorRate = 0;         // reads that come back as a GATT error (empty value)
+  float controlWriteFailRate = 0;  // Control Register writes the unit does not apply
+  uint32_t floodAdverts = 0;       // extra advertisers heard per scan
+  float floodMatchingRate = 0;     // ...of which carry the target prefix but are gone by connect time
+  float bondLossRate = 0;          // re-encryptions that find the unit has lost its keys (reflashed)
+  uint32_t rpaRotateMs = 0;        // units advertise resolvable private addresses, renewed this often
+};
+
+struct SimStats {
+  uint32_t scanStarts = 0;
+  uint32_t overlappingScanStarts = 0;  // start() while a scan was already running
+  uint32_t scansCompleted = 0;
+  uint32_t advertsDelivered = 0;
+  uint32_t connectAttempts = 0;
+  uint32_t connectFailures = 0;
+  uint32_t connects = 0;
+  uint32_t clientsCreated = 0;
+  uint32_t linkDrops = 0;              // injected link losses
+  uint32_t attRequests = 0;
+  uint32_t readMultiples = 0;          // of which Read Multiple requests
+  uint32_t readErrors = 0;
+  uint32_t writesDropped = 0;
+  uint32_t notifications = 0;
+  uint32_t idleDisconnects = 0;        // the unit gave up on a silent central
+  uint32_t pairings = 0;
+  uint32_t pairingFailures = 0;
+  uint32_t encryptions = 0;            // links encrypted with a stored key
+  uint32_t keyMissing = 0;             // re-encryptions the unit could not answer
+  uint32_t authRefused = 0;            // Control Register accesses over an unencrypted link
+  uint32_t addressRotations = 0;       // resolvable private addresses renewed
+  uint64_t faultStartUs = 0;           // first fault not yet followed by a successful connect
+  bool faultPending = false;
+  bool rescanPending = false;
+  uint32_t recoveryScanStarts = 0;     // scans started between a fault and the next connection
+  std::vector<uint32_t> rescanMs;      // fault to the first scan started after it
+  std::vector<uint32_t> recoveryMs;    // fault to next established connection
+  std::vector<uint32_t> disconnectReactionUs;  // peer dropped the link to the client being released
+  std::vector<uint32_t> selectToConnectedUs;   // operator's pick to services discovered
+};
+
+class BleSim {
+public:
+  // Replace the fleet with `count` bikes sharing the standard GATT layout
+  void createFleet(size_t count, uint32_t seed);
+  void setFaults(const SimFaults& newFaults) { faults = newFaults; }
+  const SimFaults& getFaults() const { return faults; }
+  std::vector<SimPeripheral>& peripherals() { return fleet; }
+  SimStats stats;
+
+  // Hooks for the fake BLE classes
+  SimPeripheral* find(const std::string& address);
+  bool connect(BLEClient* client, SimPeripheral* peripheral);
+  void disconnect(BLEClient* client);
+  bool attRequest(BLEClient* client, bool isRead);
+  bool write(BLEClient* client, SimCharacteristic* target, const uint8_t* data, size_t length,
+             bool response);
+  void subscribe(BLERemoteCharacteristic* characteristic, bool enable);
+  // Starts encryption on the link to `address`: a stored key if both sides have one, else pairing
+  bool encrypt(const std::string& address);
+  // The Control Register over a link it needs encrypted; counts the refusal
+  bool refused(BLEClient* client, SimCharacteristic* target);
+  std::vector<std::string>& bonds() { return bondList; }
+  void startScan(BLEScan* scan, uint32_t durationMs);
+  // An advertisement as a scan delivers it, for the micro-benchmarks
+  BLEAdvertisedDevice advert(const std::string& address, const std::string& name, int rssi,
+                             esp_ble_addr_type_t addressType = BLE_ADDR_TYPE_PUBLIC);
+  // A fresh resolvable private address for the unit holding `irk`
+  std::string privateAddress(const uint8_t* irk);
+  BLEClient* clientByConnId(uint16_t connId);
+  SimCharacteristic* findHandle(SimPeripheral* peripheral, uint16_t handle);
+  void track(BLEClient* client) { clients.push_back(client); }
+  void forget(BLEClient* client);
+  void forget(BLERemoteCharacteristic* characteristic);
+  uint32_t random(uint32_t bound);
+  bool chance(float probability);
+
+  gattc_event_handler customHandler = nullptr;
+  BLESecurityCallbacks* securityCallbacks = nullptr;
+
+private:
+  void dropLink(BLEClient* client, bool fault);
+  void releaseLink(SimPeripheral* peripheral);
+  void touch(SimPeripheral* peripheral);
+  void scheduleNotify(SimPeripheral* peripheral, SimCharacteristic* characteristic);
+  bool alive(BLEClient* client);
+  void authComplete(BLEClient* client, bool success, uint8_t reason);
+  void noteFault();
+  void renewAddress(SimPeripheral& peripheral);
+  BLEAdvertisedDevice advertOf(const SimPeripheral& peripheral);
+
+  std::vector<SimPeripheral> fleet;
+  std::vector<BLEClient*> clients;
+  std::vector<BLERemoteCharacteristic*> listeners;
+  std::vector<std::string> bondList;  // identity addresses the station holds keys for, oldest first
+  SimFaults faults;
+  uint32_t rng = 1;
+  uint16_t nextConnId = 1;
+};
+
+extern BleSim bleSim;
@@ -0,0 +1,62 @@
+#pragma once
+
+// GAP security types and the bond calls, served by the simulated backend
+
+#include <Arduino.h>
+
+typedef enum {
+  ESP_BLE_SEC_ENCRYPT = 1,
+  ESP_BLE_SEC_ENCRYPT_NO_MITM,
+  ESP_BLE_SEC_ENCRYPT_MITM
+} esp_ble_sec_act_t;
+
+typedef uint8_t esp_ble_auth_req_t;
+#define ESP_LE_AUTH_NO_BOND 0x00
+#define ESP_LE_AUTH_BOND 0x01
+#define ESP_LE_AUTH_REQ_MITM (1 << 2)
+#define ESP_LE_AUTH_REQ_SC_ONLY (1 << 3)
+#define ESP_LE_AUTH_REQ_SC_BOND (ESP_LE_AUTH_BOND | ESP_LE_AUTH_REQ_SC_ONLY)
+
+typedef uint8_t esp_ble_io_cap_t;
+#define ESP_IO_CAP_OUT 0
+#define ESP_IO_CAP_IO 1
+#define ESP_IO_CAP_IN 2
+#define ESP_IO_CAP_NONE 3
+
+#define ESP_BLE_ENC_KEY_MASK (1 << 0)
+#define ESP_BLE_ID_KEY_MASK (1 << 1)
+
+typedef struct {
+  esp_bd_addr_t bd_addr;
+  bool key_present;
+  uint8_t key_type;
+  bool success;
+  uint8_t fail_reason;
+  esp_ble_addr_type_t addr_type;
+  esp_ble_auth_req_t auth_mode;
+} esp_ble_auth_cmpl_t;
+
+typedef uint8_t esp_ble_key_mask_t;
+typedef uint8_t esp_bt_octet16_t[16];
+
+typedef struct {
+  esp_bt_octet16_t irk;  // least significant byte first, as SMP distributes it
+  esp_ble_addr_type_t addr_type;
+  esp_bd_addr_t static_addr;
+} esp_ble_pid_keys_t;
+
+// The real entry also carries the LTK and CSRK; only the identity key is modelled
+typedef struct {
+  esp_ble_key_mask_t key_mask;
+  esp_ble_pid_keys_t pid_key;
+} esp_ble_bond_key_info_t;
+
+typedef struct {
+  esp_bd_addr_t bd_addr;  // identity address
+  esp_ble_bond_key_info_t bond_key;
+} esp_ble_bond_dev_t;
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act);
+int esp_ble_get_bond_device_num(void);
+esp_err_t esp_ble_get_bond_device_list(int* dev_num, esp_ble_bond_dev_t* dev_list);
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr);
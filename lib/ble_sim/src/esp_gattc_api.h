@@ -0,0 +1,54 @@
+#pragma once
+
+// GATT client types, single and multiple reads and the queued/reliable write calls, served by the simulated backend
+
+#include <Arduino.h>
+
+typedef int esp_gatt_if_t;
+typedef enum { ESP_GATT_OK = 0x00, ESP_GATT_ERROR = 0x85 } esp_gatt_status_t;
+typedef enum { ESP_GATT_AUTH_REQ_NONE = 0 } esp_gatt_auth_req_t;
+typedef enum {
+  ESP_GATTC_READ_CHAR_EVT = 3,
+  ESP_GATTC_WRITE_CHAR_EVT = 5,
+  ESP_GATTC_PREP_WRITE_EVT = 6,
+  ESP_GATTC_EXEC_EVT = 7,
+  ESP_GATTC_READ_MULTIPLE_EVT = 8
+} esp_gattc_cb_event_t;
+
+#define ESP_GATT_MAX_READ_MULTI_HANDLES 10
+typedef struct {
+  uint8_t num_attr;
+  uint16_t handles[ESP_GATT_MAX_READ_MULTI_HANDLES];
+} esp_gattc_multi_t;
+
+typedef union {
+  struct {
+    esp_gatt_status_t status;
+    uint16_t conn_id;
+    uint16_t handle;
+    uint8_t* value;
+    uint16_t value_len;
+  } read;
+  struct {
+    esp_gatt_status_t status;
+    uint16_t conn_id;
+    uint16_t handle;
+    uint16_t offset;
+  } write;
+  struct {
+    esp_gatt_status_t status;
+    uint16_t conn_id;
+  } exec_cmpl;
+} esp_ble_gattc_cb_param_t;
+
+typedef void (*gattc_event_handler)(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                    esp_ble_gattc_cb_param_t* param);
+
+esp_err_t esp_ble_gattc_prepare_write(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                      uint16_t offset, uint16_t value_len, uint8_t* value,
+                                      esp_gatt_auth_req_t auth_req);
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                  esp_gatt_auth_req_t auth_req);
+esp_err_t esp_ble_gattc_read_multiple(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gattc_multi_t* read_multi,
+                                      esp_gatt_auth_req_t auth_req);
+esp_err_t esp_ble_gattc_execute_write(esp_gatt_if_t gattc_if, uint16_t conn_id, bool is_execute);
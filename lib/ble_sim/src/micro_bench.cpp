@@ -0,0 +1,350 @@
+// Native micro-benchmarks of the firmware's per-value and per-advert hot paths, built by
+// the native_bench environment instead of the fault-injection benchmark.
+//
+//   program [--json] [--compare <baseline.json>] [--tolerance <percent>]
+//
+// Each case is timed as the best of BENCH_REPEATS runs of at least BENCH_MIN_NS, then run
+// once more under the mem_budget allocation counters for allocs/op and bytes/op. With
+// --compare the run fails when a case allocates more than the baseline, or takes more
+// than --tolerance percent (default 50) longer; times vary between hosts, allocations
+// do not.
+
+#ifdef SIM_MICROBENCH
+
+#include <Arduino.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include "ble_sim.h"
+#include "decode.h"
+#include "device_list.h"
+#include "mem_budget.h"
+#include "rpa_resolver.h"
+
+#define BENCH_MIN_NS 50000000ULL    // 50 ms per timed run
+#define BENCH_REPEATS 5
+#define BENCH_ALLOC_OPS 1000
+#define BENCH_NAME_MAX 64
+
+static volatile size_t sink;  // keeps results alive past the optimiser
+
+// ---- Corpora: what a sweep of the simulated units actually produces -------------------
+
+struct CpfReading {
+  const char* raw;
+  uint8_t length;
+  uint8_t format;
+  int8_t exponent;
+  uint16_t unit;
+};
+
+static const CpfReading cpfReadings[] = {
+  {"\xE4\x0E", 2, 0x06, -2, 0x27AE},          // pack voltage, 38.12 V
+  {"\x88\xFF", 2, 0x0A, -2, 0x27AC},          // current, -1.20 A
+  {"\xFB\x09", 2, 0x0A, -2, 0x27B1},          // motor temperature, 25.55 °C
+  {"\x98\x08", 2, 0x0A, -2, 0x27B1},          // pack temperature, 22.00 °C
+  {"\x6A\x0F", 2, 0x06, -3, 0x27AE},          // cell voltage, 3.946 V
+  {"\x87\xD6\x12\x00", 4, 0x04, -3, 0x2701},  // odometer, 1234.567 m
+  {"\x6D\xF1", 2, 0x16, 0, 0x27B1},           // SFLOAT sensor, 36.5 °C
+  {"\x2E\xFB\xFF\xFD", 4, 0x17, 0, 0x2700},   // FLOAT, -1.234
+};
+
+static const char* const textValues[] = {"Skarper Ltd", "DiscDrive", "SKP100005", "C", "2.4.1", "1.9.0"};
+
+struct BinaryValue {
+  const char* raw;
+  uint8_t length;
+};
+
+static const BinaryValue binaryValues[] = {
+  {"\x03\x00", 2},                                          // CSC feature
+  {"\x4C\x1D", 2},                                          // user service: assist level
+  {"\x02", 1},                                              // user service: mode
+  {"\x6B\x08", 2},                                          // user service: wheel size
+  {"\x00\x00\x00\x00", 4},                                  // control register
+  {"\x03\x12\x00\x00\x00\x10\x20\x05\x00\x30\x40", 11},    // CSC measurement
+};
+
+// Explored in this order on every unit: services hit the name table, characteristics miss
+static const char* const serviceUuids[] = {
+  "180A", "180F", "1816", "B1F8799E-4999-4F4A-AF05-B5A6FB6AB55D",
+  "B1F879A7-4999-4F4A-AF05-B5A6FB6AB55D", "B1F879B4-4999-4F4A-AF05-B5A6FB6AB55D",
+};
+static const char* const characteristicUuids[] = {
+  "2A29", "2A24", "2A19", "B1F879A3-4999-4F4A-AF05-B5A6FB6AB55D", "B1F879A4-4999-4F4A-AF05-B5A6FB6AB55D",
+  "2A5B", "2A5C", "B1F8799F-4999-4F4A-AF05-B5A6FB6AB55D", "B1F879A8-4999-4F4A-AF05-B5A6FB6AB55D",
+};
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define UNIT_COUNT 8
+#define ADVERTS_PER_UNIT 16
+#define RPAS_PER_UNIT 2  // heard under the old and the renewed address in the same scan
+
+static std::string cpfRaw[ARRAY_SIZE(cpfReadings)];
+static std::string binaryRaw[ARRAY_SIZE(binaryValues)];
+static std::string textRaw[ARRAY_SIZE(textValues)];
+static std::vector<BLEUUID> serviceUuidList;
+static std::vector<BLEUUID> characteristicUuidList;
+static std::vector<BLEAdvertisedDevice> adverts;  // a scan's worth, RSSI jittering per unit
+static std::vector<BLEAdvertisedDevice> privateAdverts;  // the same from bonded units using RPAs
+static DeviceList privateList;
+
+static void buildCorpora() {
+  for (size_t i = 0; i < ARRAY_SIZE(cpfReadings); i++) cpfRaw[i].assign(cpfReadings[i].raw, cpfReadings[i].length);
+  for (size_t i = 0; i < ARRAY_SIZE(binaryValues); i++) binaryRaw[i].assign(binaryValues[i].raw, binaryValues[i].length);
+  for (size_t i = 0; i < ARRAY_SIZE(textValues); i++) textRaw[i] = textValues[i];
+  for (const char* uuid : serviceUuids) serviceUuidList.push_back(BLEUUID(std::string(uuid)));
+  for (const char* uuid : characteristicUuids) characteristicUuidList.push_back(BLEUUID(std::string(uuid)));
+
+  // Units sit a few dB apart, so jitter of up to +/-8 dB reorders some of them
+  for (int round = 0; round < ADVERTS_PER_UNIT; round++) {
+    for (int unit = 0; unit < UNIT_COUNT; unit++) {
+      char address[18];
+      char name[16];
+      snprintf(address, sizeof(address), "c4:de:e2:00:%02x:%02x", unit, (0x41 + unit * 0x37) & 0xFF);
+      snprintf(name, sizeof(name), "Skp-%04d", unit + 1);
+      int rssi = -50 - unit * 5 + (int)((round * 7 + unit * 3) % 17) - 8;
+      adverts.push_back(bleSim.advert(address, name, rssi));
+    }
+  }
+  // Locked as on the station, so the cases include the mutex
+  deviceList.begin();
+  privateList.begin();
+  deviceList.clear();
+  deviceList.beginScan();
+  for (int unit = 0; unit < UNIT_COUNT; unit++) deviceList.seen(adverts[unit]);
+
+  std::string privateAddresses[UNIT_COUNT][RPAS_PER_UNIT];
+  for (int unit = 0; unit < UNIT_COUNT; unit++) {
+    uint8_t identity[6] = {0xc4, 0xde, 0xe2, 0x01, 0x00, (uint8_t)unit};
+    uint8_t irk[16];
+    for (int i = 0; i < 16; i++) irk[i] = (uint8_t)(unit * 37 + i * 11);
+    rpaResolver.setKey(identity, irk);
+    for (int i = 0; i < RPAS_PER_UNIT; i++) privateAddresses[unit][i] = bleSim.privateAddress(irk);
+  }
+  for (size_t i = 0; i < adverts.size(); i++) {
+    int unit = i % UNIT_COUNT;
+    int round = i / UNIT_COUNT;
+    privateAdverts.push_back(bleSim.advert(privateAddresses[unit][round * RPAS_PER_UNIT / ADVERTS_PER_UNIT],
+                                           adverts[i].getName(), adverts[i].getRSSI(), BLE_ADDR_TYPE_RANDOM));
+  }
+  privateList.beginScan();
+  for (int unit = 0; unit < UNIT_COUNT; unit++) privateList.seen(privateAdverts[unit]);
+}
+
+// ---- Cases --------------------------------------------------------------------------
+
+typedef void (*BenchBody)(uint32_t operations);
+
+struct BenchCase {
+  const char* name;
+  BenchBody body;
+  double nsPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+};
+
+static void benchConvertRawValue(uint32_t operations) {
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == ARRAY_SIZE(cpfReadings) ? 0 : i + 1) {
+    const CpfReading& reading = cpfReadings[i];
+    sink += convertRawValue(cpfRaw[i], reading.format, reading.exponent, reading.unit).length();
+  }
+}
+
+static void benchFallbackText(uint32_t operations) {
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == ARRAY_SIZE(textValues) ? 0 : i + 1) {
+    sink += fallbackConvert(textRaw[i]).length();
+  }
+}
+
+static void benchFallbackBinary(uint32_t operations) {
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == ARRAY_SIZE(binaryValues) ? 0 : i + 1) {
+    sink += fallbackConvert(binaryRaw[i]).length();
+  }
+}
+
+static void benchUuidNameService(uint32_t operations) {
+  size_t count = serviceUuidList.size();
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == count ? 0 : i + 1) {
+    sink += getUuidName(serviceUuidList[i]).length();
+  }
+}
+
+static void benchUuidNameCharacteristic(uint32_t operations) {
+  size_t count = characteristicUuidList.size();
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == count ? 0 : i + 1) {
+    sink += getUuidName(characteristicUuidList[i]).length();
+  }
+}
+
+static void benchUnitMap(uint32_t operations) {
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == ARRAY_SIZE(cpfReadings) ? 0 : i + 1) {
+    auto unit = unitMap.find(cpfReadings[i].unit);
+    sink += unit != unitMap.end() ? unit->second.length() : 0;
+  }
+}
+
+// An advert from a unit already listed: update, and re-rank when the RSSI moved enough
+static void benchDeviceSeen(uint32_t operations) {
+  size_t count = adverts.size();
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == count ? 0 : i + 1) {
+    sink += deviceList.seen(adverts[i]);
+  }
+}
+
+// The same from units advertising resolvable private addresses: one cached resolution more
+static void benchDeviceSeenPrivate(uint32_t operations) {
+  size_t count = privateAdverts.size();
+  for (uint32_t op = 0, i = 0; op < operations; op++, i = i + 1 == count ? 0 : i + 1) {
+    sink += privateList.seen(privateAdverts[i]);
+  }
+}
+
+// One row of the device table: the next unit in RSSI order and its name
+static void benchDeviceRanked(uint32_t operations) {
+  uint32_t op = 0;
+  while (op < operations) {
+    deviceList.forEachRanked([&op, operations](const std::string&, const DeviceEntry& entry) {
+      if (op == operations) return;
+      sink += entry.device->getName().size() + entry.rssi;
+      op++;
+    });
+  }
+}
+
+static BenchCase cases[] = {
+  {"convertRawValue/cpf", benchConvertRawValue, 0, 0, 0},
+  {"fallbackConvert/text", benchFallbackText, 0, 0, 0},
+  {"fallbackConvert/binary", benchFallbackBinary, 0, 0, 0},
+  {"getUuidName/service", benchUuidNameService, 0, 0, 0},
+  {"getUuidName/characteristic", benchUuidNameCharacteristic, 0, 0, 0},
+  {"unitMap/find", benchUnitMap, 0, 0, 0},
+  {"deviceList/seen", benchDeviceSeen, 0, 0, 0},
+  {"deviceList/seenPrivate", benchDeviceSeenPrivate, 0, 0, 0},
+  {"deviceList/rankedRow", benchDeviceRanked, 0, 0, 0},
+};
+
+// ---- Measurement --------------------------------------------------------------------
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void totals(uint32_t& allocs, uint32_t& bytes) {
+  allocs = bytes = 0;
+  for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+    allocs += memCounters[tag].allocs.load();
+    bytes += memCounters[tag].allocBytes.load();
+  }
+}
+
+static void measure(BenchCase& benchCase) {
+  benchCase.body(BENCH_ALLOC_OPS);  // warm up caches and lazily built tables
+
+  uint32_t allocsBefore, bytesBefore, allocsAfter, bytesAfter;
+  totals(allocsBefore, bytesBefore);
+  benchCase.body(BENCH_ALLOC_OPS);
+  totals(allocsAfter, bytesAfter);
+  benchCase.allocsPerOp = (double)(allocsAfter - allocsBefore) / BENCH_ALLOC_OPS;
+  benchCase.bytesPerOp = (double)(bytesAfter - bytesBefore) / BENCH_ALLOC_OPS;
+
+  uint32_t operations = BENCH_ALLOC_OPS;
+  uint64_t elapsed = 0;
+  for (;;) {
+    uint64_t start = nowNs();
+    benchCase.body(operations);
+    elapsed = nowNs() - start;
+    if (elapsed >= BENCH_MIN_NS || operations >= (1u << 30)) break;
+    operations *= 2;
+  }
+  double best = (double)elapsed / operations;
+  for (int repeat = 1; repeat < BENCH_REPEATS; repeat++) {
+    uint64_t start = nowNs();
+    benchCase.body(operations);
+    best = std::min(best, (double)(nowNs() - start) / operations);
+  }
+  benchCase.nsPerOp = best;
+}
+
+// ---- Baseline -----------------------------------------------------------------------
+
+// One case per line, as printJson writes them
+static int compareBaseline(const char* path, double tolerancePercent) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "cannot read baseline %s\n", path);
+    return 2;
+  }
+  int regressions = 0;
+  int matched = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char name[BENCH_NAME_MAX];
+    double ns, allocs, bytes;
+    if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, \"allocs_per_op\": %lf, \"bytes_per_op\": %lf",
+               name, &ns, &allocs, &bytes) != 4) {
+      continue;
+    }
+    for (const BenchCase& benchCase : cases) {
+      if (strcmp(benchCase.name, name) != 0) continue;
+      matched++;
+      bool slower = benchCase.nsPerOp > ns * (1 + tolerancePercent / 100);
+      bool allocating = benchCase.allocsPerOp > allocs + 0.01 || benchCase.bytesPerOp > bytes + 0.5;
+      if (slower || allocating) {
+        regressions++;
+        fprintf(stderr, "REGRESSION %-28s %.1f ns/op (baseline %.1f), %.2f allocs/op (%.2f), %.1f B/op (%.1f)\n", name,
+               benchCase.nsPerOp, ns, benchCase.allocsPerOp, allocs, benchCase.bytesPerOp, bytes);
+      }
+    }
+  }
+  fclose(file);
+  if (matched < (int)ARRAY_SIZE(cases)) fprintf(stderr, "baseline covers %d of %u cases\n", matched, (unsigned)ARRAY_SIZE(cases));
+  fprintf(stderr, "%d regression(s) against %s\n", regressions, path);
+  return regressions ? 1 : 0;
+}
+
+static void printJson() {
+  printf("{\n  \"unit\": \"per operation; ns on the host that wrote it\",\n  \"cases\": [\n");
+  for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+    const BenchCase& benchCase = cases[i];
+    printf("    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}%s\n",
+           benchCase.name, benchCase.nsPerOp, benchCase.allocsPerOp, benchCase.bytesPerOp,
+           i + 1 < ARRAY_SIZE(cases) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+  bool json = false;
+  const char* baseline = nullptr;
+  double tolerancePercent = 50;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerancePercent = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--json] [--compare <baseline.json>] [--tolerance <percent>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  buildCorpora();
+  for (BenchCase& benchCase : cases) measure(benchCase);
+
+  if (json) {
+    printJson();
+  } else {
+    printf("%-28s %10s %10s %10s\n", "case", "ns/op", "allocs/op", "B/op");
+    for (const BenchCase& benchCase : cases) {
+      printf("%-28s %10.1f %10.2f %10.1f\n", benchCase.name, benchCase.nsPerOp, benchCase.allocsPerOp,
+             benchCase.bytesPerOp);
+    }
+  }
+  return baseline ? compareBaseline(baseline, tolerancePercent) : 0;
+}
+
+#endif  // SIM_MICROBENCH
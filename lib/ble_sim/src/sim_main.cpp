@@ -0,0 +1,618 @@
+// Native entry point: runs the unmodified firmware (setup()/loop()) against the simulated
+// radio under each fault profile and reports recovery time and throughput.
+//
+//   program [profile|all] [simulated minutes] [--echo] [--select "<number> [mode]"]
+//   program checks|<check> [--select "<number> [mode]"]   scripted scenarios that pass or fail
+//
+// The native_bench environment builds micro_bench.cpp in its place.
+
+#ifndef SIM_MICROBENCH
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include "battery_trend.h"
+#include "ble_sim.h"
+#include "output.h"
+#include "thermal_profile.h"
+
+void setup();
+void loop();
+extern BLEClient* pClient;
+
+struct FaultProfile {
+  const char* name;
+  const char* description;
+  SimFaults faults;
+};
+
+static FaultProfile makeProfile(const char* name, const char* description) {
+  FaultProfile profile;
+  profile.name = name;
+  profile.description = description;
+  return profile;
+}
+
+static std::vector<FaultProfile> buildProfiles() {
+  std::vector<FaultProfile> profiles;
+
+  profiles.push_back(makeProfile("baseline", "no faults"));
+
+  FaultProfile drop = makeProfile("drop-mid-explore", "2% of reads lose the link");
+  drop.faults.dropPerRead = 0.02f;
+  profiles.push_back(drop);
+
+  FaultProfile slow = makeProfile("slow-att", "ATT round trips +150..350 ms");
+  slow.faults.attLatencyMs = 150;
+  slow.faults.attJitterMs = 200;
+  profiles.push_back(slow);
+
+  FaultProfile errors = makeProfile("read-errors", "10% of reads return a GATT error");
+  errors.faults.readErrorRate = 0.10f;
+  profiles.push_back(errors);
+
+  FaultProfile control = makeProfile("control-write-fail", "50% of Control Register writes not applied");
+  control.faults.controlWriteFailRate = 0.5f;
+  profiles.push_back(control);
+
+  FaultProfile flood = makeProfile("adv-flood", "300 extra advertisers per scan, 5% prefixed ghosts");
+  flood.faults.floodAdverts = 300;
+  flood.faults.floodMatchingRate = 0.05f;
+  profiles.push_back(flood);
+
+  FaultProfile bondLoss = makeProfile("bond-loss", "30% of re-encryptions find the unit has lost its keys");
+  bondLoss.faults.bondLossRate = 0.30f;
+  profiles.push_back(bondLoss);
+
+  FaultProfile rf = makeProfile("rf-degraded", "all of the above, milder");
+  rf.faults.connectFailRate = 0.10f;
+  rf.faults.dropPerRead = 0.01f;
+  rf.faults.attLatencyMs = 60;
+  rf.faults.attJitterMs = 120;
+  rf.faults.readErrorRate = 0.03f;
+  rf.faults.controlWriteFailRate = 0.10f;
+  rf.faults.floodAdverts = 100;
+  rf.faults.floodMatchingRate = 0.02f;
+  profiles.push_back(rf);
+
+  FaultProfile privacy = makeProfile("rpa-rotation", "units advertise private addresses, renewed every 20 s");
+  privacy.faults.rpaRotateMs = 20000;
+  profiles.push_back(privacy);
+
+  return profiles;
+}
+
+// Fixed-size so a child can hand it back through a pipe
+struct ProfileResult {
+  uint32_t simSeconds;
+  uint32_t prompts;
+  uint32_t verdicts;
+  uint32_t controlOk;
+  uint32_t controlFailed;
+  uint32_t connectFailedLines;
+  uint32_t scanStarts;
+  uint32_t overlappingScanStarts;
+  uint32_t recoveryScanStarts;
+  uint32_t rescanMeanMs;
+  uint32_t scansCompleted;
+  uint32_t advertsDelivered;
+  uint32_t connectAttempts;
+  uint32_t connectFailures;
+  uint32_t linkDrops;
+  uint32_t idleDisconnects;
+  uint32_t attRequests;
+  uint32_t readErrors;
+  uint32_t writesDropped;
+  uint32_t notifications;
+  uint32_t recoveries;
+  uint32_t recoveryMeanMs;
+  uint32_t recoveryP95Ms;
+  uint32_t recoveryMaxMs;
+  uint32_t hostCpuMs;
+  uint64_t consoleBytes;
+  uint32_t loopPasses;
+  uint32_t inputReactions;
+  uint32_t inputMeanUs;
+  uint32_t inputMaxUs;
+  uint32_t disconnectReactions;
+  uint32_t disconnectMeanUs;
+  uint32_t disconnectMaxUs;
+  uint32_t sessionsConnected;
+  uint32_t connectMeanUs;
+  uint32_t connectMaxUs;
+  uint32_t clientsCreated;
+  uint32_t pairings;
+  uint32_t pairingFailures;
+  uint32_t encryptions;
+  uint32_t keyMissing;
+  uint32_t authRefused;
+  uint32_t readMultiples;
+  uint32_t addressRotations;
+  uint32_t devicesFound;
+};
+
+static void summarize(const std::vector<uint32_t>& samples, uint32_t& count, uint32_t& mean, uint32_t& max) {
+  count = samples.size();
+  if (samples.empty()) return;
+  uint64_t total = 0;
+  for (uint32_t sample : samples) {
+    total += sample;
+    max = std::max(max, sample);
+  }
+  mean = total / samples.size();
+}
+
+static ProfileResult runProfile(const FaultProfile& profile, uint32_t minutes, bool echo,
+                                const std::string& select) {
+  ProfileResult result;
+  memset(&result, 0, sizeof(result));
+
+  bleSim.createFleet(8, 0x5EED1234);
+  bleSim.setFaults(profile.faults);
+  simResetClock();
+  simConsole.echo = echo;
+
+  // The operator always picks the strongest unit as soon as the list is shown
+  uint64_t chosenUs = 0;
+  simConsole.onLine = [&result, &chosenUs, &select](const std::string& line) {
+    if (line.compare(0, 19, "Enter device number") == 0) {
+      result.prompts++;
+      chosenUs = simNowUs();
+      simConsoleInput(select + "\n");
+    } else if (line == "Connection established. Services discovered." && chosenUs) {
+      bleSim.stats.selectToConnectedUs.push_back(simNowUs() - chosenUs);
+      chosenUs = 0;
+    } else if (line.compare(0, 8, "VERDICT ") == 0) {
+      result.verdicts++;
+    } else if (line == "Control Register write completed successfully") {
+      result.controlOk++;
+    } else if (line == "Control Register write failed") {
+      result.controlFailed++;
+    } else if (line == "Connection failed. Restarting scan...") {
+      result.connectFailedLines++;
+    } else if (line.compare(0, 13, "Found device:") == 0) {
+      result.devicesFound++;
+    }
+  };
+
+  uint64_t endUs = (uint64_t)minutes * 60 * 1000000;
+  setup();
+  while (simNowUs() < endUs) {
+    loop();
+    result.loopPasses++;
+  }
+
+  const SimStats& stats = bleSim.stats;
+  result.simSeconds = simNowUs() / 1000000;
+  result.scanStarts = stats.scanStarts;
+  result.overlappingScanStarts = stats.overlappingScanStarts;
+  result.recoveryScanStarts = stats.recoveryScanStarts;
+  if (!stats.rescanMs.empty()) {
+    uint64_t total = 0;
+    for (uint32_t ms : stats.rescanMs) total += ms;
+    result.rescanMeanMs = total / stats.rescanMs.size();
+  }
+  result.scansCompleted = stats.scansCompleted;
+  result.advertsDelivered = stats.advertsDelivered;
+  result.connectAttempts = stats.connectAttempts;
+  result.connectFailures = stats.connectFailures;
+  result.linkDrops = stats.linkDrops;
+  result.idleDisconnects = stats.idleDisconnects;
+  result.attRequests = stats.attRequests;
+  result.readErrors = stats.readErrors;
+  result.writesDropped = stats.writesDropped;
+  result.notifications = stats.notifications;
+  result.consoleBytes = simConsole.bytesOut;
+  summarize(simConsole.inputReactionUs, result.inputReactions, result.inputMeanUs, result.inputMaxUs);
+  summarize(stats.disconnectReactionUs, result.disconnectReactions, result.disconnectMeanUs,
+            result.disconnectMaxUs);
+  summarize(stats.selectToConnectedUs, result.sessionsConnected, result.connectMeanUs, result.connectMaxUs);
+  result.clientsCreated = stats.clientsCreated;
+  result.pairings = stats.pairings;
+  result.pairingFailures = stats.pairingFailures;
+  result.encryptions = stats.encryptions;
+  result.keyMissing = stats.keyMissing;
+  result.authRefused = stats.authRefused;
+  result.readMultiples = stats.readMultiples;
+  result.addressRotations = stats.addressRotations;
+
+  std::vector<uint32_t> recovery = stats.recoveryMs;
+  result.recoveries = recovery.size();
+  if (!recovery.empty()) {
+    std::sort(recovery.begin(), recovery.end());
+    uint64_t total = 0;
+    for (uint32_t ms : recovery) total += ms;
+    result.recoveryMeanMs = total / recovery.size();
+    result.recoveryP95Ms = recovery[std::min(recovery.size() - 1, recovery.size() * 95 / 100)];
+    result.recoveryMaxMs = recovery.back();
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  result.hostCpuMs = usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000 +
+                     usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000;
+  return result;
+}
+
+// The firmware keeps its state in globals, so every run happens in a fresh child process
+template <typename Result>
+static bool runIsolated(std::function<Result()> run, Result& result) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    close(fds[0]);
+    Result childResult = run();
+    fflush(stdout);
+    ssize_t written = write(fds[1], &childResult, sizeof(childResult));
+    _exit(written == (ssize_t)sizeof(childResult) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t got = read(fds[0], &result, sizeof(result));
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return got == (ssize_t)sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void printResult(const FaultProfile& profile, const ProfileResult& r) {
+  double minutes = r.simSeconds / 60.0;
+  printf("\n[%s] %s\n", profile.name, profile.description);
+  printf("  throughput   %u verdicts, %u control OK (%.2f units/min), %u control failed\n", r.verdicts,
+         r.controlOk, minutes > 0 ? r.controlOk / minutes : 0.0, r.controlFailed);
+  printf("  radio        %u connects / %u attempts, %u link drops, %u idle timeouts, %u ATT requests\n",
+         r.connectAttempts - r.connectFailures, r.connectAttempts, r.linkDrops, r.idleDisconnects,
+         r.attRequests);
+  printf("  errors       %u read errors, %u control writes dropped, %u notifications, %u Read Multiple\n",
+         r.readErrors, r.writesDropped, r.notifications, r.readMultiples);
+  printf("  recovery     %u recovered, mean %u ms, p95 %u ms, max %u ms\n", r.recoveries, r.recoveryMeanMs,
+         r.recoveryP95Ms, r.recoveryMaxMs);
+  printf("  scanning     %u starts (%u while a scan was running), %u completed, %u adverts\n", r.scanStarts,
+         r.overlappingScanStarts, r.scansCompleted, r.advertsDelivered);
+  printf("  devices      %u announced as found, %u private address renewals\n", r.devicesFound,
+         r.addressRotations);
+  printf("  rescan       %u starts while recovering (%.2f per recovery), first rescan %u ms after the fault\n",
+         r.recoveryScanStarts, r.recoveries ? (double)r.recoveryScanStarts / r.recoveries : 0.0,
+         r.rescanMeanMs);
+  printf("  reaction     input %u lines, mean %.1f ms, max %.1f ms; peer disconnect %u, mean %.1f ms, "
+         "max %.1f ms\n", r.inputReactions, r.inputMeanUs / 1000.0, r.inputMaxUs / 1000.0,
+         r.disconnectReactions, r.disconnectMeanUs / 1000.0, r.disconnectMaxUs / 1000.0);
+  printf("  connect      %u sessions, pick to services discovered mean %.1f ms, max %.1f ms; %u client(s) "
+         "created\n", r.sessionsConnected, r.connectMeanUs / 1000.0, r.connectMaxUs / 1000.0, r.clientsCreated);
+  printf("  security     %u pairings (%u failed), %u resumed from a stored key, %u key(s) missing, "
+         "%u control accesses refused\n", r.pairings, r.pairingFailures, r.encryptions, r.keyMissing,
+         r.authRefused);
+  printf("  loop         %u passes (%.1f per simulated s)\n", r.loopPasses,
+         r.simSeconds ? (double)r.loopPasses / r.simSeconds : 0.0);
+  printf("  host         %u ms CPU for %u simulated s, %llu console bytes\n", r.hostCpuMs, r.simSeconds,
+         (unsigned long long)r.consoleBytes);
+}
+
+// ---- Checks ----------------------------------------------------------------------------
+
+struct CheckResult {
+  bool passed;
+  char detail[160];
+};
+
+struct SimCheck {
+  const char* name;
+  const char* description;
+  CheckResult (*run)(const std::string& select);
+};
+
+static CheckResult checkFailed(const char* format, ...) {
+  CheckResult result;
+  result.passed = false;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(result.detail, sizeof(result.detail), format, args);
+  va_end(args);
+  return result;
+}
+
+static CheckResult checkPassed() {
+  CheckResult result;
+  result.passed = true;
+  result.detail[0] = '\0';
+  return result;
+}
+
+static void loopFor(uint64_t us) {
+  uint64_t endUs = simNowUs() + us;
+  while (simNowUs() < endUs) loop();
+}
+
+static bool loopUntil(const bool& done, uint64_t limitUs) {
+  uint64_t endUs = simNowUs() + limitUs;
+  while (!done && simNowUs() < endUs) loop();
+  return done;
+}
+
+// Picks the first listed unit and returns once its test plan is through, with the link kept
+static bool openSession(std::vector<std::string>& lines) {
+  bleSim.createFleet(8, 0x5EED1234);
+  for (auto& unit : bleSim.peripherals()) {
+    unit.disconnectAfterControlMs = 0;
+    unit.idleTimeoutMs = 600000;
+  }
+  simResetClock();
+
+  static bool selected;
+  static bool ready;
+  selected = ready = false;
+  simConsole.onLine = [&lines](const std::string& line) {
+    if (line.compare(0, 19, "Enter device number") == 0 && !selected) {
+      selected = true;
+      simConsoleInput("1\n");
+    } else if (line.compare(0, 8, "VERDICT ") == 0) {
+      ready = true;
+    }
+    lines.push_back(line);
+  };
+  setup();
+  if (!loopUntil(ready, 60000000)) return false;
+  loopFor(1000000);
+  return pClient && pClient->isConnected();
+}
+
+// Battery and thermal captures restarted while notifications for the first run are still
+// queued: every sample must fall inside the run that reports it
+static CheckResult checkCaptureRestart(const std::string&) {
+  std::vector<std::string> lines;
+  if (!openSession(lines)) return checkFailed("no session to capture from");
+  outputLevel = OUT_VERBOSE;  // the battery report lists each sample's time
+  lines.clear();
+
+  // The second start() comes while loop() has not yet handed over the first run's events
+  batteryTrend.start(pClient);
+  loopFor(3000000);
+  simAdvance(3000000);
+  batteryTrend.start(pClient);
+  loopFor(3000000);
+  batteryTrend.stop();
+
+  thermalProfile.start(pClient);
+  loopFor(3000000);
+  simAdvance(5000000);
+  thermalProfile.start(pClient);
+  loopFor(3000000);
+  thermalProfile.stop();
+
+  int batteryLines = 0;
+  int thermalLines = 0;
+  for (const std::string& line : lines) {
+    size_t at = line.find(" samples (ms,value):");
+    if (at != std::string::npos) {
+      batteryLines++;
+      const char* cursor = line.c_str() + line.find(':', at) + 1;
+      while (*cursor == ' ') {
+        unsigned long ms = strtoul(cursor + 1, nullptr, 10);
+        if (ms > BATTERY_TREND_DURATION_MS) return checkFailed("battery sample at %lu ms: %s", ms, line.c_str());
+        cursor = strchr(cursor + 1, ' ');
+        if (!cursor) break;
+      }
+    }
+    at = line.find("(bucket ");
+    if (at != std::string::npos) {
+      thermalLines++;
+      unsigned long seconds = strtoul(line.c_str() + at + 8, nullptr, 10);
+      if (seconds * 1000 != THERMAL_BUCKET_MS) return checkFailed("thermal bucket grew to %lu s: %s", seconds,
+                                                                  line.c_str());
+    }
+  }
+  if (batteryLines == 0 || thermalLines == 0) {
+    return checkFailed("%d battery and %d thermal series reported", batteryLines, thermalLines);
+  }
+  return checkPassed();
+}
+
+// The firmware's side of the link in RPC mode, parsed as a station script would
+struct RpcWire {
+  std::string pending;    // bytes not yet parsed into a frame
+  std::string line;       // TEXT payload up to its next newline
+  std::string unframed;   // the first bytes that were not part of any frame
+  bool strict = false;    // from the RESULT frame that confirms RPC mode on
+  uint8_t nextId = 1;
+  uint32_t unframedBytes = 0;
+  uint32_t badFrames = 0;
+  uint32_t selects = 0;
+  uint32_t selectsOk = 0;
+  uint32_t verdicts = 0;
+};
+
+// A select request carrying the same words as the text command after "select"
+static std::string selectFrame(const std::string& words, uint8_t id) {
+  std::string args;
+  size_t start = 0;
+  while (start < words.size()) {
+    size_t end = words.find(' ', start);
+    if (end == std::string::npos) end = words.size();
+    if (end > start) {
+      args += (char)(end - start);
+      args += words.substr(start, end - start);
+    }
+    start = end + 1;
+  }
+  std::string frame = {(char)0xA5, 0x01, (char)id, (char)args.size()};
+  frame += args;
+  uint8_t check = 0;
+  for (size_t i = 1; i < frame.size(); i++) check ^= (uint8_t)frame[i];
+  frame += (char)check;
+  return frame;
+}
+
+static void rpcFrame(RpcWire& wire, const std::string& select, uint8_t type, const uint8_t* payload,
+                     size_t length) {
+  if (type == 0x10 && length >= 2) {
+    if (!wire.strict && payload[0] == 0x00) wire.strict = true;
+    if (payload[0] != 0x01) return;
+    // Each select is answered once its plan is through; the next one follows a second later,
+    // and is refused until the unit list is back on screen
+    wire.selects++;
+    if (payload[1] == 0) wire.selectsOk++;
+    simSchedule(1000000, [&wire, select]() { simConsoleInput(selectFrame(select, wire.nextId++)); });
+  } else if (type == 0x11) {
+    for (size_t i = 0; i < length; i++) {
+      if (payload[i] != '\n') {
+        wire.line += (char)payload[i];
+        continue;
+      }
+      if (wire.line.compare(0, 8, "VERDICT ") == 0) wire.verdicts++;
+      wire.line.clear();
+    }
+  }
+}
+
+static void rpcBytes(RpcWire& wire, const std::string& select, const uint8_t* data, size_t size) {
+  wire.pending.append(reinterpret_cast<const char*>(data), size);
+  size_t at = 0;
+  while (at < wire.pending.size()) {
+    const uint8_t* frame = reinterpret_cast<const uint8_t*>(wire.pending.data()) + at;
+    size_t available = wire.pending.size() - at;
+    if (frame[0] != 0xA5) {
+      // Text mode output still draining before the switch is fine; anything after is not
+      if (wire.strict) {
+        if (wire.unframed.size() < 60) wire.unframed += (char)frame[0];
+        wire.unframedBytes++;
+      }
+      at++;
+      continue;
+    }
+    if (available < 4 || available < 5u + frame[3]) break;
+    uint8_t check = 0;
+    for (size_t i = 1; i < 4u + frame[3]; i++) check ^= frame[i];
+    if (check != frame[4 + frame[3]]) {
+      wire.badFrames++;
+      at++;
+      continue;
+    }
+    rpcFrame(wire, select, frame[1], frame + 4, frame[3]);
+    at += 5 + frame[3];
+  }
+  wire.pending.erase(0, at);
+}
+
+// The operator's pick made over RPC, again and again: every byte the firmware sends from
+// then on has to be part of a valid frame, whatever the test plan and the scans print
+static CheckResult checkRpcSelect(const std::string& select) {
+  bleSim.createFleet(8, 0x5EED1234);
+  simResetClock();
+
+  static RpcWire wire;
+  wire = RpcWire();
+  simConsole.onLine = [&select](const std::string& line) {
+    if (line.compare(0, 19, "Enter device number") != 0 || simConsole.onWrite) return;
+    simConsole.onWrite = [&select](const uint8_t* data, size_t size) { rpcBytes(wire, select, data, size); };
+    simConsoleInput("rpc\n" + selectFrame(select, wire.nextId++));
+  };
+  setup();
+  loopFor(3ull * 60 * 1000000);
+
+  if (!wire.strict) return checkFailed("RPC mode never confirmed");
+  if (wire.unframedBytes || wire.badFrames) {
+    std::string shown;
+    for (char c : wire.unframed) shown += isprint((unsigned char)c) ? c : '.';
+    return checkFailed("%u byte(s) outside frames, %u bad frame(s); first: \"%s\"", wire.unframedBytes,
+                       wire.badFrames, shown.c_str());
+  }
+  // A mode may fail its part (sync without a capture), but the plan before it must have run
+  if (wire.verdicts == 0) {
+    return checkFailed("%u select(s), %u OK, %u verdict(s) in TEXT frames", wire.selects, wire.selectsOk,
+                       wire.verdicts);
+  }
+  return checkPassed();
+}
+
+static const SimCheck simChecks[] = {
+  {"capture-restart", "battery and thermal restarted with notifications queued", checkCaptureRestart},
+  {"rpc-select", "--select over RPC leaves nothing but frames on the link", checkRpcSelect},
+};
+
+static bool runChecks(const char* only, const std::string& select) {
+  bool matched = false;
+  int failed = 0;
+  for (const SimCheck& check : simChecks) {
+    if (strcmp(only, "checks") != 0 && strcmp(only, check.name) != 0) continue;
+    matched = true;
+    CheckResult result;
+    auto run = [&]() { return check.run(select); };
+    if (!runIsolated(std::function<CheckResult()>(run), result)) {
+      result = checkFailed("run failed");
+    }
+    printf("[%s] %s: %s%s%s\n", check.name, check.description, result.passed ? "PASS" : "FAIL",
+           result.passed ? "" : " - ", result.detail);
+    if (!result.passed) failed++;
+  }
+  return matched && failed == 0;
+}
+
+static bool isCheck(const char* name) {
+  if (strcmp(name, "checks") == 0) return true;
+  for (const SimCheck& check : simChecks) {
+    if (strcmp(name, check.name) == 0) return true;
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  const char* only = "all";
+  uint32_t minutes = 10;
+  bool echo = false;
+  std::string select = "1";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--echo") == 0) {
+      echo = true;
+    } else if (strcmp(argv[i], "--select") == 0 && i + 1 < argc) {
+      select = argv[++i];
+    } else if (atoi(argv[i]) > 0) {
+      minutes = atoi(argv[i]);
+    } else {
+      only = argv[i];
+    }
+  }
+
+  // The telemetry log writes next to the working directory; keep runs from sharing one
+  char workDir[] = "/tmp/ble_sim.XXXXXX";
+  if (!mkdtemp(workDir) || chdir(workDir) != 0) {
+    fprintf(stderr, "cannot create a working directory\n");
+    return 1;
+  }
+
+  if (isCheck(only)) return runChecks(only, select) ? 0 : 1;
+
+  std::vector<FaultProfile> profiles = buildProfiles();
+  printf("Fault-injection benchmark: %u simulated minute(s) per profile, 8 units\n", minutes);
+  int matched = 0;
+  int failed = 0;
+  for (auto& profile : profiles) {
+    if (strcmp(only, "all") != 0 && strcmp(only, profile.name) != 0) continue;
+    matched++;
+    ProfileResult result;
+    auto run = [&]() { return runProfile(profile, minutes, echo, select); };
+    if (!runIsolated(std::function<ProfileResult()>(run), result)) {
+      printf("\n[%s] run failed\n", profile.name);
+      failed++;
+      continue;
+    }
+    printResult(profile, result);
+  }
+  if (matched == 0) {
+    fprintf(stderr, "unknown profile '%s'; available:", only);
+    for (auto& profile : profiles) fprintf(stderr, " %s", profile.name);
+    fprintf(stderr, "; checks:");
+    for (const SimCheck& check : simChecks) fprintf(stderr, " %s", check.name);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
+
+#endif  // SIM_MICROBENCH
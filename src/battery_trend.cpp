@@ -0,0 +1,208 @@
+#include "battery_trend.h"
+#include "decode.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "uuids.h"
+
+BatteryTrend batteryTrend;
+
+static BLEUUID BATTERY_LEVEL_UUID((uint16_t)0x2A19);
+
+void TrendChannel::reset(const char* channelName, const String& channelUnit, uint32_t start) {
+  name = channelName;
+  unit = channelUnit;
+  memset(&stats, 0, sizeof(stats));
+  head = 0;
+  startMs = start;
+}
+
+void TrendChannel::add(uint32_t timeMs, float value) {
+  samples[head].timeMs = timeMs;
+  samples[head].value = value;
+  head = (head + 1) % BATTERY_TREND_CAPACITY;
+
+  if (stats.count == 0 || value < stats.min) stats.min = value;
+  if (stats.count == 0 || value > stats.max) stats.max = value;
+  stats.count++;
+  stats.mean += (value - stats.mean) / stats.count;
+
+  double t = (timeMs - startMs) / 1000.0;
+  stats.sumT += t;
+  stats.sumV += value;
+  stats.sumTT += t * t;
+  stats.sumTV += t * value;
+}
+
+double TrendStats::slopePerMinute() const {
+  double denominator = count * sumTT - sumT * sumT;
+  if (count < 2 || denominator <= 0) return 0;
+  return (count * sumTV - sumT * sumV) / denominator * 60.0;
+}
+
+void BatteryTrend::addSource(BLERemoteCharacteristic* pChar, bool isLevel, uint8_t format,
+                             int8_t exponent, uint16_t unitUUID) {
+  if (channelCount >= BATTERY_TREND_CHANNELS) return;
+
+  Source& source = sources[channelCount];
+  source.characteristic = pChar;
+  source.isLevel = isLevel;
+  source.format = format;
+  source.exponent = exponent;
+  source.polled = !pChar->canNotify();
+
+  const char* name = isLevel ? "Battery Level" : (unitUUID == 0x27AE ? "Voltage" : "Current");
+  channels[channelCount].reset(name, unitMap[unitUUID], startMs);
+  channelCount++;
+}
+
+bool BatteryTrend::start(BLEClient* client) {
+  channelCount = 0;
+  startMs = millis();
+  lastPollMs = startMs;
+  lastReportMs = startMs;
+
+  BLERemoteService* battery = client->getService(BATTERY_UUID);
+  if (battery) {
+    BLERemoteCharacteristic* level = battery->getCharacteristic(BATTERY_LEVEL_UUID);
+    if (level && (level->canNotify() || level->canRead())) {
+      addSource(level, true, 0, 0, 0x27B3);
+    }
+  }
+
+  // Vendor voltage/current characteristics are recognised by their CPF unit
+  auto services = client->getServices();
+  if (services) {
+    for (auto& service : *services) {
+      for (auto& chr : *service.second->getCharacteristics()) {
+        BLERemoteCharacteristic* pChar = chr.second;
+        if (!pChar->canNotify() && !pChar->canRead()) continue;
+        uint8_t format;
+        int8_t exponent;
+        uint16_t unitUUID;
+        if (readCpf(pChar, format, exponent, unitUUID) &&
+            (unitUUID == 0x27AE || unitUUID == 0x27AC)) {
+          addSource(pChar, false, format, exponent, unitUUID);
+        }
+      }
+    }
+  }
+
+  if (channelCount == 0) {
+    gattWorker.print(OUT_QUIET, "Battery trend: no battery level, voltage or current characteristics found\n");
+    return false;
+  }
+
+  gattWorker.print(OUT_QUIET, "Battery trend: capturing %u channel(s) for %u s\n", channelCount,
+                   BATTERY_TREND_DURATION_MS / 1000);
+  running = true;
+  // Last, so the first notification finds every source in place
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (sources[i].polled) continue;
+    notifyDispatcher.subscribe(sources[i].characteristic,
+                               [this](BLERemoteCharacteristic* c, const NotifyEvent& event) { onNotify(c, event); });
+  }
+  return true;
+}
+
+bool BatteryTrend::decodeSample(const Source& source, const std::string& raw, float& value) {
+  if (source.isLevel) {
+    if (raw.empty()) return false;
+    value = (uint8_t)raw[0];
+    return true;
+  }
+  DecimalValue decoded;
+  // An IEEE-11073 NaN or INF is no sample
+  if (!decodeDecimal(raw, source.format, source.exponent, decoded) || !decoded.finite()) return false;
+  value = decimalToFloat(decoded);
+  return true;
+}
+
+void BatteryTrend::onNotify(BLERemoteCharacteristic* pChar, const NotifyEvent& event) {
+  if (!running) return;
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (sources[i].characteristic != pChar) continue;
+    float value;
+    if (decodeSample(sources[i], std::string(reinterpret_cast<const char*>(event.data), event.length), value)) {
+      // Time the sample by when it arrived, not by when loop() got to it
+      uint32_t now = millis() - (micros() - event.stampUs) / 1000;
+      // Received before this capture started: it belongs to an earlier one
+      if ((int32_t)(now - startMs) < 0) return;
+      channels[i].add(now, value);
+    }
+    return;
+  }
+}
+
+void BatteryTrend::update(bool connected) {
+  if (!running) return;
+  if (!connected) {
+    consoleOut.begin(OUT_QUIET);
+    consoleOut.print("Battery trend: link lost, reporting partial capture\n");
+    consoleOut.flush();
+    stop();  // releases the dispatcher slots as well
+    return;
+  }
+
+  uint32_t now = millis();
+  if (now - lastPollMs >= BATTERY_TREND_POLL_MS) {
+    lastPollMs = now;
+    for (uint8_t i = 0; i < channelCount; i++) {
+      if (!sources[i].polled) continue;
+      float value;
+      if (decodeSample(sources[i], sources[i].characteristic->readValue(), value)) {
+        channels[i].add(now, value);
+      }
+    }
+  }
+
+  if (now - startMs >= BATTERY_TREND_DURATION_MS) {
+    stop();
+  } else if (now - lastReportMs >= BATTERY_TREND_REPORT_MS) {
+    lastReportMs = now;
+    printSummary(false);
+  }
+}
+
+void BatteryTrend::stop() {
+  if (!running) return;
+  running = false;
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (!sources[i].polled) notifyDispatcher.unsubscribe(sources[i].characteristic);
+  }
+  printSummary(true);
+}
+
+void BatteryTrend::printSummary(bool final) {
+  // Interim summaries follow the verbosity level; the final report is always shown
+  if (!consoleOut.begin(final ? OUT_QUIET : OUT_NORMAL)) return;
+
+  consoleOut.printf("%s at %lus:\n", final ? "\nBattery trend report" : "Battery trend",
+                    (unsigned long)((millis() - startMs) / 1000));
+  for (uint8_t i = 0; i < channelCount; i++) {
+    const TrendStats& stats = channels[i].stats;
+    if (stats.count == 0) {
+      consoleOut.printf("  %s: no samples\n", channels[i].name);
+      continue;
+    }
+    consoleOut.printf("  %s: n=%lu min=%s max=%s mean=%s slope=%s%s/min\n", channels[i].name,
+                      (unsigned long)stats.count, String(stats.min, 2).c_str(),
+                      String(stats.max, 2).c_str(), String(stats.mean, 2).c_str(),
+                      String(stats.slopePerMinute(), 3).c_str(), channels[i].unit.c_str());
+  }
+
+  // The raw ring is only dumped on request; it is what floods the link
+  if (final && outputEnabled(OUT_VERBOSE)) {
+    for (uint8_t i = 0; i < channelCount; i++) {
+      const TrendChannel& channel = channels[i];
+      uint32_t stored = std::min<uint32_t>(channel.stats.count, BATTERY_TREND_CAPACITY);
+      consoleOut.printf("  %s samples (ms,value):", channel.name);
+      for (uint32_t n = 0; n < stored; n++) {
+        const TrendSample& sample =
+          channel.samples[(channel.head + BATTERY_TREND_CAPACITY - stored + n) % BATTERY_TREND_CAPACITY];
+        consoleOut.printf(" %lu,%s", (unsigned long)(sample.timeMs - startMs), String(sample.value, 2).c_str());
+      }
+      consoleOut.print("\n");
+    }
+  }
+  consoleOut.flush();
+}
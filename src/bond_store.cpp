@@ -0,0 +1,200 @@
+#include "bond_store.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "rpa_resolver.h"
+
+BondStore bondStore;
+
+// Authentication completes on the BLE host task; secure() waits for it on the GATT task
+static SemaphoreHandle_t authDone = nullptr;
+
+class StationSecurityCallbacks : public BLESecurityCallbacks {
+  // The station has no display or keyboard: Just Works, and any request from a unit is accepted
+  uint32_t onPassKeyRequest() override { return 0; }
+  void onPassKeyNotify(uint32_t passKey) override {}
+  bool onSecurityRequest() override { return true; }
+  bool onConfirmPIN(uint32_t pin) override { return true; }
+  void onAuthenticationComplete(esp_ble_auth_cmpl_t result) override { bondStore.onAuthComplete(result); }
+};
+static StationSecurityCallbacks securityCallbacks;
+
+const char* linkSecurityName(uint8_t security) {
+  switch (security) {
+    case SECURITY_RESUMED: return "bond resumed";
+    case SECURITY_PAIRED: return "paired";
+    case SECURITY_FAILED: return "encryption failed";
+    default: return "not secured";
+  }
+}
+
+void BondStore::begin() {
+  authDone = xSemaphoreCreateBinary();
+  static BLESecurity security;
+  security.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+  security.setCapability(ESP_IO_CAP_NONE);
+  security.setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  security.setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  BLEDevice::setSecurityCallbacks(&securityCallbacks);
+
+  rpaResolver.begin();
+
+  count = 0;
+  adoptStored();
+  if (count) Serial.printf("Bond store: %u bonded unit(s)\n", (unsigned)count);
+}
+
+// Hands the IRK of every stored bond to the resolver; returns the stack's bond list
+int BondStore::loadKeys(esp_ble_bond_dev_t* stored) {
+  int storedCount = BOND_STORE_MAX;
+  if (esp_ble_get_bond_device_num() <= 0 || esp_ble_get_bond_device_list(&storedCount, stored) != ESP_OK) {
+    return 0;
+  }
+  for (int i = 0; i < storedCount; i++) {
+    if (stored[i].bond_key.key_mask & ESP_BLE_ID_KEY_MASK) {
+      rpaResolver.setKey(stored[i].bd_addr, stored[i].bond_key.pid_key.irk);
+    }
+  }
+  return storedCount;
+}
+
+// Adds the stack's bonds this table does not list yet: all of them at boot, where their
+// order of use is not kept, and a unit just paired. They rank oldest until used.
+void BondStore::adoptStored() {
+  esp_ble_bond_dev_t stored[BOND_STORE_MAX];
+  int storedCount = loadKeys(stored);
+  for (int i = 0; i < storedCount && count < BOND_STORE_MAX; i++) {
+    if (find(stored[i].bd_addr)) continue;
+    Bond& bond = bonds[count++];
+    memcpy(bond.address, stored[i].bd_addr, 6);
+    bond.lastUsed = 0;
+    bond.resumes = 0;
+  }
+}
+
+void BondStore::onAuthComplete(const esp_ble_auth_cmpl_t& result) {
+  authSuccess = result.success;
+  authReason = result.fail_reason;
+  xSemaphoreGive(authDone);
+}
+
+BondStore::Bond* BondStore::find(const uint8_t* address) {
+  for (size_t i = 0; i < count; i++) {
+    if (memcmp(bonds[i].address, address, 6) == 0) return &bonds[i];
+  }
+  return nullptr;
+}
+
+void BondStore::remove(Bond* bond) {
+  rpaResolver.removeKey(bond->address);
+  *bond = bonds[--count];
+}
+
+void BondStore::evictOldest() {
+  Bond* oldest = &bonds[0];
+  for (size_t i = 1; i < count; i++) {
+    if (bonds[i].lastUsed < oldest->lastUsed) oldest = &bonds[i];
+  }
+  esp_ble_remove_bond_device(oldest->address);
+  remove(oldest);
+  evictions++;
+}
+
+bool BondStore::encrypt(esp_bd_addr_t address, uint32_t timeoutMs, BLEClient* client) {
+  xSemaphoreTake(authDone, 0);  // a completion nobody waited for
+  if (esp_ble_set_encryption(address, ESP_BLE_SEC_ENCRYPT) != ESP_OK) return false;
+
+  // Short slices, so a link that drops mid-pairing is noticed without the full timeout
+  uint32_t start = millis();
+  while (xSemaphoreTake(authDone, pdMS_TO_TICKS(50)) != pdTRUE) {
+    if (!client->isConnected() || millis() - start > timeoutMs) return false;
+  }
+  return authSuccess;
+}
+
+LinkSecurity BondStore::secure(BLEClient* client) {
+  // Encryption goes by the address the link was made to; the table is keyed by identity,
+  // which a unit using a resolvable private address only reveals to a bonded station
+  esp_bd_addr_t address;
+  memcpy(address, *client->getPeerAddress().getNative(), 6);
+  uint8_t identity[6];
+  if (!rpaResolver.resolve(address, identity)) memcpy(identity, address, 6);
+
+  uint32_t start = millis();
+  Bond* bond = find(identity);
+  if (bond) {
+    // With a bond the stack starts encryption straight from the stored LTK
+    if (encrypt(address, BOND_RESUME_TIMEOUT_MS, client)) {
+      bond->lastUsed = ++useClock;
+      bond->resumes++;
+      resumes++;
+      resumeMsTotal += millis() - start;
+      return SECURITY_RESUMED;
+    }
+    if (!client->isConnected()) {
+      failures++;
+      return SECURITY_FAILED;
+    }
+    // The unit no longer has its keys (reflashed or reset): drop the stale bond and pair again
+    gattWorker.print(OUT_QUIET, "Stored key rejected by %s (reason 0x%02X); pairing again\n",
+                     client->getPeerAddress().toString().c_str(), (unsigned)authReason);
+    keyMissing++;
+    esp_ble_remove_bond_device(identity);
+    remove(bond);
+    start = millis();
+  }
+
+  // The stack refuses to pair once its own storage is full, so its count decides
+  if (esp_ble_get_bond_device_num() > (int)count) adoptStored();
+  while (count > 0 && (count >= BOND_STORE_MAX || esp_ble_get_bond_device_num() >= BOND_STORE_MAX)) {
+    evictOldest();
+  }
+  if (!encrypt(address, BOND_PAIRING_TIMEOUT_MS, client)) {
+    failures++;
+    gattWorker.print(OUT_QUIET, "Pairing with %s failed (reason 0x%02X)\n", client->getPeerAddress().toString().c_str(),
+                     (unsigned)authReason);
+    return SECURITY_FAILED;
+  }
+
+  // Key distribution gave the unit's IRK and identity address to the stack, which keys
+  // the bond by identity; the entry adopted from it is the one to update
+  adoptStored();
+  if (!rpaResolver.resolve(address, identity)) memcpy(identity, address, 6);
+
+  Bond* fresh = find(identity);
+  if (!fresh && count < BOND_STORE_MAX) {
+    fresh = &bonds[count++];
+    memcpy(fresh->address, identity, 6);
+  }
+  if (fresh) {
+    fresh->lastUsed = ++useClock;
+    fresh->resumes = 0;
+  }
+  pairings++;
+  pairingMsTotal += millis() - start;
+  return SECURITY_PAIRED;
+}
+
+void BondStore::forget(const uint8_t* address) {
+  for (size_t i = count; i-- > 0;) {
+    if (address && memcmp(bonds[i].address, address, 6) != 0) continue;
+    esp_ble_remove_bond_device(bonds[i].address);
+    remove(&bonds[i]);
+  }
+}
+
+void BondStore::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Bonds: %u/%u stored, %lu paired (avg %lu ms), %lu resumed (avg %lu ms), "
+                    "%lu key(s) missing, %lu evicted, %lu failed\n",
+                    (unsigned)count, (unsigned)BOND_STORE_MAX, (unsigned long)pairings,
+                    (unsigned long)(pairings ? pairingMsTotal / pairings : 0), (unsigned long)resumes,
+                    (unsigned long)(resumes ? resumeMsTotal / resumes : 0), (unsigned long)keyMissing,
+                    (unsigned long)evictions, (unsigned long)failures);
+  for (size_t i = 0; i < count; i++) {
+    const Bond& bond = bonds[i];
+    consoleOut.printf("  %02x:%02x:%02x:%02x:%02x:%02x  resumed %lu time(s), last use #%lu\n", bond.address[0],
+                      bond.address[1], bond.address[2], bond.address[3], bond.address[4], bond.address[5],
+                      (unsigned long)bond.resumes, (unsigned long)bond.lastUsed);
+  }
+  consoleOut.flush();
+}
@@ -0,0 +1,100 @@
+#include "client_pool.h"
+#include "output.h"
+
+ClientPool clientPool;
+
+BLEClient* ClientPool::acquire(BLEClientCallbacks* callbacks) {
+  Entry* chosen = nullptr;
+  for (Entry& entry : entries) {
+    if (entry.client && !entry.taken && !entry.client->isConnected()) {
+      chosen = &entry;
+      break;
+    }
+  }
+  if (!chosen && created < CLIENT_POOL_SIZE) {
+    chosen = &entries[created++];
+    chosen->client = BLEDevice::createClient();
+  }
+  if (!chosen) {
+    // Everything free is still closing a link; the first to finish is as good as any
+    for (Entry& entry : entries) {
+      if (!entry.taken) {
+        teardownWaits++;
+        if (waitForTeardown(entry.client)) chosen = &entry;
+        break;
+      }
+    }
+  }
+  if (!chosen) return nullptr;
+
+  chosen->taken = true;
+  chosen->client->setClientCallbacks(callbacks);
+  acquired++;
+  return chosen->client;
+}
+
+void ClientPool::release(BLEClient* client) {
+  for (Entry& entry : entries) {
+    if (entry.client != client) continue;
+    // The disconnect below belongs to nobody; the next user installs its own callbacks
+    client->setClientCallbacks(nullptr);
+    client->disconnect();
+    entry.taken = false;
+    return;
+  }
+}
+
+bool ClientPool::waitForTeardown(BLEClient* client, uint32_t timeoutMs) {
+  uint32_t start = millis();
+  while (client->isConnected()) {
+    if (millis() - start > timeoutMs) return false;
+    delay(5);
+  }
+  return true;
+}
+
+void ClientPool::recordConnect(const std::string& address, const ConnectTiming& timing) {
+  auto found = latency.find(address);
+  if (found == latency.end()) {
+    // Full: the unit connected least often makes room
+    if (latency.size() >= CONNECT_STATS_MAX) {
+      auto rarest = latency.begin();
+      for (auto it = latency.begin(); it != latency.end(); ++it) {
+        if (it->second.count < rarest->second.count) rarest = it;
+      }
+      latency.erase(rarest);
+    }
+    Latency fresh = {};
+    fresh.minMs = UINT32_MAX;
+    found = latency.emplace(address, fresh).first;
+  }
+
+  Latency& entry = found->second;
+  uint32_t totalMs = timing.queuedMs + timing.linkMs + timing.securityMs + timing.discoveryMs;
+  entry.count++;
+  entry.lastMs = totalMs;
+  entry.sumMs += totalMs;
+  if (totalMs < entry.minMs) entry.minMs = totalMs;
+  if (totalMs > entry.maxMs) entry.maxMs = totalMs;
+  entry.last = timing;
+}
+
+void ClientPool::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Clients: %u created, %lu acquired, %lu teardown wait(s)\n", (unsigned)created,
+                    (unsigned long)acquired, (unsigned long)teardownWaits);
+  if (!latency.empty()) {
+    consoleOut.print("Connect latency, unit chosen to services discovered\n"
+                     "(last: queued + link + security + discovery)\n"
+                     "Address           | Connects | Last ms | Queued | Link | Security | Discovery | Min ms | Avg ms | Max ms\n");
+  }
+  for (auto& item : latency) {
+    const Latency& entry = item.second;
+    consoleOut.printf("%-17s | %8lu | %7lu | %6lu | %4lu | %8lu | %9lu | %6lu | %6lu | %6lu\n", item.first.c_str(),
+                      (unsigned long)entry.count, (unsigned long)entry.lastMs,
+                      (unsigned long)entry.last.queuedMs, (unsigned long)entry.last.linkMs,
+                      (unsigned long)entry.last.securityMs, (unsigned long)entry.last.discoveryMs, (unsigned long)entry.minMs,
+                      (unsigned long)(entry.sumMs / entry.count), (unsigned long)entry.maxMs);
+  }
+  consoleOut.flush();
+}
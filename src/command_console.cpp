@@ -0,0 +1,338 @@
+#include "command_console.h"
+#include "loop_events.h"
+#include "output.h"
+
+CommandConsole commandConsole;
+
+static const char* STATUS_TEXT[] = {"ok", "bad arguments", "not now", "not found", "GATT error", "busy",
+                                    "unknown command", "bad frame"};
+
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool ConsoleArg::is(const char* word) const {
+  if (strlen(word) != length) return false;
+  for (size_t i = 0; i < length; i++) {
+    if (tolower((unsigned char)data[i]) != tolower((unsigned char)word[i])) return false;
+  }
+  return true;
+}
+
+long ConsoleArg::toInt() const {
+  size_t i = 0;
+  bool negative = length > 0 && data[0] == '-';
+  if (negative) i++;
+  long value = 0;
+  for (; i < length && data[i] >= '0' && data[i] <= '9'; i++) value = value * 10 + (data[i] - '0');
+  return negative ? -value : value;
+}
+
+size_t ConsoleRequest::bytes(uint8_t index, uint8_t* out, size_t capacity) const {
+  if (index >= argc) return 0;
+  const ConsoleArg& arg = argv[index];
+  if (binary) {
+    size_t count = std::min<size_t>(arg.length, capacity);
+    memcpy(out, arg.data, count);
+    return count;
+  }
+
+  // Separators such as ':' or '-' between the digits are skipped
+  size_t count = 0;
+  int high = -1;
+  for (size_t i = 0; i < arg.length && count < capacity; i++) {
+    int nibble = hexNibble(arg.data[i]);
+    if (nibble < 0) continue;
+    if (high < 0) {
+      high = nibble;
+    } else {
+      out[count++] = high << 4 | nibble;
+      high = -1;
+    }
+  }
+  return count;
+}
+
+void CommandConsole::begin(const ConsoleCommand* table, size_t count, ConsoleHandler fallback) {
+  commands = table;
+  commandCount = count;
+  unmatched = fallback;
+}
+
+void CommandConsole::poll() {
+  int available = Serial.available();
+  if (available > 0 && rxLength < sizeof(rx)) {
+    size_t room = sizeof(rx) - rxLength;
+    size_t got = Serial.readBytes(reinterpret_cast<uint8_t*>(rx) + rxLength, std::min<size_t>(available, room));
+    rxLength += got;
+    bytesIn += got;
+    if (rxLength > rxHighWater) rxHighWater = rxLength;
+  }
+
+  size_t start = 0;
+  for (;;) {
+    size_t used = binary ? parseFrame(start) : parseLine(start);
+    if (used == 0) break;
+    start += used;
+  }
+
+  // Only an unfinished line or frame is left; move it to the front
+  if (start) {
+    memmove(rx, rx + start, rxLength - start);
+    rxLength -= start;
+  }
+  if (!binary && rxLength == sizeof(rx)) {
+    overflows++;
+    rxLength = 0;
+    discarding = true;
+    consoleOut.begin(OUT_QUIET);
+    consoleOut.print("Error: line too long\n");
+    consoleOut.flush();
+  }
+
+  // More than fitted this time: come straight back
+  if (Serial.available()) loopEvents.signal(LOOP_EVENT_INPUT);
+}
+
+size_t CommandConsole::parseLine(size_t start) {
+  const char* line = rx + start;
+  const char* end = static_cast<const char*>(memchr(line, '\n', rxLength - start));
+  if (!end) return 0;
+  size_t used = end - line + 1;
+  if (discarding) {
+    discarding = false;
+    return used;
+  }
+
+  ConsoleRequest request;
+  request.binary = false;
+  request.id = 0;
+  request.opcode = 0;
+  request.argc = 0;
+  const char* p = line;
+  while (p < end && request.argc < CONSOLE_MAX_ARGS) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if (p == end) break;
+    const char* word = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    request.argv[request.argc].data = word;
+    request.argv[request.argc].length = std::min<size_t>(p - word, 255);
+    request.argc++;
+  }
+  if (request.argc == 0) return used;
+
+  textCommands++;
+  loopEvents.handled(LOOP_EVENT_INPUT);
+  run(request);
+  return used;
+}
+
+size_t CommandConsole::parseFrame(size_t start) {
+  // Anything before a sync byte is noise (or text typed by mistake) and is dropped
+  const char* sync = static_cast<const char*>(memchr(rx + start, CONSOLE_FRAME_SYNC, rxLength - start));
+  if (!sync) return rxLength - start;
+  if (sync != rx + start) return sync - (rx + start);
+
+  const uint8_t* frame = reinterpret_cast<const uint8_t*>(rx + start);
+  size_t available = rxLength - start;
+  if (available < 4 || available < 4 + (size_t)frame[3] + 1) return 0;
+
+  size_t payloadEnd = 4 + frame[3];
+  uint8_t check = 0;
+  for (size_t i = 1; i < payloadEnd; i++) check ^= frame[i];
+  if (check != frame[payloadEnd]) {
+    // Skip just the sync byte; the real frame may start inside this one
+    badFrames++;
+    sendResult(frame[2], frame[1], STATUS_BAD_FRAME, nullptr, 0);
+    return 1;
+  }
+
+  ConsoleRequest request;
+  request.binary = true;
+  request.id = frame[2];
+  request.opcode = frame[1];
+  request.argc = 1;
+  for (size_t p = 4; p < payloadEnd;) {
+    uint8_t length = frame[p++];
+    if (p + length > payloadEnd || request.argc == CONSOLE_MAX_ARGS) {
+      badFrames++;
+      sendResult(request.id, request.opcode, STATUS_BAD_FRAME, nullptr, 0);
+      return payloadEnd + 1;
+    }
+    request.argv[request.argc].data = reinterpret_cast<const char*>(frame + p);
+    request.argv[request.argc].length = length;
+    request.argc++;
+    p += length;
+  }
+
+  rpcRequests++;
+  loopEvents.handled(LOOP_EVENT_INPUT);
+  run(request);
+  return payloadEnd + 1;
+}
+
+const ConsoleCommand* CommandConsole::find(const ConsoleArg& name) const {
+  for (size_t i = 0; i < commandCount; i++) {
+    if (name.is(commands[i].name)) return &commands[i];
+  }
+  return nullptr;
+}
+
+const ConsoleCommand* CommandConsole::find(uint8_t opcode) const {
+  for (size_t i = 0; i < commandCount; i++) {
+    if (commands[i].opcode == opcode) return &commands[i];
+  }
+  return nullptr;
+}
+
+void CommandConsole::run(ConsoleRequest& request) {
+  if (!request.binary) {
+    if (request.argv[0].is("rpc")) {
+      // The first RESULT frame tells the script the console now speaks frames
+      binary = true;
+      sendResult(0, CONSOLE_OPCODE_EXIT, STATUS_OK, nullptr, 0);
+      restoreSink();
+      return;
+    }
+    const ConsoleCommand* command = find(request.argv[0]);
+    uint8_t status = STATUS_UNKNOWN;
+    if (command) {
+      request.opcode = command->opcode;
+      status = command->handler(request);
+    } else if (unmatched) {
+      status = unmatched(request);
+    }
+
+    if (status == STATUS_PENDING) {
+      waiting = true;
+      waitingBinary = false;
+    } else if (status != STATUS_OK) {
+      Serial.printf("Error: %s", STATUS_TEXT[std::min<uint8_t>(status, STATUS_BAD_FRAME)]);
+      if (status == STATUS_BAD_ARGS && command) Serial.printf(" (usage: %s)", command->usage);
+      if (status == STATUS_UNKNOWN) Serial.print("; 'help' lists the commands");
+      Serial.println();
+    }
+    return;
+  }
+
+  if (request.opcode == CONSOLE_OPCODE_EXIT) {
+    sendResult(request.id, request.opcode, STATUS_OK, nullptr, 0);
+    binary = false;
+    restoreSink();
+    return;
+  }
+  const ConsoleCommand* command = find(request.opcode);
+  if (!command) {
+    sendResult(request.id, request.opcode, STATUS_UNKNOWN, nullptr, 0);
+    return;
+  }
+  request.argv[0].data = command->name;
+  request.argv[0].length = strlen(command->name);
+
+  // Tables and reports the handler prints come back framed, ahead of the result
+  textFrames.id = request.id;
+  consoleOut.redirect(&textFrames);
+  uint8_t status = command->handler(request);
+
+  if (status == STATUS_PENDING) {
+    waiting = true;
+    waitingBinary = true;
+    waitingId = request.id;
+    waitingOpcode = request.opcode;
+  } else {
+    sendResult(request.id, request.opcode, status, nullptr, 0);
+  }
+  restoreSink();
+}
+
+void CommandConsole::complete(uint8_t status, const uint8_t* data, size_t length) {
+  if (!waiting) return;
+  waiting = false;
+  if (waitingBinary) {
+    sendResult(waitingId, waitingOpcode, status, data, length);
+    // Nothing may follow the RESULT frame under its id
+    restoreSink();
+  } else if (status != STATUS_OK && !binary) {
+    Serial.printf("Error: %s\n", STATUS_TEXT[std::min<uint8_t>(status, STATUS_BAD_FRAME)]);
+  }
+}
+
+void CommandConsole::restoreSink() {
+  if (!binary) {
+    consoleOut.redirect(nullptr);
+  } else if (waiting && waitingBinary) {
+    textFrames.id = waitingId;
+    consoleOut.redirect(&textFrames);
+  } else {
+    consoleOut.redirect(&noText);
+  }
+}
+
+void CommandConsole::notify(BLEUUID uuid, uint16_t handle, const uint8_t* data, size_t length) {
+  if (binary) {
+    uint8_t head[2] = {(uint8_t)(handle & 0xFF), (uint8_t)(handle >> 8)};
+    sendFrame(FRAME_NOTIFY, notifySequence++, head, sizeof(head), data, length);
+    return;
+  }
+  if (!consoleOut.begin(OUT_NORMAL)) return;
+  consoleOut.printf("Notify %s:", uuid.toString().c_str());
+  for (size_t i = 0; i < length; i++) consoleOut.printf(" %02X", data[i]);
+  consoleOut.print("\n");
+  consoleOut.flush();
+}
+
+void CommandConsole::sendFrame(uint8_t type, uint8_t seq, const uint8_t* head, size_t headLength,
+                               const uint8_t* data, size_t length) {
+  uint8_t frame[4 + CONSOLE_FRAME_MAX + 1];
+  length = std::min(length, CONSOLE_FRAME_MAX - headLength);
+  frame[0] = CONSOLE_FRAME_SYNC;
+  frame[1] = type;
+  frame[2] = seq;
+  frame[3] = headLength + length;
+  if (headLength) memcpy(frame + 4, head, headLength);
+  if (length) memcpy(frame + 4 + headLength, data, length);
+  size_t end = 4 + headLength + length;
+  uint8_t check = 0;
+  for (size_t i = 1; i < end; i++) check ^= frame[i];
+  frame[end] = check;
+  Serial.write(frame, end + 1);
+}
+
+void CommandConsole::sendResult(uint8_t id, uint8_t opcode, uint8_t status, const uint8_t* data,
+                                size_t length) {
+  uint8_t head[2] = {opcode, status};
+  sendFrame(FRAME_RESULT, id, head, sizeof(head), data, length);
+}
+
+size_t CommandConsole::TextFrames::write(const uint8_t* data, size_t length) {
+  for (size_t sent = 0; sent < length;) {
+    size_t chunk = std::min<size_t>(length - sent, CONSOLE_FRAME_MAX);
+    commandConsole.sendFrame(FRAME_TEXT, id, nullptr, 0, data + sent, chunk);
+    sent += chunk;
+  }
+  return length;
+}
+
+void CommandConsole::printHelp() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.print("Commands:\n");
+  for (size_t i = 0; i < commandCount; i++) {
+    if (commands[i].opcode) consoleOut.printf("  %-40s rpc 0x%02X\n", commands[i].usage, commands[i].opcode);
+  }
+  consoleOut.print("  <number> [battery|thermal|capture|sync|monitor]  test the listed device\n"
+                   "  rpc                                              switch to framed RPC (opcode 0x00 returns)\n");
+  consoleOut.flush();
+}
+
+void CommandConsole::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Console: %s mode, %lu command(s), %lu RPC request(s), %lu bad frame(s), %lu overflow(s), "
+                    "%lu byte(s) in, buffer peak %u/%u\n",
+                    binary ? "rpc" : "text", (unsigned long)textCommands, (unsigned long)rpcRequests,
+                    (unsigned long)badFrames, (unsigned long)overflows, (unsigned long)bytesIn,
+                    (unsigned)rxHighWater, (unsigned)CONSOLE_RX_SIZE);
+  consoleOut.flush();
+}
@@ -0,0 +1,208 @@
+#include "control_channel.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "uuids.h"
+#include <esp_gattc_api.h>
+
+ControlChannel controlChannel;
+
+// The read-back completes on the GATTC event handler, so its timeout can run while it is
+// outstanding; the response is copied out of the handler
+static SemaphoreHandle_t readDone = nullptr;
+static volatile uint16_t readHandle = 0;
+static volatile esp_gatt_status_t readStatus = ESP_GATT_OK;
+static uint8_t readValue[CONTROL_MAX_PAYLOAD + 1];
+static volatile size_t readLength = 0;
+
+static void controlGattcHandler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                esp_ble_gattc_cb_param_t* param) {
+  if (event != ESP_GATTC_READ_CHAR_EVT || param->read.handle != readHandle) return;
+  readStatus = param->read.status;
+  readLength = std::min<size_t>(param->read.value_len, sizeof(readValue));
+  memcpy(readValue, param->read.value, readLength);
+  xSemaphoreGive(readDone);
+}
+
+ControlCommand makeControlCommand(const char* name, const uint8_t* data, uint8_t length,
+                                  ControlConfirm confirm) {
+  ControlCommand command;
+  command.name = name;
+  command.length = std::min<uint8_t>(length, CONTROL_MAX_PAYLOAD);
+  memcpy(command.data, data, command.length);
+  command.confirm = confirm;
+  command.retries = CONTROL_DEFAULT_RETRIES;
+  command.timeoutMs = CONTROL_DEFAULT_TIMEOUT_MS;
+  return command;
+}
+
+bool ControlChannel::attach(BLEClient* link) {
+  detach();
+  if (!readDone) {
+    readDone = xSemaphoreCreateBinary();
+    indicationDone = xSemaphoreCreateBinary();
+    addGattcHandler(controlGattcHandler);
+  }
+  if (!link || !link->isConnected()) {
+    gattWorker.print(OUT_QUIET, "Control channel: not connected\n");
+    return false;
+  }
+
+  BLERemoteService* pControlService = link->getService(CONTROL_UUID);
+  if (!pControlService) {
+    gattWorker.print(OUT_QUIET, "Control Service not found\n");
+    return false;
+  }
+
+  controlReg = pControlService->getCharacteristic(CONTROL_REG_UUID);
+  if (!controlReg) {
+    gattWorker.print(OUT_QUIET, "Control Register characteristic not found\n");
+    return false;
+  }
+
+  if (!controlReg->canWrite() && !controlReg->canWriteNoResponse()) {
+    gattWorker.print(OUT_QUIET, "Control Register is not writable\n");
+    controlReg = nullptr;
+    return false;
+  }
+
+  client = link;
+  canPipeline = controlReg->canWriteNoResponse() && controlReg->canRead();
+  canIndicate = controlReg->canIndicate();
+  if (canIndicate) {
+    controlReg->registerForNotify([this](BLERemoteCharacteristic*, uint8_t* data, size_t length, bool) {
+      onIndication(data, length);
+    }, false);
+  }
+  return true;
+}
+
+void ControlChannel::detach() {
+  // Over a dropped link there is no subscription left to undo
+  if (controlReg && canIndicate && client && client->isConnected()) controlReg->registerForNotify(nullptr);
+  client = nullptr;
+  controlReg = nullptr;
+  canIndicate = false;
+  queued = 0;
+}
+
+bool ControlChannel::enqueue(const ControlCommand& command) {
+  if (queued >= CONTROL_QUEUE_DEPTH) return false;
+  queue[queued++] = command;
+  return true;
+}
+
+void ControlChannel::onIndication(uint8_t* data, size_t length) {
+  indicationLength = std::min<size_t>(length, CONTROL_MAX_PAYLOAD);
+  memcpy(indication, data, indicationLength);
+  xSemaphoreGive(indicationDone);
+}
+
+bool ControlChannel::readBackMatches(const ControlCommand& command, uint32_t waitMs) {
+  xSemaphoreTake(readDone, 0);  // a response that arrived after an earlier timeout
+  readHandle = controlReg->getHandle();
+  if (esp_ble_gattc_read_char(client->getGattcIf(), client->getConnId(), readHandle, ESP_GATT_AUTH_REQ_NONE) !=
+          ESP_OK ||
+      xSemaphoreTake(readDone, pdMS_TO_TICKS(waitMs)) != pdTRUE) {
+    return false;
+  }
+  return readStatus == ESP_GATT_OK && readLength == command.length &&
+         memcmp(readValue, command.data, command.length) == 0;
+}
+
+bool ControlChannel::writeAndConfirm(const ControlCommand& command) {
+  ControlConfirm confirm = command.confirm;
+  // Without the matching property, fall back to the strongest confirmation available
+  if (confirm == CONFIRM_INDICATION && !canIndicate) confirm = CONFIRM_READBACK;
+  if (confirm == CONFIRM_READBACK && !controlReg->canRead()) confirm = CONFIRM_RESPONSE;
+
+  xSemaphoreTake(indicationDone, 0);
+  uint32_t start = millis();
+  controlReg->writeValue(const_cast<uint8_t*>(command.data), command.length, true);
+  uint32_t elapsed = millis() - start;
+  if (confirm != CONFIRM_RESPONSE && elapsed > command.timeoutMs) return false;
+
+  switch (confirm) {
+    case CONFIRM_READBACK:
+      return readBackMatches(command, command.timeoutMs - elapsed);
+    case CONFIRM_INDICATION:
+      return xSemaphoreTake(indicationDone, pdMS_TO_TICKS(command.timeoutMs - elapsed)) == pdTRUE &&
+             indicationLength == command.length && memcmp(indication, command.data, command.length) == 0;
+    default:
+      return true;
+  }
+}
+
+size_t ControlChannel::runPipelined(size_t first) {
+  // Fire the whole run of write-without-response commands back to back
+  size_t last = first;
+  while (last + 1 < queued && queue[last + 1].confirm == CONFIRM_NONE) last++;
+
+  uint32_t start = micros();
+  for (size_t i = first; i < last; i++) {
+    controlReg->writeValue(queue[i].data, queue[i].length, false);
+  }
+
+  // The register holds only the last value written, so the earlier commands cannot be
+  // read back; the last one is confirmed, and only it is resent when that fails
+  uint8_t attempts = 0;
+  bool ok = false;
+  while (!ok && attempts <= queue[last].retries && client->isConnected()) {
+    attempts++;
+    controlReg->writeValue(queue[last].data, queue[last].length, false);
+    ok = readBackMatches(queue[last], queue[last].timeoutMs);
+  }
+
+  uint32_t latency = micros() - start;
+  for (size_t i = first; i < last; i++) {
+    results[resultCount++] = {queue[i].name, CONTROL_UNCONFIRMED, 1, latency};
+  }
+  results[resultCount++] = {queue[last].name, ok ? CONTROL_OK : CONTROL_FAILED, attempts, latency};
+  return last;
+}
+
+size_t ControlChannel::run() {
+  resultCount = 0;
+  size_t failures = 0;
+
+  for (size_t i = 0; i < queued; i++) {
+    if (!controlReg) {
+      results[resultCount++] = {queue[i].name, CONTROL_FAILED, 0, 0};
+      failures++;
+      continue;
+    }
+
+    if (queue[i].confirm == CONFIRM_NONE && canPipeline) {
+      size_t first = resultCount;
+      i = runPipelined(i);
+      for (size_t r = first; r < resultCount; r++) failures += results[r].outcome == CONTROL_FAILED;
+      continue;
+    }
+
+    ControlCommand command = queue[i];
+    if (command.confirm == CONFIRM_NONE) command.confirm = CONFIRM_RESPONSE;
+
+    uint32_t start = micros();
+    uint8_t attempts = 0;
+    bool ok = false;
+    while (!ok && attempts <= command.retries) {
+      attempts++;
+      ok = writeAndConfirm(command);
+    }
+    results[resultCount++] = {command.name, ok ? CONTROL_OK : CONTROL_FAILED, attempts, (uint32_t)(micros() - start)};
+    failures += !ok;
+  }
+
+  queued = 0;
+  return failures;
+}
+
+void ControlChannel::printResults() {
+  if (!consoleOut.begin(OUT_NORMAL)) return;
+  static const char* const outcomes[] = {"FAIL", "OK  ", "UNCF"};
+  for (size_t i = 0; i < resultCount; i++) {
+    consoleOut.printf("  %-16s %s attempts=%u latency=%luus\n", results[i].name,
+                      outcomes[results[i].outcome], (unsigned)results[i].attempts,
+                      (unsigned long)results[i].latencyUs);
+  }
+  consoleOut.flush();
+}
@@ -0,0 +1,354 @@
+#include "decode.h"
+#include "uuids.h"
+#include "mem_budget.h"
+#include <algorithm>
+#include <cmath>
+
+// Unit mapping for CPF descriptor (unit UUID -> unit string)
+std::map<uint16_t, String> unitMap = {
+  {0x2700, ""},         // unitless
+  {0x2763, "km/h"},     // kilometres per hour
+  {0x27AD, "rpm"},      // revolutions per minute
+  {0x2701, "m"},        // metres
+  {0x27B1, "°C"},       // degrees Celsius
+  {0x27B3, "%"},        // percentage
+  {0x27AE, "V"},        // volts
+  {0x27AC, "A"}         // amperes
+};
+
+// Service/Characteristic Name Map
+std::map<std::string, std::string> uuidNames = {
+  {DIS_UUID.toString(), "Device Information Service"},
+  {TEMP_UUID.toString(), "Temperature Service"},
+  {CSCP_UUID.toString(), "Cycling Speed and Cadence"},
+  {USER_UUID.toString(), "User Service"},
+  {BATTERY_UUID.toString(), "Battery Service"},
+  {CONTROL_UUID.toString(), "Control Service"},
+  {CONTROL_REG_UUID.toString(), "Control Register"},
+  {"0x2A29", "Manufacturer Name String"},
+  {"0x2A24", "Model Number String"},
+  {"0x2A5B", "CSC Measurement"}
+};
+
+String getUuidName(BLEUUID uuid) {
+  std::string uuidStr = uuid.toString();
+  return (uuidNames.find(uuidStr) != uuidNames.end()) ? 
+         String(uuidNames[uuidStr].c_str()) : 
+         String(uuidStr.c_str());
+}
+
+// Integer formats by CPF format code. 0x04, 0x08, 0x0A and 0x0E keep the meanings the
+// units' firmware gives them; the newer formats use their Bluetooth SIG codes.
+struct IntegerFormat {
+  uint8_t format;
+  uint8_t bytes;
+  bool isSigned;
+};
+static const IntegerFormat integerFormats[] = {
+  {0x04, 4, false},  // uint32
+  {0x06, 2, false},  // uint16
+  {0x07, 3, false},  // uint24
+  {0x08, 4, true},   // int32
+  {0x09, 6, false},  // uint48
+  {0x0A, 2, true},   // int16
+  {0x0F, 3, true},   // sint24
+  {0x11, 6, true},   // sint48
+};
+
+#define FORMAT_BOOLEAN 0x01
+#define FORMAT_UINT128 0x0B
+#define FORMAT_FLOAT32 0x0E
+#define FORMAT_SFLOAT 0x16  // IEEE-11073 16-bit: 4-bit exponent, 12-bit mantissa
+#define FORMAT_FLOAT 0x17   // IEEE-11073 32-bit: 8-bit exponent, 24-bit mantissa
+
+#define FLOAT32_DIGITS 7    // significant digits a float carries
+
+// Powers of ten that are exact in a double (10^22 is the largest), an int64 and a float (10^10)
+static const double pow10Table[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+static const int64_t pow10Integers[] = {1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+                                        100000000LL, 1000000000LL, 10000000000LL, 100000000000LL,
+                                        1000000000000LL, 10000000000000LL, 100000000000000LL,
+                                        1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+                                        1000000000000000000LL};
+static const float pow10fTable[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+// One correctly rounded multiply or divide by an exact power of ten, where pow() adds
+// its own error (10^-2 has no exact double) and a libm call. Only float32 and uint128
+// take this path.
+static double scaleDecimal(double mantissa, int exponent) {
+  for (; exponent > 22; exponent -= 22) mantissa *= 1e22;
+  for (; exponent < -22; exponent += 22) mantissa /= 1e22;
+  return exponent >= 0 ? mantissa * pow10Table[exponent] : mantissa / pow10Table[-exponent];
+}
+
+static uint64_t readLittleEndian(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = bytes; i > 0; i--) value = (value << 8) | data[i - 1];
+  return value;
+}
+
+static int64_t signExtend(uint64_t value, unsigned bits) {
+  uint64_t sign = 1ULL << (bits - 1);
+  return (int64_t)((value ^ sign) - sign);
+}
+
+// Decimal digits of an unsigned number, most significant first; returns the count
+static size_t decimalDigits(uint64_t value, char* digits) {
+  char reversed[20];
+  size_t count = 0;
+  do {
+    reversed[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  for (size_t i = 0; i < count; i++) digits[i] = reversed[count - 1 - i];
+  return count;
+}
+
+// Decimal digits of a little-endian uint128, by long division over 32-bit limbs
+static size_t uint128Digits(const uint8_t* data, char* digits) {
+  uint32_t limbs[4];  // most significant first
+  for (int i = 0; i < 4; i++) limbs[i] = readLittleEndian(data + (3 - i) * 4, 4);
+  size_t count = 0;
+  bool more;
+  do {
+    uint64_t remainder = 0;
+    more = false;
+    for (uint32_t& limb : limbs) {
+      uint64_t current = (remainder << 32) | limb;
+      limb = current / 10;
+      remainder = current % 10;
+      more |= limb != 0;
+    }
+    digits[count++] = '0' + remainder;
+  } while (more);
+  std::reverse(digits, digits + count);
+  return count;
+}
+
+static bool setExponent(DecimalValue& value, int exponent) {
+  if (exponent < INT8_MIN || exponent > INT8_MAX) return false;
+  value.exponent = exponent;
+  return true;
+}
+
+static bool decodeMedfloat(uint32_t word, unsigned mantissaBits, unsigned totalBits, int8_t exponent,
+                           DecimalValue& value) {
+  // Reserved mantissas, with a zero exponent
+  uint32_t top = 1UL << (mantissaBits - 1);
+  value.special = word == top - 1   ? DECIMAL_NAN
+                  : word == top     ? DECIMAL_NRES
+                  : word == top - 2 ? DECIMAL_POS_INF
+                  : word == top + 2 ? DECIMAL_NEG_INF
+                  : word == top + 1 ? DECIMAL_RESERVED
+                                    : DECIMAL_FINITE;
+  value.mantissa = signExtend(word & ((1UL << mantissaBits) - 1), mantissaBits);
+  return setExponent(value, exponent + signExtend(word >> mantissaBits, totalBits - mantissaBits));
+}
+
+static bool decodeFloat32(float number, int8_t exponent, DecimalValue& value) {
+  if (std::isnan(number)) {
+    value.special = DECIMAL_NAN;
+    return true;
+  }
+  if (std::isinf(number)) {
+    value.special = number > 0 ? DECIMAL_POS_INF : DECIMAL_NEG_INF;
+    return true;
+  }
+  if (number == 0) return setExponent(value, exponent);
+  int shift = FLOAT32_DIGITS - 1 - (int)floor(log10(fabs(number)));
+  value.mantissa = llround(scaleDecimal(number, shift));
+  while (value.mantissa % 10 == 0) {
+    value.mantissa /= 10;
+    shift--;
+  }
+  return setExponent(value, exponent - shift);
+}
+
+bool decodeDecimal(const std::string& rawValue, uint8_t format, int8_t exponent, DecimalValue& value) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(rawValue.data());
+  value = DecimalValue();
+  value.exponent = exponent;
+  for (const IntegerFormat& integer : integerFormats) {
+    if (integer.format != format) continue;
+    if (rawValue.size() < integer.bytes) return false;
+    uint64_t raw = readLittleEndian(data, integer.bytes);
+    value.mantissa = integer.isSigned ? signExtend(raw, integer.bytes * 8) : (int64_t)raw;
+    return true;
+  }
+
+  switch (format) {
+    case FORMAT_BOOLEAN:
+      value.mantissa = (!rawValue.empty() && rawValue[0]) ? 1 : 0;
+      value.exponent = 0;
+      return true;
+    case FORMAT_SFLOAT:
+      return rawValue.size() >= 2 && decodeMedfloat(readLittleEndian(data, 2), 12, 16, exponent, value);
+    case FORMAT_FLOAT:
+      return rawValue.size() >= 4 && decodeMedfloat(readLittleEndian(data, 4), 24, 32, exponent, value);
+    case FORMAT_FLOAT32: {
+      if (rawValue.size() < 4) return false;
+      float number;
+      memcpy(&number, data, sizeof(number));
+      return decodeFloat32(number, exponent, value);
+    }
+    case FORMAT_UINT128: {  // the leading 18 digits; convertRawValue prints them all
+      if (rawValue.size() < 16) return false;
+      char digits[40];
+      size_t count = uint128Digits(data, digits);
+      size_t kept = std::min<size_t>(count, 18);
+      for (size_t i = 0; i < kept; i++) value.mantissa = value.mantissa * 10 + (digits[i] - '0');
+      return setExponent(value, exponent + (int)(count - kept));
+    }
+  }
+  return false;
+}
+
+uint8_t cpfValueSize(uint8_t format) {
+  for (const IntegerFormat& integer : integerFormats) {
+    if (integer.format == format) return integer.bytes;
+  }
+  switch (format) {
+    case FORMAT_BOOLEAN: return 1;
+    case FORMAT_SFLOAT: return 2;
+    case FORMAT_FLOAT:
+    case FORMAT_FLOAT32: return 4;
+    case FORMAT_UINT128: return 16;
+  }
+  return 0;
+}
+
+int64_t decimalAt(const DecimalValue& value, int exponent) {
+  if (value.special == DECIMAL_POS_INF) return INT64_MAX;
+  if (value.special == DECIMAL_NEG_INF) return INT64_MIN;
+  if (!value.finite()) return 0;
+  int shift = value.exponent - exponent;
+  if (value.mantissa == 0 || shift < -18) return 0;
+  if (shift < 0) return value.mantissa / pow10Integers[-shift];
+  int64_t limit = shift > 18 ? 0 : INT64_MAX / pow10Integers[shift];
+  if (value.mantissa > limit) return INT64_MAX;
+  if (value.mantissa < -limit) return INT64_MIN;
+  return value.mantissa * pow10Integers[shift];
+}
+
+float decimalToFloat(const DecimalValue& value) {
+  switch (value.special) {
+    case DECIMAL_FINITE: break;
+    case DECIMAL_POS_INF: return INFINITY;
+    case DECIMAL_NEG_INF: return -INFINITY;
+    default: return NAN;
+  }
+  // Single precision, which the ESP32-S3 does in hardware
+  float result = value.mantissa;
+  int exponent = value.exponent;
+  for (; exponent > 10; exponent -= 10) result *= 1e10f;
+  for (; exponent < -10; exponent += 10) result /= 1e10f;
+  return exponent >= 0 ? result * pow10fTable[exponent] : result / pow10fTable[-exponent];
+}
+
+// Writes `digits` with the decimal point `exponent` places from the right; returns the end
+static char* placeDecimalPoint(char* out, const char* digits, size_t count, int exponent) {
+  if (exponent >= 0) {
+    memcpy(out, digits, count);
+    out += count;
+    if (count != 1 || digits[0] != '0') {
+      for (int i = 0; i < exponent; i++) *out++ = '0';
+    }
+    return out;
+  }
+  size_t places = -exponent;
+  if (count > places) {
+    memcpy(out, digits, count - places);
+    out += count - places;
+  } else {
+    *out++ = '0';
+  }
+  *out++ = '.';
+  for (size_t i = count; i < places; i++) *out++ = '0';
+  size_t fraction = std::min(count, places);
+  memcpy(out, digits + count - fraction, fraction);
+  return out + fraction;
+}
+
+String formatDecimal(const DecimalValue& value, const char* unit) {
+  switch (value.special) {
+    case DECIMAL_FINITE: break;
+    case DECIMAL_NAN: return "NaN";
+    case DECIMAL_NRES: return "NRes";
+    case DECIMAL_POS_INF: return "+INF";
+    case DECIMAL_NEG_INF: return "-INF";
+    default: return "Reserved";
+  }
+  // Sign, 19 digits, point, up to 128 zeros of exponent, then the unit
+  char text[160];
+  char digits[20];
+  char* out = text;
+  if (value.mantissa < 0) *out++ = '-';
+  uint64_t magnitude = value.mantissa < 0 ? 0 - (uint64_t)value.mantissa : value.mantissa;
+  out = placeDecimalPoint(out, digits, decimalDigits(magnitude, digits), value.exponent);
+  snprintf(out, text + sizeof(text) - out, "%s", unit);
+  return String(text);
+}
+
+// Convert raw binary data using CPF descriptor parameters
+String convertRawValue(const std::string& rawValue, uint8_t format, int8_t exponent, uint16_t unitUUID) {
+  MemScope memScope(MEM_DECODE);
+  auto unit = unitMap.find(unitUUID);
+  const char* unitText = unit != unitMap.end() ? unit->second.c_str() : "";
+
+  if (format == FORMAT_UINT128) {
+    if (rawValue.size() < 16) return "";
+    char digits[40];
+    char text[200];
+    size_t count = uint128Digits(reinterpret_cast<const uint8_t*>(rawValue.data()), digits);
+    char* out = placeDecimalPoint(text, digits, count, exponent);
+    snprintf(out, text + sizeof(text) - out, "%s", unitText);
+    return String(text);
+  }
+
+  DecimalValue value;
+  if (!decodeDecimal(rawValue, format, exponent, value)) return "";
+  if (format == FORMAT_BOOLEAN) return value.mantissa ? "true" : "false";
+  // The IEEE-11073 special values are reported by name, without a unit
+  return formatDecimal(value, value.finite() ? unitText : "");
+}
+
+// Fallback conversion: attempt ASCII, otherwise decimal bytes.
+String fallbackConvert(const std::string& rawValue) {
+  MemScope memScope(MEM_DECODE);
+  if (rawValue.empty()) return "";
+  
+  bool isAscii = true;
+  for (char c : rawValue) {
+    if (c < 32 || c > 126) {
+      isAscii = false;
+      break;
+    }
+  }
+  if (isAscii) {
+    return String(rawValue.c_str());
+  }
+  
+  String out = "";
+  for (uint8_t c : rawValue) {
+    out += String(c) + " ";
+  }
+  return out;
+}
+
+bool readCpf(BLERemoteCharacteristic* pChar, uint8_t& format, int8_t& exponent, uint16_t& unitUUID) {
+  auto descriptors = pChar->getDescriptors();
+  if (!descriptors) return false;
+
+  for (auto& desc : *descriptors) {
+    if (desc.second->getUUID().equals(CPF_DESC_UUID)) {
+      std::string cpfData = desc.second->readValue();
+      if (cpfData.size() < 7) return false;
+      format = cpfData[0];
+      exponent = cpfData[1];
+      unitUUID = *(reinterpret_cast<const uint16_t*>(&cpfData[2]));
+      return true;
+    }
+  }
+  return false;
+}
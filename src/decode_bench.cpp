@@ -0,0 +1,157 @@
+#include "decode_bench.h"
+#include "decode.h"
+#include "expectations.h"
+#include "output.h"
+#include <cmath>
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+// Readings as the units send them, with the CPF of each and a range to check
+struct BenchValue {
+  const char* name;
+  uint8_t bytes[4];
+  uint8_t length;
+  uint8_t format;
+  int8_t exponent;
+  uint16_t unit;
+  double min;
+  double max;
+};
+
+static const BenchValue corpus[] = {
+  {"pack voltage", {0xE4, 0x0E}, 2, 0x06, -2, 0x27AE, 0, 60},               // 38.12 V
+  {"current", {0x88, 0xFF}, 2, 0x0A, -2, 0x27AC, -40, 40},                  // -1.20 A
+  {"motor temp", {0xFB, 0x09}, 2, 0x0A, -2, 0x27B1, -20, 85},               // 25.55 °C
+  {"pack temp", {0x98, 0x08}, 2, 0x0A, -2, 0x27B1, -20, 85},                // 22.00 °C
+  {"cell voltage", {0x6A, 0x0F}, 2, 0x06, -3, 0x27AE, 2.5, 4.25},           // 3.946 V
+  {"odometer", {0x87, 0xD6, 0x12, 0x00}, 4, 0x04, -3, 0x2701, 0, 1e6},      // 1234.567 m
+  {"speed", {0xF1, 0x00}, 2, 0x06, -1, 0x2763, 0, 45},                      // 24.1 km/h
+  {"torque offset", {0x2E, 0xFB, 0xFF, 0xFF}, 4, 0x08, -4, 0x2700, -1, 1},  // -0.1234
+};
+static const size_t corpusSize = sizeof(corpus) / sizeof(corpus[0]);
+
+// The double path this replaced: pow() scaling, then String(value, 2)
+static bool legacyDecode(const std::string& raw, uint8_t format, int8_t exponent, double& value) {
+  switch (format) {
+    case 0x04:
+      if (raw.size() < 4) return false;
+      value = *(reinterpret_cast<const uint32_t*>(raw.data())) * pow(10, exponent);
+      return true;
+    case 0x06:
+      if (raw.size() < 2) return false;
+      value = *(reinterpret_cast<const uint16_t*>(raw.data())) * pow(10, exponent);
+      return true;
+    case 0x08:
+      if (raw.size() < 4) return false;
+      value = *(reinterpret_cast<const int32_t*>(raw.data())) * pow(10, exponent);
+      return true;
+    case 0x0A:
+      if (raw.size() < 2) return false;
+      value = *(reinterpret_cast<const int16_t*>(raw.data())) * pow(10, exponent);
+      return true;
+  }
+  return false;
+}
+
+static uint64_t benchNowNs() {
+#ifdef ARDUINO
+  return (uint64_t)micros() * 1000;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct BenchStage {
+  const char* name;
+  uint64_t legacyNs;
+  uint64_t fixedNs;
+};
+
+void runDecodeBench(uint32_t rounds) {
+  std::string raws[corpusSize];
+  double legacyValues[corpusSize];
+  DecimalValue fixedValues[corpusSize];
+  int64_t fixedMin[corpusSize], fixedMax[corpusSize];
+  for (size_t i = 0; i < corpusSize; i++) {
+    raws[i].assign(reinterpret_cast<const char*>(corpus[i].bytes), corpus[i].length);
+    legacyDecode(raws[i], corpus[i].format, corpus[i].exponent, legacyValues[i]);
+    decodeDecimal(raws[i], corpus[i].format, corpus[i].exponent, fixedValues[i]);
+    fixedMin[i] = llround(corpus[i].min * 1e6);
+    fixedMax[i] = llround(corpus[i].max * 1e6);
+  }
+
+  BenchStage stages[] = {{"decode", 0, 0}, {"range check", 0, 0}, {"format", 0, 0}};
+  volatile double doubleSink = 0;
+  volatile int64_t integerSink = 0;
+  volatile size_t lengthSink = 0;
+  uint32_t formatRounds = std::max<uint32_t>(1, rounds / 10);  // String work is the slow part
+
+  uint64_t start = benchNowNs();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) {
+      double value;
+      legacyDecode(raws[i], corpus[i].format, corpus[i].exponent, value);
+      doubleSink = value;
+    }
+  }
+  stages[0].legacyNs = benchNowNs() - start;
+  start = benchNowNs();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) {
+      DecimalValue value;
+      decodeDecimal(raws[i], corpus[i].format, corpus[i].exponent, value);
+      integerSink = value.mantissa;
+    }
+  }
+  stages[0].fixedNs = benchNowNs() - start;
+
+  start = benchNowNs();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) {
+      double value = legacyValues[i];
+      doubleSink = (value >= corpus[i].min) & (value <= corpus[i].max);
+    }
+  }
+  stages[1].legacyNs = benchNowNs() - start;
+  start = benchNowNs();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) {
+      int64_t value = decimalAt(fixedValues[i], EXPECT_EXPONENT);
+      integerSink = (value >= fixedMin[i]) & (value <= fixedMax[i]);
+    }
+  }
+  stages[1].fixedNs = benchNowNs() - start;
+
+  start = benchNowNs();
+  for (uint32_t r = 0; r < formatRounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) lengthSink = String(legacyValues[i], 2).length();
+  }
+  stages[2].legacyNs = (benchNowNs() - start) * (rounds / formatRounds);
+  start = benchNowNs();
+  for (uint32_t r = 0; r < formatRounds; r++) {
+    for (size_t i = 0; i < corpusSize; i++) lengthSink = formatDecimal(fixedValues[i]).length();
+  }
+  stages[2].fixedNs = (benchNowNs() - start) * (rounds / formatRounds);
+  (void)doubleSink;
+  (void)integerSink;
+  (void)lengthSink;
+
+  uint64_t operations = (uint64_t)rounds * corpusSize;
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Decode bench: %u values x %lu rounds\n", (unsigned)corpusSize, (unsigned long)rounds);
+  consoleOut.print("Stage       | double ns/op | fixed ns/op\n");
+  for (const BenchStage& stage : stages) {
+    consoleOut.printf("%-11s | %12lu | %11lu\n", stage.name, (unsigned long)(stage.legacyNs / operations),
+                      (unsigned long)(stage.fixedNs / operations));
+  }
+
+  // Where String(value, 2) loses digits or rounds differently from the CPF's precision
+  for (size_t i = 0; i < corpusSize; i++) {
+    String legacy = String(legacyValues[i], 2);
+    String fixed = formatDecimal(fixedValues[i]);
+    if (legacy != fixed) consoleOut.printf("  %-13s double %s, fixed %s\n", corpus[i].name, legacy.c_str(), fixed.c_str());
+  }
+  consoleOut.flush();
+}
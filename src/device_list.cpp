@@ -0,0 +1,187 @@
+#include "device_list.h"
+#include "mem_budget.h"
+#include "output.h"
+#include "rpa_resolver.h"
+
+DeviceList deviceList;
+
+void DeviceList::begin() {
+  if (!mutex) mutex = xSemaphoreCreateMutex();
+}
+
+void DeviceList::lock() {
+  if (mutex) xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+void DeviceList::unlock() {
+  if (mutex) xSemaphoreGive(mutex);
+}
+
+void DeviceList::beginScan() {
+  lock();
+  scanNumber++;
+  unlock();
+}
+
+bool DeviceList::seen(BLEAdvertisedDevice& device) {
+  MemScope memScope(MEM_SCAN);
+  // Resolving takes the resolver's own lock, so it stays outside this one
+  std::string address = unitAddress(device.getAddress(), device.getAddressType());
+  int rssi = device.getRSSI();
+
+  lock();
+  auto found = entries.find(address);
+  if (found == entries.end()) {
+    DeviceEntry& entry = entries[address];
+    entry.device = new BLEAdvertisedDevice(device);
+    entry.rssi = rssi;
+    entry.scan = scanNumber;
+    entry.rank = order.insert(std::make_pair(rssi, &entries.find(address)->first));
+    emit(DELTA_NEW, address, &entry);
+    unlock();
+    return true;
+  }
+
+  DeviceEntry& entry = found->second;
+  *entry.device = device;
+  entry.scan = scanNumber;
+  if (abs(rssi - entry.rssi) < DEVICE_RSSI_HYSTERESIS) {
+    updatesSuppressed++;
+    unlock();
+    return false;
+  }
+
+  // Only this entry moves; the rest of the order is untouched
+  order.erase(entry.rank);
+  entry.rssi = rssi;
+  entry.rank = order.insert(std::make_pair(rssi, &found->first));
+  emit(DELTA_RSSI, address, &entry);
+  unlock();
+  return false;
+}
+
+void DeviceList::endScan() {
+  lock();
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second.scan == scanNumber) {
+      ++it;
+      continue;
+    }
+    emit(DELTA_LOST, it->first, nullptr);
+    order.erase(it->second.rank);
+    delete it->second.device;
+    it = entries.erase(it);
+  }
+  unlock();
+}
+
+void DeviceList::clear() {
+  lock();
+  for (auto& item : entries) delete item.second.device;
+  entries.clear();
+  order.clear();
+  unlock();
+}
+
+size_t DeviceList::size() {
+  lock();
+  size_t count = entries.size();
+  unlock();
+  return count;
+}
+
+void DeviceList::forEachRanked(const std::function<void(const std::string& address, const DeviceEntry& entry)>& row) {
+  lock();
+  for (auto& item : order) row(*item.second, entries.find(*item.second)->second);
+  unlock();
+}
+
+bool DeviceList::at(size_t index, BLEAdvertisedDevice& copy) {
+  lock();
+  bool found = index < order.size();
+  if (found) {
+    auto it = order.begin();
+    std::advance(it, index);
+    copy = *entries[*it->second].device;
+  }
+  unlock();
+  return found;
+}
+
+bool DeviceList::find(const std::string& address, BLEAdvertisedDevice* copy) {
+  std::string unit = unitAddress(BLEAddress(address), BLE_ADDR_TYPE_RANDOM);
+  lock();
+  auto found = entries.find(address);
+  if (found == entries.end()) found = entries.find(unit);
+  bool listed = found != entries.end();
+  if (listed && copy) *copy = *found->second.device;
+  unlock();
+  return listed;
+}
+
+std::string DeviceList::unitAddress(BLEAddress address, uint8_t addressType) {
+  uint8_t identity[6];
+  if (addressType == BLE_ADDR_TYPE_RANDOM && rpaResolver.resolve(*address.getNative(), identity)) {
+    return BLEAddress(identity).toString();
+  }
+  return address.toString();
+}
+
+void DeviceList::setExport(Print* exportSink) {
+  lock();
+  sink = exportSink;
+  unlock();
+  if (exportSink) resync();
+}
+
+void DeviceList::resync() {
+  lock();
+  emit(DELTA_RESET, std::string(), nullptr);
+  for (auto& item : order) emit(DELTA_NEW, *item.second, &entries[*item.second]);
+  unlock();
+}
+
+void DeviceList::emit(DeviceDeltaType type, const std::string& address, const DeviceEntry* entry) {
+  if (!sink) return;
+
+  uint8_t frame[DEVICE_FRAME_MAX];
+  size_t length = 4;
+  if (type == DELTA_RESET) {
+    frame[length++] = std::min<size_t>(entries.size(), 255);
+  } else {
+    memcpy(frame + length, BLEAddress(address).getNative(), 6);
+    length += 6;
+    if (type == DELTA_NEW) frame[length++] = entry->device->getAddressType();
+    if (type != DELTA_LOST) frame[length++] = (uint8_t)(int8_t)entry->rssi;
+    if (type == DELTA_NEW) {
+      std::string name = entry->device->getName();
+      uint8_t nameLength = std::min<size_t>(name.size(), DEVICE_NAME_MAX);
+      frame[length++] = nameLength;
+      memcpy(frame + length, name.data(), nameLength);
+      length += nameLength;
+    }
+  }
+
+  frame[0] = DEVICE_FRAME_SYNC;
+  frame[1] = type;
+  frame[2] = sequence++;
+  frame[3] = length - 4;
+  uint8_t check = 0;
+  for (size_t i = 1; i < length; i++) check ^= frame[i];
+  frame[length++] = check;
+
+  sink->write(frame, length);
+  framesSent++;
+  bytesSent += length;
+}
+
+void DeviceList::printStats() {
+  size_t count = size();
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Device list: %u device(s), export %s, %lu frame(s), %lu byte(s), "
+                    "%lu RSSI update(s) inside +/-%d dB\n",
+                    (unsigned)count, sink ? "on" : "off", (unsigned long)framesSent,
+                    (unsigned long)bytesSent, (unsigned long)updatesSuppressed, DEVICE_RSSI_HYSTERESIS);
+  consoleOut.flush();
+  rpaResolver.printStats();
+}
@@ -0,0 +1,147 @@
+#include "dis_snapshot.h"
+#include "expectations.h"
+#include "output.h"
+#include <stddef.h>
+
+DisRegistry disRegistry;
+
+// Field table: characteristic UUID, field bit, offset and size within DisSnapshot, is text
+struct DisFieldInfo {
+  uint16_t uuid;
+  uint16_t bit;
+  const char* label;
+  size_t offset;
+  size_t size;
+  bool text;
+};
+
+static const DisFieldInfo disFields[] = {
+  {0x2A29, DIS_MANUFACTURER, "Manufacturer", offsetof(DisSnapshot, manufacturer), sizeof(DisSnapshot::manufacturer), true},
+  {0x2A24, DIS_MODEL, "Model", offsetof(DisSnapshot, model), sizeof(DisSnapshot::model), true},
+  {0x2A25, DIS_SERIAL, "Serial", offsetof(DisSnapshot, serial), sizeof(DisSnapshot::serial), true},
+  {0x2A27, DIS_HARDWARE_REV, "Hardware", offsetof(DisSnapshot, hardwareRev), sizeof(DisSnapshot::hardwareRev), true},
+  {0x2A26, DIS_FIRMWARE_REV, "Firmware", offsetof(DisSnapshot, firmwareRev), sizeof(DisSnapshot::firmwareRev), true},
+  {0x2A28, DIS_SOFTWARE_REV, "Software", offsetof(DisSnapshot, softwareRev), sizeof(DisSnapshot::softwareRev), true},
+  {0x2A23, DIS_SYSTEM_ID, "System ID", offsetof(DisSnapshot, systemId), sizeof(DisSnapshot::systemId), false},
+  {0x2A50, DIS_PNP_ID, "PnP ID", offsetof(DisSnapshot, pnpId), sizeof(DisSnapshot::pnpId), false},
+};
+static const size_t disFieldCount = sizeof(disFields) / sizeof(disFields[0]);
+
+uint32_t fnv1a(const void* data, size_t length, uint32_t hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+bool readDisSnapshot(BLERemoteService* dis, DisSnapshot& snapshot, uint16_t fields) {
+  memset(&snapshot, 0, sizeof(snapshot));
+  if (!dis) return false;
+
+  // One pass over the discovered characteristics instead of a lookup per field
+  uint8_t* base = reinterpret_cast<uint8_t*>(&snapshot);
+  for (auto& chr : *dis->getCharacteristics()) {
+    BLERemoteCharacteristic* pChar = chr.second;
+    BLEUUID uuid = pChar->getUUID();
+    esp_bt_uuid_t* native = uuid.getNative();
+    if (native->len != ESP_UUID_LEN_16 || !pChar->canRead()) continue;
+
+    for (size_t i = 0; i < disFieldCount; i++) {
+      const DisFieldInfo& field = disFields[i];
+      if (field.uuid != native->uuid.uuid16 || !(fields & field.bit)) continue;
+      std::string value = pChar->readValue();
+      // Text fields keep one byte for the terminator
+      size_t limit = field.text ? field.size - 1 : field.size;
+      memcpy(base + field.offset, value.data(), std::min(value.size(), limit));
+      snapshot.presentMask |= field.bit;
+      break;
+    }
+  }
+
+  snapshot.unitHash = fnv1a(&snapshot, offsetof(DisSnapshot, unitHash));
+  uint32_t config = fnv1a(snapshot.manufacturer, sizeof(snapshot.manufacturer));
+  config = fnv1a(snapshot.model, sizeof(snapshot.model), config);
+  config = fnv1a(snapshot.hardwareRev, sizeof(snapshot.hardwareRev), config);
+  config = fnv1a(snapshot.firmwareRev, sizeof(snapshot.firmwareRev), config);
+  snapshot.configHash = fnv1a(snapshot.softwareRev, sizeof(snapshot.softwareRev), config);
+  return snapshot.presentMask != 0;
+}
+
+void recordDisSnapshot(const DisSnapshot& snapshot) {
+  const uint8_t* base = reinterpret_cast<const uint8_t*>(&snapshot);
+  for (size_t i = 0; i < disFieldCount; i++) {
+    const DisFieldInfo& field = disFields[i];
+    if (!field.text || !(snapshot.presentMask & field.bit)) continue;
+    expectations.record(BLEUUID(field.uuid), 0x2700, false, DecimalValue(),
+                        std::string(reinterpret_cast<const char*>(base + field.offset)));
+  }
+}
+
+static void printField(const DisFieldInfo& field, const DisSnapshot& snapshot) {
+  const uint8_t* value = reinterpret_cast<const uint8_t*>(&snapshot) + field.offset;
+  if (field.text) {
+    consoleOut.printf("%s", reinterpret_cast<const char*>(value));
+    return;
+  }
+  for (size_t i = 0; i < field.size; i++) consoleOut.printf("%02X", value[i]);
+}
+
+void printDisSnapshot(const DisSnapshot& snapshot) {
+  if (!consoleOut.begin(OUT_NORMAL)) return;
+  consoleOut.printf("\nDevice Information (unit %08lX, config %08lX)\n", (unsigned long)snapshot.unitHash,
+                    (unsigned long)snapshot.configHash);
+  for (size_t i = 0; i < disFieldCount; i++) {
+    if (!(snapshot.presentMask & disFields[i].bit)) continue;
+    consoleOut.printf("  %-12s: ", disFields[i].label);
+    printField(disFields[i], snapshot);
+    consoleOut.print("\n");
+  }
+  consoleOut.flush();
+}
+
+void printDisDiff(const DisSnapshot& before, const DisSnapshot& after) {
+  consoleOut.begin(OUT_QUIET);
+  const uint8_t* a = reinterpret_cast<const uint8_t*>(&before);
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(&after);
+  for (size_t i = 0; i < disFieldCount; i++) {
+    const DisFieldInfo& field = disFields[i];
+    if (memcmp(a + field.offset, b + field.offset, field.size) == 0) continue;
+    consoleOut.printf("  %-12s changed: ", field.label);
+    printField(field, before);
+    consoleOut.print(" -> ");
+    printField(field, after);
+    consoleOut.print("\n");
+  }
+  consoleOut.flush();
+}
+
+const DisSnapshot* DisRegistry::findUnit(const DisSnapshot& snapshot) {
+  if (!(snapshot.presentMask & DIS_SERIAL)) return nullptr;
+  // Newest first, so a re-test is compared with the most recent run
+  for (size_t n = 0; n < count; n++) {
+    const Entry& entry = entries[(next + DIS_REGISTRY_SIZE - 1 - n) % DIS_REGISTRY_SIZE];
+    if (memcmp(entry.snapshot.serial, snapshot.serial, sizeof(snapshot.serial)) == 0) {
+      return &entry.snapshot;
+    }
+  }
+  return nullptr;
+}
+
+int DisRegistry::configPasses(uint32_t configHash) {
+  int passes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].snapshot.configHash != configHash) continue;
+    if (!entries[i].pass) return -1;
+    passes++;
+  }
+  return passes;
+}
+
+void DisRegistry::remember(const DisSnapshot& snapshot, bool pass) {
+  entries[next].snapshot = snapshot;
+  entries[next].pass = pass;
+  next = (next + 1) % DIS_REGISTRY_SIZE;
+  if (count < DIS_REGISTRY_SIZE) count++;
+}
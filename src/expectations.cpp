@@ -0,0 +1,201 @@
+#include "expectations.h"
+#include "output.h"
+#include "session_arena.h"
+#include <cmath>
+
+ExpectationChecker expectations;
+
+// Station limits. Characteristic entries take precedence over unit defaults.
+static const ExpectationSpec defaultSpecs[] = {
+  // name                  uuid    unit    kind            min     max    enum  pattern
+  {"Battery Level",        "2A19", 0,      EXPECT_RANGE,   5,      100,   0,    nullptr},
+  {"Manufacturer Name",    "2A29", 0,      EXPECT_PATTERN, 0,      0,     0,    "Skarper*"},
+  {"Model Number",         "2A24", 0,      EXPECT_PATTERN, 0,      0,     0,    "?*"},
+  {"Firmware Revision",    "2A26", 0,      EXPECT_PATTERN, 0,      0,     0,    "*.*"},
+  {"CSC Feature",          "2A5C", 0,      EXPECT_ENUM,    0,      0,     0xFF, nullptr},
+  {"Temperature",          nullptr, 0x27B1, EXPECT_RANGE,  -20,    85,    0,    nullptr},
+  {"Percentage",           nullptr, 0x27B3, EXPECT_RANGE,  0,      100,   0,    nullptr},
+  {"Voltage",              nullptr, 0x27AE, EXPECT_RANGE,  0,      60,    0,    nullptr},
+  {"Current",              nullptr, 0x27AC, EXPECT_RANGE,  -40,    40,    0,    nullptr},
+};
+
+bool globMatch(const char* pattern, const char* text) {
+  const char* star = nullptr;
+  const char* resume = nullptr;
+  while (*text) {
+    if (*pattern == '*') {
+      star = pattern++;
+      resume = text;
+    } else if (*pattern == '?' || *pattern == *text) {
+      pattern++;
+      text++;
+    } else if (star) {
+      pattern = star + 1;
+      text = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') pattern++;
+  return *pattern == '\0';
+}
+
+void ExpectationChecker::compile(const ExpectationSpec* specs, size_t count) {
+  if (!specs) {
+    specs = defaultSpecs;
+    count = sizeof(defaultSpecs) / sizeof(defaultSpecs[0]);
+  }
+
+  slotByUuid.clear();
+  slotByUnit.clear();
+  slotName.clear();
+  slotKind.clear();
+  slotMin.clear();
+  slotMax.clear();
+  slotEnum.clear();
+  slotPattern.clear();
+
+  for (size_t i = 0; i < count && i < 255; i++) {
+    const ExpectationSpec& spec = specs[i];
+    uint8_t slot = slotName.size();
+    if (spec.uuid) {
+      slotByUuid[BLEUUID(std::string(spec.uuid)).toString()] = slot;
+    } else {
+      slotByUnit[spec.unit] = slot;
+    }
+    slotName.push_back(spec.name);
+    slotKind.push_back(spec.kind);
+    // Enum and pattern slots get an open range so the range test never rejects them. The
+    // lowest int64 stays below every minimum; a NaN is recorded as it.
+    bool ranged = spec.kind == EXPECT_RANGE;
+    slotMin.push_back(ranged ? llround(spec.min * 1e6) : INT64_MIN + 1);
+    slotMax.push_back(ranged ? llround(spec.max * 1e6) : INT64_MAX);
+    slotEnum.push_back(spec.kind == EXPECT_ENUM ? spec.enumMask : 0);
+    slotPattern.push_back(spec.pattern ? spec.pattern : "*");
+  }
+
+  numbers.reserve(slotName.size());
+  scaled.reserve(slotName.size());
+  numberSlot.reserve(slotName.size());
+  numberOk.reserve(slotName.size());
+  texts.reserve(slotName.size());
+  textSlot.reserve(slotName.size());
+  textOk.reserve(slotName.size());
+}
+
+void ExpectationChecker::beginSession(const std::string& address) {
+  sessionAddress = address;
+  numbers.clear();
+  scaled.clear();
+  numberSlot.clear();
+  numberOk.clear();
+  texts.clear();
+  textSlot.clear();
+  textOk.clear();
+}
+
+int ExpectationChecker::findSlot(BLEUUID& uuid, uint16_t unit) {
+  auto byUuid = slotByUuid.find(uuid.toString());
+  if (byUuid != slotByUuid.end()) return byUuid->second;
+  auto byUnit = slotByUnit.find(unit);
+  if (byUnit != slotByUnit.end()) return byUnit->second;
+  return -1;
+}
+
+void ExpectationChecker::record(BLEUUID uuid, uint16_t unit, bool haveNumber, const DecimalValue& number,
+                                const std::string& raw) {
+  int slot = findSlot(uuid, unit);
+  if (slot < 0) return;
+
+  if (slotKind[slot] == EXPECT_PATTERN) {
+    texts.push_back(sessionArena.copy(raw));
+    textSlot.push_back(slot);
+    return;
+  }
+
+  DecimalValue value = number;
+  if (!haveNumber) {
+    if (raw.empty() || raw.size() > 8) return;
+    uint64_t bytes = 0;
+    for (size_t i = raw.size(); i > 0; i--) {
+      bytes = (bytes << 8) | (uint8_t)raw[i - 1];
+    }
+    value = DecimalValue();
+    value.mantissa = std::min<uint64_t>(bytes, INT64_MAX);
+  }
+  bool comparable = value.finite() || value.special == DECIMAL_POS_INF || value.special == DECIMAL_NEG_INF;
+  numbers.push_back(value);
+  scaled.push_back(comparable ? decimalAt(value, EXPECT_EXPONENT) : INT64_MIN);
+  numberSlot.push_back(slot);
+}
+
+SessionVerdict ExpectationChecker::evaluate() {
+  uint32_t start = micros();
+
+  // Numeric pass: branch-free integer compares over the contiguous value arrays
+  const int64_t unit = 1000000;  // 1 at EXPECT_EXPONENT
+  size_t n = scaled.size();
+  numberOk.resize(n);
+  const int64_t* values = scaled.data();
+  const uint8_t* slots = numberSlot.data();
+  uint8_t* ok = numberOk.data();
+  for (size_t i = 0; i < n; i++) {
+    uint8_t s = slots[i];
+    int64_t v = values[i];
+    uint64_t mask = slotEnum[s];
+    uint64_t bit = (v >= 0 && v < 64 * unit && v % unit == 0) ? (1ULL << (unsigned)(v / unit)) : 0;
+    ok[i] = (v >= slotMin[s]) & (v <= slotMax[s]) & ((mask == 0) | ((mask & bit) != 0));
+  }
+
+  textOk.resize(texts.size());
+  for (size_t i = 0; i < texts.size(); i++) {
+    textOk[i] = globMatch(slotPattern[textSlot[i]], texts[i]);
+  }
+
+  SessionVerdict verdict;
+  verdict.checked = n + texts.size();
+  verdict.failed = 0;
+  for (size_t i = 0; i < n; i++) verdict.failed += !numberOk[i];
+  for (size_t i = 0; i < textOk.size(); i++) verdict.failed += !textOk[i];
+  verdict.pass = verdict.failed == 0;
+  verdict.evalMicros = micros() - start;
+  return verdict;
+}
+
+// A limit in millionths, without the trailing zeros
+static String formatLimit(int64_t limit) {
+  DecimalValue value;
+  value.mantissa = limit;
+  value.exponent = EXPECT_EXPONENT;
+  while (value.exponent < 0 && value.mantissa % 10 == 0) {
+    value.mantissa /= 10;
+    value.exponent++;
+  }
+  return formatDecimal(value);
+}
+
+void ExpectationChecker::printVerdict(const SessionVerdict& verdict) {
+  // Verdicts are shown at every verbosity level
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("\nVERDICT %s %s checked=%u failed=%u eval=%luus\n", sessionAddress.c_str(),
+                    verdict.pass ? "PASS" : "FAIL", (unsigned)verdict.checked,
+                    (unsigned)verdict.failed, (unsigned long)verdict.evalMicros);
+
+  for (size_t i = 0; i < numbers.size(); i++) {
+    if (numberOk[i]) continue;
+    uint8_t s = numberSlot[i];
+    if (slotKind[s] == EXPECT_ENUM) {
+      consoleOut.printf("  FAIL %s: %s not in allowed set\n", slotName[s], formatDecimal(numbers[i]).c_str());
+    } else {
+      consoleOut.printf("  FAIL %s: %s outside [%s, %s]\n", slotName[s], formatDecimal(numbers[i]).c_str(),
+                        formatLimit(slotMin[s]).c_str(), formatLimit(slotMax[s]).c_str());
+    }
+  }
+  for (size_t i = 0; i < texts.size(); i++) {
+    if (textOk[i]) continue;
+    uint8_t s = textSlot[i];
+    consoleOut.printf("  FAIL %s: \"%s\" does not match \"%s\"\n", slotName[s],
+                      texts[i], slotPattern[s]);
+  }
+  consoleOut.flush();
+}
@@ -0,0 +1,110 @@
+#include "fleet_audit.h"
+#include "client_pool.h"
+#include "dis_snapshot.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "uuids.h"
+
+FleetAudit fleetAudit;
+
+static void copyField(char* dst, size_t size, const std::string& value) {
+  size_t length = std::min(value.size(), size - 1);
+  memcpy(dst, value.data(), length);
+  dst[length] = '\0';
+}
+
+void FleetAudit::auditOne(BLEClient* client, BLEAdvertisedDevice* device, AuditRow& row) {
+  uint32_t start = millis();
+  copyField(row.address, sizeof(row.address), device->getAddress().toString());
+  copyField(row.name, sizeof(row.name), device->getName());
+  row.model[0] = row.firmware[0] = row.software[0] = '\0';
+  row.connectMs = 0;
+  row.configHash = 0;
+
+  // The client was released two devices ago; it has normally finished closing by now
+  if (!clientPool.waitForTeardown(client) || !client->connect(device->getAddress(), device->getAddressType())) {
+    row.status = AUDIT_CONNECT_FAILED;
+    row.totalMs = millis() - start;
+    return;
+  }
+  row.connectMs = millis() - start;
+
+  DisSnapshot snapshot;
+  if (!readDisSnapshot(client->getService(DIS_UUID), snapshot,
+                       DIS_MODEL | DIS_FIRMWARE_REV | DIS_SOFTWARE_REV)) {
+    row.status = client->isConnected() ? AUDIT_NO_DIS : AUDIT_LINK_LOST;
+  } else {
+    copyField(row.model, sizeof(row.model), snapshot.model);
+    copyField(row.firmware, sizeof(row.firmware), snapshot.firmwareRev);
+    copyField(row.software, sizeof(row.software), snapshot.softwareRev);
+    row.status = client->isConnected() ? AUDIT_OK : AUDIT_LINK_LOST;
+  }
+  row.configHash = snapshot.configHash;
+
+  // Start the close and return straight away; the other client handles the next device
+  client->disconnect();
+  row.totalMs = millis() - start;
+}
+
+void FleetAudit::run(DeviceList& devices) {
+  uint32_t start = millis();
+  rowCount = 0;
+
+  // Both come from the pool the test sessions use; the session client is free by now
+  BLEClient* clients[2] = {clientPool.acquire(nullptr), clientPool.acquire(nullptr)};
+  if (!clients[0] || !clients[1]) {
+    for (BLEClient* client : clients) {
+      if (client) clientPool.release(client);
+    }
+    gattWorker.print(OUT_QUIET, "Fleet audit: no free client\n");
+    elapsedMs = 0;
+    return;
+  }
+
+  deviceCount = devices.size();
+  gattWorker.print(OUT_QUIET, "Fleet audit: %u device(s)\n", (unsigned)std::min<size_t>(deviceCount, FLEET_AUDIT_MAX_DEVICES));
+  // Each device is copied out, so the list is not held locked across a connect
+  BLEAdvertisedDevice device;
+  while (rowCount < FLEET_AUDIT_MAX_DEVICES && devices.at(rowCount, device)) {
+    auditOne(clients[rowCount % 2], &device, rows[rowCount]);
+
+    // The row is complete before the record that points loop() at it
+    SessionRecord record;
+    record.type = RECORD_AUDIT_ROW;
+    record.length = 1;
+    record.data[0] = rowCount;
+    gattWorker.publish(record);
+    rowCount++;
+  }
+
+  for (BLEClient* client : clients) {
+    clientPool.waitForTeardown(client);
+    clientPool.release(client);
+  }
+  elapsedMs = millis() - start;
+}
+
+void FleetAudit::printRow(size_t index) {
+  if (!consoleOut.begin(OUT_NORMAL)) return;
+  const AuditRow& row = rows[index];
+  consoleOut.printf("  [%u/%u] %s %s\n", (unsigned)(index + 1), (unsigned)deviceCount, row.address,
+                    row.status == AUDIT_OK ? "ok" : "failed");
+  consoleOut.flush();
+}
+
+void FleetAudit::printTable() {
+  static const char* statusText[] = {"ok", "connect failed", "no DIS", "link lost"};
+
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.print("\n===== Fleet Audit =====\n"
+                   "Address           | Name            | Model                   | Firmware        | Software        | Config   | Conn ms | Total ms | Status\n");
+  for (size_t i = 0; i < rowCount; i++) {
+    const AuditRow& row = rows[i];
+    consoleOut.printf("%-17s | %-15s | %-23s | %-15s | %-15s | %08lX | %7u | %8u | %s\n", row.address,
+                      row.name, row.model, row.firmware, row.software, (unsigned long)row.configHash,
+                      (unsigned)row.connectMs,
+                      (unsigned)row.totalMs, statusText[row.status]);
+  }
+  consoleOut.printf("%u device(s) audited in %lu ms\n", (unsigned)rowCount, (unsigned long)elapsedMs);
+  consoleOut.flush();
+}
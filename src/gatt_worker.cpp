@@ -0,0 +1,153 @@
+#include "gatt_worker.h"
+#include "loop_events.h"
+#include "output.h"
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+GattWorker gattWorker;
+
+static gattc_event_handler gattcHandlers[GATTC_HANDLERS_MAX];
+static size_t gattcHandlerCount = 0;
+
+static void dispatchGattcEvent(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                               esp_ble_gattc_cb_param_t* param) {
+  for (size_t i = 0; i < gattcHandlerCount; i++) gattcHandlers[i](event, gattc_if, param);
+}
+
+void addGattcHandler(gattc_event_handler handler) {
+  if (gattcHandlerCount >= GATTC_HANDLERS_MAX) return;
+  gattcHandlers[gattcHandlerCount++] = handler;
+  if (gattcHandlerCount == 1) BLEDevice::setCustomGattcHandler(dispatchGattcEvent);
+}
+
+void GattWorker::begin(GattJobHandler jobHandler, SessionRecordHandler recordHandler) {
+  onJob = jobHandler;
+  onRecord = recordHandler;
+  statsStartMs = millis();
+#ifdef ARDUINO
+  TaskHandle_t handle = nullptr;
+  xTaskCreatePinnedToCore(taskMain, "gatt", GATT_TASK_STACK, this, GATT_TASK_PRIORITY, &handle, GATT_TASK_CORE);
+  task = handle;
+#endif
+}
+
+bool GattWorker::post(const GattJob& job) {
+  if (!jobs.push(job)) return false;
+#ifdef ARDUINO
+  xTaskNotifyGive(static_cast<TaskHandle_t>(task));
+#else
+  loopEvents.signal(LOOP_EVENT_RECORD);  // the job runs from the next poll()
+#endif
+  return true;
+}
+
+void GattWorker::taskMain(void* parameter) {
+#ifdef ARDUINO
+  GattWorker* worker = static_cast<GattWorker*>(parameter);
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    worker->runJobs();
+  }
+#endif
+}
+
+void GattWorker::runJobs() {
+  // Marked busy before the pop so idle() never sees an empty queue with a job in flight
+  busy.store(true, std::memory_order_release);
+  GattJob job;
+  while (jobs.pop(job)) {
+    uint32_t start = micros();
+    onJob(job);
+    gattBusyRemainderUs += (uint32_t)(micros() - start);
+    gattBusyMs.fetch_add(gattBusyRemainderUs / 1000, std::memory_order_relaxed);
+    gattBusyRemainderUs %= 1000;
+    jobsRun.fetch_add(1, std::memory_order_relaxed);
+  }
+  busy.store(false, std::memory_order_release);
+  // loop() defers link cleanup and captures while the worker is busy
+  loopEvents.signal(LOOP_EVENT_RECORD);
+}
+
+void GattWorker::publish(const SessionRecord& record) {
+  while (!records.push(record)) {
+    publishWaits.fetch_add(1, std::memory_order_relaxed);
+#ifdef ARDUINO
+    vTaskDelay(1);
+#else
+    deliver(SESSION_RECORD_DEPTH);  // single-threaded: make room by consuming inline
+#endif
+  }
+  loopEvents.signal(LOOP_EVENT_RECORD);
+}
+
+void GattWorker::print(OutputLevel level, const char* format, ...) {
+  if (!outputEnabled(level)) return;
+  char text[GATT_TEXT_MAX];
+  va_list args;
+  va_start(args, format);
+  size_t length = std::min(outputFormat(text, sizeof(text), format, args), sizeof(text));
+  va_end(args);
+
+  SessionRecord record;
+  record.type = RECORD_TEXT;
+  record.status = level;
+  for (size_t sent = 0; sent < length; sent += record.length) {
+    record.length = std::min<size_t>(length - sent, SESSION_RECORD_MAX_VALUE);
+    memcpy(record.data, text + sent, record.length);
+    publish(record);
+  }
+}
+
+size_t GattWorker::deliver(size_t budget) {
+  SessionRecord record;
+  size_t delivered = 0;
+  while (delivered < budget && records.pop(record)) {
+    onRecord(record);
+    delivered++;
+  }
+  recordsDelivered += delivered;
+  return delivered;
+}
+
+size_t GattWorker::poll(size_t budget) {
+#ifndef ARDUINO
+  if (!jobs.empty()) runJobs();
+#endif
+  return deliver(budget);
+}
+
+void GattWorker::accountLoop(uint32_t busyUs) {
+  loopPasses++;
+  loopBusyUs += busyUs;
+}
+
+void GattWorker::printStats() {
+  uint32_t elapsedMs = millis() - statsStartMs;
+  double elapsedUs = elapsedMs ? elapsedMs * 1000.0 : 1.0;
+  unsigned long gattFree = 0;
+  unsigned long loopFree = 0;
+  int loopCore = 1;
+#ifdef ARDUINO
+  if (task) gattFree = uxTaskGetStackHighWaterMark(static_cast<TaskHandle_t>(task));
+  loopFree = uxTaskGetStackHighWaterMark(nullptr);
+  loopCore = xPortGetCoreID();
+#endif
+
+  uint32_t gattMs = gattBusyMs.load(std::memory_order_relaxed);
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Tasks over %lu s:\n", (unsigned long)(elapsedMs / 1000));
+  consoleOut.printf("  gatt  core %d  jobs=%lu busy=%lu ms (%s%%) stack free=%lu\n", GATT_TASK_CORE,
+                    (unsigned long)jobsRun.load(std::memory_order_relaxed), (unsigned long)gattMs,
+                    String(gattMs * 100000.0 / elapsedUs, 1).c_str(), gattFree);
+  consoleOut.printf("  loop  core %d  passes=%lu busy=%lu ms (%s%%) stack free=%lu\n", loopCore,
+                    (unsigned long)loopPasses, (unsigned long)(loopBusyUs / 1000),
+                    String(loopBusyUs * 100.0 / elapsedUs, 1).c_str(), loopFree);
+  consoleOut.printf("  rings: jobs max %lu/%u, records max %lu/%u, %lu delivered, %lu publish waits\n",
+                    (unsigned long)jobs.maxDepth(), GATT_JOB_DEPTH, (unsigned long)records.maxDepth(),
+                    SESSION_RECORD_DEPTH, (unsigned long)recordsDelivered,
+                    (unsigned long)publishWaits.load(std::memory_order_relaxed));
+  consoleOut.flush();
+}
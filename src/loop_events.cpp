@@ -0,0 +1,84 @@
+#include "loop_events.h"
+#include "output.h"
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#endif
+
+LoopEvents loopEvents;
+
+static const uint32_t ALL_EVENTS = (1u << LOOP_EVENT_COUNT) - 1;
+
+static const char* EVENT_NAMES[LOOP_EVENT_COUNT] = {"input", "prompt", "disconnect", "record", "notify", "target", "scan", "tick"};
+
+void LoopEvents::Latency::add(uint32_t us) {
+  count++;
+  sumUs += us;
+  if (us > maxUs) maxUs = us;
+}
+
+void LoopEvents::begin() {
+  group = xEventGroupCreate();
+  statsStartMs = millis();
+}
+
+void LoopEvents::signal(LoopEvent event) {
+  uint32_t bit = 1u << event;
+  // Only the first signal before a wake is timed; later ones are already covered by it
+  if (!(pending.load(std::memory_order_acquire) & bit)) {
+    signalledUs[event].store(micros(), std::memory_order_relaxed);
+  }
+  pending.fetch_or(bit, std::memory_order_acq_rel);
+  signals[event]++;
+  if (group) xEventGroupSetBits(static_cast<EventGroupHandle_t>(group), bit);
+}
+
+uint32_t LoopEvents::wait(uint32_t timeoutMs) {
+  uint32_t start = micros();
+  if (group) {
+    xEventGroupWaitBits(static_cast<EventGroupHandle_t>(group), ALL_EVENTS, pdTRUE, pdFALSE,
+                        pdMS_TO_TICKS(timeoutMs));
+  }
+  uint32_t now = micros();
+  waits++;
+  sleptUs += now - start;
+
+  uint32_t events = pending.exchange(0, std::memory_order_acq_rel);
+  if (!events) events = 1u << LOOP_EVENT_TICK;
+  for (uint8_t i = 0; i < LOOP_EVENT_COUNT; i++) {
+    if (!(events & (1u << i))) continue;
+    uint32_t stamp = i == LOOP_EVENT_TICK ? now : signalledUs[i].load(std::memory_order_relaxed);
+    if (i == LOOP_EVENT_TICK) signals[i]++;
+    wake[i].add(now - stamp);
+    // An event not acted on yet keeps its original time, e.g. input typed before the prompt
+    if (!(woken & (1u << i))) wokenUs[i] = stamp;
+  }
+  woken |= events;
+  return events;
+}
+
+void LoopEvents::handled(LoopEvent event) {
+  uint32_t bit = 1u << event;
+  if (!(woken & bit)) return;
+  reaction[event].add(micros() - wokenUs[event]);
+  woken &= ~bit;
+}
+
+void LoopEvents::printStats() {
+  uint32_t elapsedMs = millis() - statsStartMs;
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Loop events over %lu s: %lu waits, asleep %s%%\n"
+                    "Event      | Signals | Wake avg/max us  | Handled | React avg/max us\n",
+                    (unsigned long)(elapsedMs / 1000), (unsigned long)waits,
+                    String(elapsedMs ? sleptUs / (elapsedMs * 10.0) : 0.0, 1).c_str());
+  for (uint8_t i = 0; i < LOOP_EVENT_COUNT; i++) {
+    const Latency& w = wake[i];
+    const Latency& r = reaction[i];
+    consoleOut.printf("%-10s | %7lu | %7lu/%-8lu | %7lu | %7lu/%lu\n", EVENT_NAMES[i], (unsigned long)signals[i],
+                      (unsigned long)(w.count ? w.sumUs / w.count : 0), (unsigned long)w.maxUs,
+                      (unsigned long)r.count, (unsigned long)(r.count ? r.sumUs / r.count : 0),
+                      (unsigned long)r.maxUs);
+  }
+  consoleOut.flush();
+}
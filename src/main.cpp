@@ -4,434 +4,1270 @@
 #include <BLEScan.h>
 #include <BLEAdvertisedDevice.h>
 #include <BLEClient.h>
+#include <atomic>
 #include <map>
 #include <cmath>
 #include <vector>
+#include "uuids.h"
+#include "decode.h"
+#include "output.h"
+#include "expectations.h"
+#include "battery_trend.h"
+#include "thermal_profile.h"
+#include "control_channel.h"
+#include "fleet_audit.h"
+#include "dis_snapshot.h"
+#include "profile_sync.h"
+#include "telemetry_log.h"
+#include "mem_budget.h"
+#include "session_arena.h"
+#include "notify_dispatch.h"
+#include "device_list.h"
+#include "gatt_worker.h"
+#include "loop_events.h"
+#include "command_console.h"
+#include "client_pool.h"
+#include "bond_store.h"
+#include "value_store.h"
+#include "poll_scheduler.h"
+#include "decode_bench.h"
 
 // Function prototypes
 void startScan();
 void exploreService(BLERemoteService* service);
-String fallbackConvert(const std::string& rawValue);
 bool writeControlRegister();
 void displayFoundDevices();
-void processUserSelection();
-bool connectToDevice();
-String getUuidName(BLEUUID uuid);
-
-// Service UUID Definitions
-static BLEUUID DIS_UUID((uint16_t)0x180A);  // Device Information Service
-static BLEUUID TEMP_UUID("B1F8799E-4999-4F4A-AF05-B5A6FB6AB55D"); // Temperature Service
-static BLEUUID CSCP_UUID((uint16_t)0x1816); // Cycling Speed and Cadence Profile
-static BLEUUID USER_UUID("B1F879A7-4999-4F4A-AF05-B5A6FB6AB55D"); // User Service
-static BLEUUID BATTERY_UUID((uint16_t)0x180F); // Battery Service
-static BLEUUID CONTROL_UUID("B1F879B4-4999-4F4A-AF05-B5A6FB6AB55D"); // Control Service
-static BLEUUID CONTROL_REG_UUID("B1F879B5-4999-4F4A-AF05-B5A6FB6AB55D"); // Control Register
-
-// Descriptor UUID for Characteristic Presentation Format (CPF)
-static BLEUUID CPF_DESC_UUID((uint16_t)0x2904);
+bool connectToDevice(uint8_t flags = 0);
+void runGattJob(const GattJob& job);
+void onSessionRecord(const SessionRecord& record);
 
 // Target Device Configuration
 static const char* TARGET_DEVICE_PREFIX = "Skp";
+#define SCAN_RETRY_MS 2000  // pause before scanning again when nothing was found
+#define FOUND_DEVICE_DEPTH 32  // announcements waiting for loop(); must be a power of two
 BLEScan* pBLEScan;
 BLEClient* pClient = nullptr;
-BLEAdvertisedDevice* targetDevice = nullptr;
 bool deviceFound = false;
 bool isConnected = false;
 bool scanCompleted = false;
+static std::atomic<bool> scanEnded{false};  // set by the scan callback, taken by loop()
+static bool rescanDue = false;              // nothing found; scan again at rescanAtMs
+static uint32_t rescanAtMs = 0;
 bool waitingForUserInput = false;
+std::atomic<bool> linkLost{false};  // set by the BLE host, cleared by loop() once it has cleaned up
+std::string sessionAddress;  // address of the unit the current session was started for
+uint8_t sessionAddressType = 0;
+std::string sessionUnit;  // its identity address, which per-unit state is kept under
+uint32_t sessionChosenMs = 0;  // when the unit was chosen, for the connect latency
 
-// Store all matching devices and their signal strengths
-std::map<std::string, std::pair<BLEAdvertisedDevice*, int>> foundDevices;
-std::vector<std::pair<std::string, int>> sortedDevices; // For displaying sorted list
-
-// Service/Characteristic Name Map
-std::map<std::string, std::string> uuidNames = {
-  {DIS_UUID.toString(), "Device Information Service"},
-  {TEMP_UUID.toString(), "Temperature Service"},
-  {CSCP_UUID.toString(), "Cycling Speed and Cadence"},
-  {USER_UUID.toString(), "User Service"},
-  {BATTERY_UUID.toString(), "Battery Service"},
-  {CONTROL_UUID.toString(), "Control Service"},
-  {CONTROL_REG_UUID.toString(), "Control Register"},
-  {"0x2A29", "Manufacturer Name String"},
-  {"0x2A24", "Model Number String"},
-  {"0x2A5B", "CSC Measurement"}
+// A "connect <address>" typed during a scan, for a unit not heard yet. The scan callback
+// flags it as soon as the unit advertises and loop() connects without waiting for the
+// scan to finish.
+struct PendingConnect {
+  std::atomic<bool> armed{false};
+  std::atomic<bool> heard{false};
+  std::string address;  // written by loop() before `armed` is set
+  std::string unit;     // the address resolved to its identity, as adverts are compared
+  uint32_t chosenMs = 0;
 };
+PendingConnect pendingConnect;
+bool pollPosted = false;  // a JOB_POLL is queued or running; the next waits for RECORD_POLL_DONE
 
-// Unit mapping for CPF descriptor (unit UUID -> unit string)
-std::map<uint16_t, String> unitMap = {
-  {0x2700, ""},         // unitless
-  {0x2763, "km/h"},     // kilometres per hour
-  {0x27AD, "rpm"},      // revolutions per minute
-  {0x2701, "m"},        // metres
-  {0x27B1, "°C"},       // degrees Celsius
-  {0x27B3, "%"},        // percentage
-  {0x27AE, "V"},        // volts
-  {0x27AC, "A"}         // amperes
+// What to run once a device is connected and explored
+enum TestMode {
+  MODE_EXPLORE,   // explore services, verdict, control register write
+  MODE_BATTERY,   // ...then capture a battery trend
+  MODE_THERMAL,   // ...then run a thermal profile
+  MODE_CAPTURE,   // ...then store the User Service as the desired profile
+  MODE_SYNC,      // ...then write the User Service characteristics that differ from the profile
+  MODE_MONITOR    // explore, then poll each characteristic at its own period (no control write)
 };
+TestMode testMode = MODE_EXPLORE;
 
-// Convert raw binary data using CPF descriptor parameters
-String convertRawValue(const std::string& rawValue, uint8_t format, int8_t exponent, uint16_t unitUUID) {
-  String unit = (unitMap.find(unitUUID) != unitMap.end()) ? unitMap[unitUUID] : "";
-  double scaledValue = 0;
 
-  switch (format) {
-    case 0x01: // Boolean
-      return rawValue.empty() ? "false" : (rawValue[0] ? "true" : "false");
+// ---- GATT task: everything that talks to the peer -------------------------------------
 
-    case 0x04: { // uint32
-      if (rawValue.size() < 4) break;
-      uint32_t val = *(reinterpret_cast<const uint32_t*>(rawValue.data()));
-      scaledValue = val * pow(10, exponent);
-      return String(scaledValue, 2) + unit;
-    }
-    case 0x06: { // uint16
-      if (rawValue.size() < 2) break;
-      uint16_t val = *(reinterpret_cast<const uint16_t*>(rawValue.data()));
-      scaledValue = val * pow(10, exponent);
-      return String(scaledValue, 2) + unit;
-    }
-    case 0x08: { // int32
-      if (rawValue.size() < 4) break;
-      int32_t val = *(reinterpret_cast<const int32_t*>(rawValue.data()));
-      scaledValue = val * pow(10, exponent);
-      return String(scaledValue, 2) + unit;
-    }
-    case 0x0A: { // int16
-      if (rawValue.size() < 2) break;
-      int16_t val = *(reinterpret_cast<const int16_t*>(rawValue.data()));
-      scaledValue = val * pow(10, exponent);
-      return String(scaledValue, 2) + unit;
-    }
-    case 0x0E: { // float32
-      if (rawValue.size() < 4) break;
-      float val = *(reinterpret_cast<const float*>(rawValue.data()));
-      return String(val * pow(10, exponent), 2) + unit;
-    }
-  }
-  return "";
-}
+// Written by the GATT task before RECORD_SNAPSHOT is published; read by loop() after it
+static DisSnapshot workerSnapshot;
 
-// Fallback conversion: attempt ASCII, otherwise decimal bytes.
-String fallbackConvert(const std::string& rawValue) {
-  if (rawValue.empty()) return "";
-  
-  bool isAscii = true;
-  for (char c : rawValue) {
-    if (c < 32 || c > 126) {
-      isAscii = false;
-      break;
-    }
-  }
-  if (isAscii) {
-    return String(rawValue.c_str());
-  }
-  
-  String out = "";
-  for (uint8_t c : rawValue) {
-    out += String(c) + " ";
-  }
-  return out;
+static void publishRecord(SessionRecordType type, bool flag = false) {
+  SessionRecord record;
+  record.type = type;
+  record.flag = flag;
+  record.length = 0;
+  gattWorker.publish(record);
 }
 
+// Reads every characteristic of one service and hands the values to loop()
 void exploreService(BLERemoteService* service) {
-  BLEUUID serviceUUID = service->getUUID();
-  Serial.printf("\nService: %s\nUUID: %s\n", 
-                (uuidNames.find(serviceUUID.toString()) != uuidNames.end() ? 
-                  uuidNames[serviceUUID.toString()].c_str() : serviceUUID.toString().c_str()),
-                serviceUUID.toString().c_str());
+  SessionRecord record;
+  record.type = RECORD_SERVICE;
+  record.uuid = service->getUUID();
+  record.length = 0;
+  gattWorker.publish(record);
 
   for (auto& chr : *service->getCharacteristics()) {
     BLERemoteCharacteristic* pChar = chr.second;
-    BLEUUID charUUID = pChar->getUUID();
-    Serial.printf("  Characteristic: %s\n  UUID: %s\n",
-                  (uuidNames.find(charUUID.toString()) != uuidNames.end() ? 
-                   uuidNames[charUUID.toString()].c_str() : charUUID.toString().c_str()),
-                  charUUID.toString().c_str());
-    
-    if (pChar->canRead()) {
+
+    // Every streaming characteristic is subscribed; test modes attach handlers to their slots
+    if (pChar->canNotify() || pChar->canIndicate()) {
+      notifyDispatcher.subscribe(pChar);
+    }
+
+    record.type = RECORD_VALUE;
+    record.uuid = pChar->getUUID();
+    record.handle = pChar->getHandle();
+    record.flag = pChar->canRead();
+    record.haveCpf = false;
+    record.unit = 0x2700; // Default: unitless
+    record.format = 0;
+    record.exponent = 0;
+    record.length = 0;
+    if (record.flag) {
       std::string rawValue = pChar->readValue();
-      String formattedValue = "";
-      uint16_t unitUUID = 0x2700; // Default: unitless
-      bool descriptorUsed = false;
-
-      auto descriptors = pChar->getDescriptors();
-      if (descriptors) {
-        for (auto& desc : *descriptors) {
-          if (desc.second->getUUID().equals(CPF_DESC_UUID)) {
-            std::string cpfData = desc.second->readValue();
-            if (cpfData.size() >= 7) {
-              uint8_t format = cpfData[0];
-              int8_t exponent = cpfData[1];
-              unitUUID = *(reinterpret_cast<const uint16_t*>(&cpfData[2]));
-              formattedValue = convertRawValue(rawValue, format, exponent, unitUUID);
-            }
-            descriptorUsed = true;
-            break;
-          }
-        }
-      }
-      
-      // If descriptor conversion failed, use fallback conversion.
-      if (formattedValue.length() == 0) {
-        formattedValue = fallbackConvert(rawValue);
-      }
-      
-      Serial.printf("  Value: %s\n", formattedValue.c_str());
+      record.haveCpf = readCpf(pChar, record.format, record.exponent, record.unit);
+      record.length = rawValue.size();
+      memcpy(record.data, rawValue.data(), std::min<size_t>(rawValue.size(), SESSION_RECORD_MAX_VALUE));
     }
+    gattWorker.publish(record);
   }
 }
 
-// Function to write magic word to Control Register
+// Function to write magic word to Control Register; results stay in controlChannel
 bool writeControlRegister() {
   if (!pClient || !pClient->isConnected()) {
-    Serial.println("Cannot write to control register: not connected");
-    return false;
-  }
-
-  Serial.println("Accessing Control Service...");
-  BLERemoteService* pControlService = pClient->getService(CONTROL_UUID);
-  if (!pControlService) {
-    Serial.println("Control Service not found");
+    gattWorker.print(OUT_QUIET, "Cannot write to control register: not connected\n");
     return false;
   }
 
-  Serial.println("Accessing Control Register characteristic...");
-  BLERemoteCharacteristic* pControlReg = pControlService->getCharacteristic(CONTROL_REG_UUID);
-  if (!pControlReg) {
-    Serial.println("Control Register characteristic not found");
+  if (!controlChannel.attach(pClient)) {
     return false;
   }
 
-  if (pControlReg->canWrite()) {
-    // Write as hex byte array (big-endian)
-    Serial.println("Writing magic word 0x337412E4 (big-endian)...");
-    uint8_t magicWordBytesBE[] = {0x33, 0x74, 0x12, 0xE4};
-    pControlReg->writeValue(magicWordBytesBE, sizeof(magicWordBytesBE), true);
-    Serial.println("Magic word successfully written to Control Register");
-    return true;
-  } else {
-    Serial.println("Control Register is not writable");
-    return false;
-  }
+  // Write as hex byte array (big-endian), verified by reading the register back
+  static const uint8_t magicWordBytesBE[] = {0x33, 0x74, 0x12, 0xE4};
+  controlChannel.enqueue(makeControlCommand("magic word", magicWordBytesBE, sizeof(magicWordBytesBE),
+                                            CONFIRM_READBACK));
+  bool ok = controlChannel.run() == 0;
+  controlChannel.detach();
+  return ok;
 }
 
+// Both run on the BLE host task; loop() reports the connect and the disconnect
 class MyClientCallback : public BLEClientCallbacks {
   void onConnect(BLEClient* pclient) override {
-    Serial.println("Connected to device");
     isConnected = true;
   }
 
   void onDisconnect(BLEClient* pclient) override {
-    Serial.println("Disconnected from device");
     isConnected = false;
-    if (targetDevice) {
-      delete targetDevice;
-      targetDevice = nullptr;
-    }
-    // Restart scanning after disconnection
-    startScan();
+    // loop() releases the client and restarts scanning as soon as the GATT task lets go
+    linkLost = true;
+    loopEvents.signal(LOOP_EVENT_DISCONNECT);
   }
 };
+// Shared by every session; pooled clients keep it between uses
+MyClientCallback clientCallbacks;
+
+// A device heard for the first time in this scan, queued for loop() to announce
+struct FoundDevice {
+  char name[32];
+  char address[18];
+  int rssi;
+};
+static SpscQueue<FoundDevice, FOUND_DEVICE_DEPTH> foundDevices;
 
 class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks {
   void onResult(BLEAdvertisedDevice advertisedDevice) override {
+    MemScope memScope(MEM_SCAN);
     if (advertisedDevice.haveName() && 
         advertisedDevice.getName().find(TARGET_DEVICE_PREFIX) == 0) {
       
-      // Get device address
-      std::string address = advertisedDevice.getAddress().toString();
-      
-      // Get RSSI (signal strength)
-      int rssi = advertisedDevice.getRSSI();
-      
-      // Create a copy of the device to store
-      BLEAdvertisedDevice* deviceCopy = new BLEAdvertisedDevice(advertisedDevice);
-      
-      // Store device with its signal strength
-      foundDevices[address] = std::make_pair(deviceCopy, rssi);
+      // Devices persist across scans; only one heard for the first time is announced
+      bool fresh = deviceList.seen(advertisedDevice);
+      // Typed as its identity or as any of its private addresses; only this advert counts,
+      // not an entry left in the list by an earlier scan
+      if (pendingConnect.armed && !pendingConnect.heard &&
+          deviceList.unitAddress(advertisedDevice.getAddress(), advertisedDevice.getAddressType()) ==
+              pendingConnect.unit) {
+        pendingConnect.heard = true;
+        loopEvents.signal(LOOP_EVENT_TARGET);
+      }
+      if (!fresh || !outputEnabled(OUT_NORMAL)) return;
       
-      Serial.print("Found device: ");
-      Serial.print(advertisedDevice.getName().c_str());
-      Serial.print(" - Address: ");
-      Serial.print(address.c_str());
-      Serial.print(" - RSSI: ");
-      Serial.println(rssi);
+      // Runs on the BLE host task: loop() prints the announcement
+      FoundDevice found;
+      snprintf(found.name, sizeof(found.name), "%s", advertisedDevice.getName().c_str());
+      snprintf(found.address, sizeof(found.address), "%s", advertisedDevice.getAddress().toString().c_str());
+      found.rssi = advertisedDevice.getRSSI();
+      if (foundDevices.push(found)) loopEvents.signal(LOOP_EVENT_SCAN);
     }
   }
 };
 
-String getUuidName(BLEUUID uuid) {
-  std::string uuidStr = uuid.toString();
-  return (uuidNames.find(uuidStr) != uuidNames.end()) ? 
-         String(uuidNames[uuidStr].c_str()) : 
-         String(uuidStr.c_str());
+// Announces the devices the scan callback queued
+static void printFoundDevices() {
+  FoundDevice found;
+  while (foundDevices.pop(found)) {
+    if (!consoleOut.begin(OUT_NORMAL)) continue;
+    consoleOut.printf("Found device: %s - Address: %s - RSSI: %d\r\n", found.name, found.address, found.rssi);
+    consoleOut.flush();
+  }
 }
 
-// Function to connect to the selected device
-bool connectToDevice();
-
 // Function to display found devices sorted by signal strength
 void displayFoundDevices() {
-  sortedDevices.clear();
+  MemScope memScope(MEM_OUTPUT);
   
-  // Convert map to vector for sorting
-  for (auto& item : foundDevices) {
-    sortedDevices.push_back(std::make_pair(item.first, item.second.second));
+  // The list keeps itself in RSSI order (strongest first); the table is rendered into one
+  // buffer, and the prompt is always shown, even when quiet
+  if (consoleOut.begin(OUT_NORMAL)) {
+    consoleOut.print("\r\n===== Found Devices =====\r\n"
+                     "Num | Device Name | Address | RSSI\r\n"
+                     "----------------------------------------\r\n");
+    unsigned number = 1;
+    deviceList.forEachRanked([&number](const std::string& address, const DeviceEntry& entry) {
+      consoleOut.printf("%u | %s | %s | %d\r\n", number++, entry.device->getName().c_str(), address.c_str(),
+                        entry.rssi);
+    });
+    consoleOut.print("----------------------------------------\r\n");
+    consoleOut.flush();
   }
-  
-  // Sort by RSSI (higher values = stronger signal)
-  std::sort(sortedDevices.begin(), sortedDevices.end(), 
-            [](const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
-              return a.second > b.second;
-            });
-  
-  Serial.println("\n===== Found Devices =====");
-  Serial.println("Num | Device Name | Address | RSSI");
-  Serial.println("----------------------------------------");
-  
-  for (size_t i = 0; i < sortedDevices.size(); i++) {
-    auto& deviceInfo = foundDevices[sortedDevices[i].first];
-    
-    Serial.print(i+1);
-    Serial.print(" | ");
-    Serial.print(deviceInfo.first->getName().c_str());
-    Serial.print(" | ");
-    Serial.print(sortedDevices[i].first.c_str());
-    Serial.print(" | ");
-    Serial.println(sortedDevices[i].second);
-  }
-  
-  Serial.println("----------------------------------------");
-  Serial.println("Enter device number to connect (1-" + String(sortedDevices.size()) + "):");
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Enter device number to connect (1-%u), optionally followed by a mode\r\n(battery, thermal, capture, sync, monitor),\r\n"
+                    "'audit' to read firmware versions from every device, or 'help' for all commands:\r\n",
+                    (unsigned)deviceList.size());
+  consoleOut.flush();
   waitingForUserInput = true;
+  loopEvents.signal(LOOP_EVENT_PROMPT);
 }
 
-// Process user selection
-void processUserSelection() {
-  if (Serial.available()) {
-    String input = Serial.readStringUntil('\n');
-    input.trim();
-    
-    int selection = input.toInt();
-    
-    if (selection > 0 && selection <= sortedDevices.size()) {
-      Serial.print("Connecting to device #");
-      Serial.println(selection);
-      
-      // Get the selected device address
-      std::string selectedAddress = sortedDevices[selection-1].first;
-      
-      // Set the target device
-      targetDevice = new BLEAdvertisedDevice(*foundDevices[selectedAddress].first);
-      deviceFound = true;
-      waitingForUserInput = false;
-      
-      // Connect to the device
-      if (!connectToDevice()) {
-        Serial.println("Connection failed. Restarting scan...");
-        delete targetDevice;
-        targetDevice = nullptr;
-        startScan();
-      }
-    } else {
-      Serial.println("Invalid selection. Please try again.");
+// ---- Console commands ----------------------------------------------------------------
+
+// RPC opcodes; 0x00 is reserved for leaving RPC mode
+enum ConsoleOpcode : uint8_t {
+  RPC_SELECT = 0x01,
+  RPC_SCAN = 0x02,
+  RPC_CONNECT = 0x03,
+  RPC_DISCONNECT = 0x04,
+  RPC_READ = 0x05,
+  RPC_WRITE = 0x06,
+  RPC_SUBSCRIBE = 0x07,
+  RPC_PLAN = 0x08,
+  RPC_STATS = 0x09,
+  RPC_OUTPUT = 0x0A,
+  RPC_LOG = 0x0B,
+  RPC_EXPORT = 0x0C,
+  RPC_AUDIT = 0x0D,
+  RPC_THERMAL = 0x0E,
+  RPC_HELP = 0x0F,
+  RPC_BONDS = 0x10,
+  RPC_DELTA = 0x11,
+  RPC_POLL = 0x12,
+  RPC_MONITOR = 0x13,
+  RPC_BENCH = 0x14
+};
+
+static GattJobType requestType;  // console read/write/subscribe waiting for its record
+static bool requestEnable;       // ...and for a subscribe, on or off
+static uint8_t planResult[6];    // pass, checked (le16), failed (le16), control written
+
+// Optional test mode word, e.g. the "battery" in "2 battery"
+static bool parseMode(const ConsoleRequest& request, uint8_t index, TestMode& mode) {
+  mode = MODE_EXPLORE;
+  if (index >= request.argc) return true;
+  const ConsoleArg& word = request.argv[index];
+  if (word.is("battery")) {
+    mode = MODE_BATTERY;
+  } else if (word.is("thermal")) {
+    mode = MODE_THERMAL;
+  } else if (word.is("capture")) {
+    mode = MODE_CAPTURE;
+  } else if (word.is("sync")) {
+    mode = MODE_SYNC;
+  } else if (word.is("monitor")) {
+    mode = MODE_MONITOR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// The GATT task owns the client while it has work, and only one request waits at a time
+static uint8_t linkState() {
+  if (!gattWorker.idle() || commandConsole.pending()) return STATUS_BUSY;
+  if (!pClient || !pClient->isConnected()) return STATUS_BAD_STATE;
+  return STATUS_OK;
+}
+
+// Selection needs the device list on screen: scan done, no session running
+static uint8_t promptState() {
+  if (commandConsole.pending()) return STATUS_BUSY;
+  return waitingForUserInput ? STATUS_OK : STATUS_BAD_STATE;
+}
+
+// One line of test plan progress; through consoleOut, so RPC mode frames it
+static void progress(const char* text) {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.print(text);
+  consoleOut.flush();
+}
+
+// Only the address and its type are kept from the device list; the connect goes by them
+static uint8_t startSession(BLEAdvertisedDevice& device, uint8_t flags, uint32_t chosenMs) {
+  sessionAddress = device.getAddress().toString();
+  sessionAddressType = device.getAddressType();
+  sessionChosenMs = chosenMs;
+  deviceFound = true;
+  waitingForUserInput = false;
+
+  // Hand the session to the GATT task; the rest happens in onSessionRecord()
+  if (!connectToDevice(flags)) {
+    progress("Connection failed. Restarting scan...\n");
+    startScan();
+    return STATUS_BUSY;
+  }
+  return STATUS_PENDING;
+}
+
+// A running scan is cut short once the unit to test is known
+static void stopScan() {
+  if (scanCompleted) return;
+  pBLEScan->stop();
+  scanCompleted = true;
+}
+
+// "<number> [mode]" at the prompt, or "select <number> [mode]"
+static uint8_t cmdSelect(const ConsoleRequest& request) {
+  uint8_t first = request.argv[0].is("select") ? 1 : 0;
+  if (first >= request.argc) return STATUS_BAD_ARGS;
+  const ConsoleArg& number = request.argv[first];
+  if (number.length == 0 || !isdigit((unsigned char)number.data[0])) {
+    return first ? STATUS_BAD_ARGS : STATUS_UNKNOWN;
+  }
+
+  TestMode mode;
+  if (!parseMode(request, first + 1, mode)) return STATUS_BAD_ARGS;
+  uint8_t state = promptState();
+  if (state != STATUS_OK) return state;
+  long selection = number.toInt();
+  BLEAdvertisedDevice device;
+  // Numbers follow the RSSI order shown in the table
+  if (selection <= 0 || !deviceList.at(selection - 1, device)) return STATUS_NOT_FOUND;
+
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Connecting to device #%ld\n", selection);
+  consoleOut.flush();
+  testMode = mode;
+  return startSession(device, 0, millis());
+}
+
+static uint8_t cmdScan(const ConsoleRequest& request) {
+  if (request.argc < 2) return STATUS_BAD_ARGS;
+  if (request.argv[1].is("start")) {
+    if (!scanCompleted || pClient || !gattWorker.idle()) return STATUS_BAD_STATE;
+    startScan();
+    return STATUS_OK;
+  }
+  if (request.argv[1].is("stop")) {
+    if (scanCompleted) return STATUS_BAD_STATE;
+    // A stopped scan never completes, so devices not heard yet are not reported lost
+    stopScan();
+    pendingConnect.armed = false;
+    progress("Scan stopped.\n");
+    displayFoundDevices();
+    return STATUS_OK;
+  }
+  return STATUS_BAD_ARGS;
+}
+
+// Connects and discovers without running the test plan; the link stays up for commands.
+// Works during a scan too: the scan stops and the connect starts as soon as the unit has
+// been heard, now or later in the scan.
+static uint8_t cmdConnect(const ConsoleRequest& request) {
+  if (request.argc < 2) return STATUS_BAD_ARGS;
+  if (commandConsole.pending()) return STATUS_BUSY;
+  bool scanning = !scanCompleted && !pClient && gattWorker.idle();
+  if (!waitingForUserInput && !scanning) return STATUS_BAD_STATE;
+
+  std::string address = request.argv[1].str();
+  for (char& c : address) c = tolower((unsigned char)c);
+  testMode = MODE_EXPLORE;
+  uint32_t chosenMs = millis();
+  if (scanning) {
+    // Stopping first keeps the scan callback off the device list while it is looked up
+    stopScan();
+    if (!deviceList.find(address)) {
+      // Not heard yet: scan on and connect the moment it advertises
+      pendingConnect.address = address;
+      pendingConnect.unit = deviceList.unitAddress(BLEAddress(address), BLE_ADDR_TYPE_RANDOM);
+      pendingConnect.chosenMs = chosenMs;
+      pendingConnect.heard = false;
+      pendingConnect.armed = true;
+      consoleOut.begin(OUT_QUIET);
+      consoleOut.printf("Waiting for %s to advertise\n", address.c_str());
+      consoleOut.flush();
+      startScan();
+      return STATUS_PENDING;
     }
   }
+  BLEAdvertisedDevice device;
+  if (!deviceList.find(address, &device)) return STATUS_NOT_FOUND;
+  return startSession(device, GATT_JOB_CONNECT_ONLY, chosenMs);
 }
 
-bool connectToDevice() {
-  if (!targetDevice) return false;
-  
-  Serial.print("Connecting to ");
-  Serial.println(targetDevice->getAddress().toString().c_str());
+static uint8_t cmdDisconnect(const ConsoleRequest& request) {
+  uint8_t state = linkState();
+  if (state != STATUS_OK) return state;
+  // The client callback and loop() take it from here, as for a link the peer dropped
+  pClient->disconnect();
+  return STATUS_OK;
+}
+
+// Explore, verdict, Control Register write and the test mode, on the link already up
+static uint8_t cmdPlan(const ConsoleRequest& request) {
+  uint8_t state = linkState();
+  if (state != STATUS_OK) return state;
+  TestMode mode;
+  if (!parseMode(request, 1, mode)) return STATUS_BAD_ARGS;
+  testMode = mode;
+  return connectToDevice(GATT_JOB_REUSE_LINK) ? STATUS_PENDING : STATUS_BUSY;
+}
+
+// read/write/subscribe by characteristic UUID, run on the GATT task
+static uint8_t postRequest(GattJobType type, const ConsoleRequest& request) {
+  uint8_t state = linkState();
+  if (state != STATUS_OK) return state;
+  if (request.argc < 2) return STATUS_BAD_ARGS;
+
+  GattJob job;
+  job.type = type;
+  const ConsoleArg& uuid = request.argv[1];
+  bool prefixed = uuid.length > 2 && uuid.data[0] == '0' && (uuid.data[1] == 'x' || uuid.data[1] == 'X');
+  job.uuid = BLEUUID(prefixed ? std::string(uuid.data + 2, uuid.length - 2) : uuid.str());
+  if (job.uuid.bitSize() == 0) return STATUS_BAD_ARGS;
 
-  if (pClient) {
-    pClient->disconnect();
-    delete pClient;
+  if (type == JOB_WRITE) {
+    job.length = request.bytes(2, job.data, sizeof(job.data));
+    if (job.length == 0) return STATUS_BAD_ARGS;
+  } else if (type == JOB_SUBSCRIBE) {
+    job.mode = !(request.argc > 2 && request.argv[2].is("off"));
   }
+  if (!gattWorker.post(job)) return STATUS_BUSY;
+  requestType = type;
+  requestEnable = job.mode;
+  return STATUS_PENDING;
+}
+
+static uint8_t cmdRead(const ConsoleRequest& request) {
+  return postRequest(JOB_READ, request);
+}
 
-  pClient = BLEDevice::createClient();
-  pClient->setClientCallbacks(new MyClientCallback());
+static uint8_t cmdWrite(const ConsoleRequest& request) {
+  return postRequest(JOB_WRITE, request);
+}
 
-  if (!pClient->connect(targetDevice)) {
-    Serial.println("Connection failed");
-    return false;
+static uint8_t cmdSubscribe(const ConsoleRequest& request) {
+  return postRequest(JOB_SUBSCRIBE, request);
+}
+
+// "stats [what]", or one of the short forms ("notify", "mem", "tasks", "events")
+static uint8_t cmdStats(const ConsoleRequest& request) {
+  const ConsoleArg* what = &request.argv[0];
+  if (what->is("stats")) what = request.argc > 1 ? &request.argv[1] : nullptr;
+  bool all = !what || what->is("all");
+  bool known = all;
+
+  // Notification counters, drops and delivery latency
+  if (all || what->is("notify")) {
+    notifyDispatcher.printStats();
+    known = true;
+  }
+  // Heap accounting per subsystem
+  if (all || what->is("mem")) {
+    printMemReport();
+    sessionArena.printStats();
+    known = true;
+  }
+  // FreeRTOS task load, stack headroom and ring depths
+  if (all || what->is("tasks")) {
+    gattWorker.printStats();
+    known = true;
+  }
+  // Wake-up and reaction latency of the main loop per event source
+  if (all || what->is("events")) {
+    loopEvents.printStats();
+    known = true;
+  }
+  if (all || what->is("devices")) {
+    deviceList.printStats();
+    known = true;
+  }
+  if (all || what->is("console")) {
+    commandConsole.printStats();
+    known = true;
+  }
+  if (all || what->is("log")) {
+    telemetryLog.printStats();
+    known = true;
+  }
+  // Client pool and connect latency per unit
+  if (all || what->is("connect")) {
+    clientPool.printStats();
+    known = true;
+  }
+  if (all || what->is("bonds")) {
+    bondStore.printStats();
+    known = true;
+  }
+  if (all || what->is("values")) {
+    valueStore.printStats();
+    known = true;
+  }
+  // Monitoring schedule: achieved periods, coalesced reads
+  if (all || what->is("poll")) {
+    if (!gattWorker.idle()) return STATUS_BUSY;
+    pollScheduler.printStats();
+    known = true;
+  }
+  return known ? STATUS_OK : STATUS_BAD_ARGS;
+}
+
+// Verbosity can be changed at any time: "output <level>" or just the level
+static uint8_t cmdOutput(const ConsoleRequest& request) {
+  const ConsoleArg* level = &request.argv[0];
+  if (level->is("output")) {
+    if (request.argc < 2) return STATUS_BAD_ARGS;
+    level = &request.argv[1];
+  }
+  if (level->is("quiet")) {
+    outputLevel = OUT_QUIET;
+  } else if (level->is("normal")) {
+    outputLevel = OUT_NORMAL;
+  } else if (level->is("verbose")) {
+    outputLevel = OUT_VERBOSE;
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Output level set to %s\n", level->str().c_str());
+  consoleOut.flush();
+  return STATUS_OK;
+}
+
+// Telemetry log queries: "log", "log <address>", "log dump <seq>", "log compact"
+static uint8_t cmdLog(const ConsoleRequest& request) {
+  if (request.argc < 2) {
+    telemetryLog.printStats();
+  } else if (request.argv[1].is("compact")) {
+    telemetryLog.compact(3);
+  } else if (request.argv[1].is("dump")) {
+    telemetryLog.dump(request.argc > 2 ? request.argv[2].toInt() : 0);
+  } else {
+    telemetryLog.printSessions(request.argv[1].str());
+  }
+  return STATUS_OK;
+}
+
+// Device list deltas for the floor dashboard: "export on|off|sync"
+static uint8_t cmdExport(const ConsoleRequest& request) {
+  if (request.argc < 2) {
+    deviceList.printStats();
+  } else if (request.argv[1].is("on")) {
+    deviceList.setExport(&Serial);
+  } else if (request.argv[1].is("off")) {
+    deviceList.setExport(nullptr);
+  } else if (request.argv[1].is("sync")) {
+    deviceList.resync();
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  return STATUS_OK;
+}
+
+// Audit firmware versions of every listed device on the GATT task; the table and the
+// list come back when it is done
+static uint8_t cmdAudit(const ConsoleRequest& request) {
+  uint8_t state = promptState();
+  if (state != STATUS_OK) return state;
+  GattJob job;
+  job.type = JOB_AUDIT;
+  if (!gattWorker.post(job)) return STATUS_BUSY;
+  waitingForUserInput = false;
+  return STATUS_PENDING;
+}
+
+// A running thermal profile can be printed or ended on demand
+static uint8_t cmdThermal(const ConsoleRequest& request) {
+  const ConsoleArg* action = &request.argv[0];
+  if (action->is("thermal")) {
+    if (request.argc < 2) return STATUS_BAD_ARGS;
+    action = &request.argv[1];
+  }
+  if (!gattWorker.idle()) return STATUS_BUSY;
+  if (!thermalProfile.active()) return STATUS_BAD_STATE;
+  if (action->is("report")) {
+    thermalProfile.printSeries();
+  } else if (action->is("stop")) {
+    thermalProfile.stop();
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  return STATUS_OK;
+}
+
+// "bonds" lists them; "bonds forget <address>" or "bonds clear" makes units pair again
+static uint8_t cmdBonds(const ConsoleRequest& request) {
+  if (request.argc < 2) {
+    bondStore.printStats();
+    return STATUS_OK;
+  }
+  // The table belongs to the GATT task while it has work
+  if (!gattWorker.idle()) return STATUS_BUSY;
+  if (request.argv[1].is("clear")) {
+    bondStore.forget(nullptr);
+  } else if (request.argv[1].is("forget") && request.argc > 2) {
+    uint8_t address[6];
+    if (!parseAddress(request.argv[2].str(), address)) return STATUS_BAD_ARGS;
+    bondStore.forget(address);
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  return STATUS_OK;
+}
+
+// Repeated sweeps print only changed values unless "delta off"; "delta reset" forgets them
+static uint8_t cmdDelta(const ConsoleRequest& request) {
+  if (request.argc < 2) {
+    valueStore.printStats();
+  } else if (request.argv[1].is("on")) {
+    valueStore.setDeltaOnly(true);
+  } else if (request.argv[1].is("off")) {
+    valueStore.setDeltaOnly(false);
+  } else if (request.argv[1].is("reset")) {
+    valueStore.clear();
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  return STATUS_OK;
+}
+
+// "poll" lists the periods; "poll <battery|temperature|csc|user|uuid> <ms>" sets one for
+// the next monitoring run, 0 to leave it out
+static uint8_t cmdPoll(const ConsoleRequest& request) {
+  if (request.argc < 2) {
+    pollScheduler.printRates();
+    return STATUS_OK;
+  }
+  if (request.argc < 3) return STATUS_BAD_ARGS;
+  const ConsoleArg& target = request.argv[1];
+  BLEUUID uuid;
+  if (target.is("battery")) {
+    uuid = BATTERY_UUID;
+  } else if (target.is("temperature")) {
+    uuid = TEMP_UUID;
+  } else if (target.is("csc")) {
+    uuid = CSCP_UUID;
+  } else if (target.is("user")) {
+    uuid = USER_UUID;
+  } else {
+    bool prefixed = target.length > 2 && target.data[0] == '0' && (target.data[1] == 'x' || target.data[1] == 'X');
+    uuid = BLEUUID(prefixed ? std::string(target.data + 2, target.length - 2) : target.str());
+  }
+  if (uuid.bitSize() == 0) return STATUS_BAD_ARGS;
+  return pollScheduler.setRate(uuid, request.argv[2].toInt()) ? STATUS_OK : STATUS_BAD_STATE;
+}
+
+static void endMonitor() {
+  pollScheduler.stop();
+  valueStore.endSweep();
+}
+
+// A monitoring run can be reported or ended on demand
+static uint8_t cmdMonitor(const ConsoleRequest& request) {
+  if (request.argc < 2) return STATUS_BAD_ARGS;
+  if (!pollScheduler.active()) return STATUS_BAD_STATE;
+  if (!gattWorker.idle()) return STATUS_BUSY;
+  if (request.argv[1].is("report")) {
+    pollScheduler.printStats();
+  } else if (request.argv[1].is("stop")) {
+    endMonitor();
+  } else {
+    return STATUS_BAD_ARGS;
+  }
+  return STATUS_OK;
+}
+
+// Blocks the loop while it runs; meant for a bench unit, not a station mid-test
+static uint8_t cmdBench(const ConsoleRequest& request) {
+  if (!gattWorker.idle()) return STATUS_BUSY;
+  long rounds = request.argc > 1 ? request.argv[1].toInt() : DECODE_BENCH_ROUNDS;
+  if (rounds <= 0) return STATUS_BAD_ARGS;
+  runDecodeBench(rounds);
+  return STATUS_OK;
+}
+
+static uint8_t cmdHelp(const ConsoleRequest& request) {
+  commandConsole.printHelp();
+  return STATUS_OK;
+}
+
+static const ConsoleCommand consoleCommands[] = {
+  {"select", RPC_SELECT, cmdSelect, "select <number> [battery|thermal|capture|sync|monitor]"},
+  {"scan", RPC_SCAN, cmdScan, "scan start|stop"},
+  {"connect", RPC_CONNECT, cmdConnect, "connect <address>"},
+  {"disconnect", RPC_DISCONNECT, cmdDisconnect, "disconnect"},
+  {"read", RPC_READ, cmdRead, "read <uuid>"},
+  {"write", RPC_WRITE, cmdWrite, "write <uuid> <hex bytes>"},
+  {"subscribe", RPC_SUBSCRIBE, cmdSubscribe, "subscribe <uuid> [off]"},
+  {"plan", RPC_PLAN, cmdPlan, "plan [battery|thermal|capture|sync|monitor]"},
+  {"stats", RPC_STATS, cmdStats, "stats [all|notify|mem|tasks|events|devices|console|log|connect|bonds|values|poll]"},
+  {"output", RPC_OUTPUT, cmdOutput, "output quiet|normal|verbose"},
+  {"log", RPC_LOG, cmdLog, "log [compact|dump <seq>|<address>]"},
+  {"export", RPC_EXPORT, cmdExport, "export [on|off|sync]"},
+  {"audit", RPC_AUDIT, cmdAudit, "audit"},
+  {"thermal", RPC_THERMAL, cmdThermal, "thermal report|stop"},
+  {"bonds", RPC_BONDS, cmdBonds, "bonds [forget <address>|clear]"},
+  {"delta", RPC_DELTA, cmdDelta, "delta [on|off|reset]"},
+  {"poll", RPC_POLL, cmdPoll, "poll [<battery|temperature|csc|user|uuid> <ms>]"},
+  {"monitor", RPC_MONITOR, cmdMonitor, "monitor report|stop"},
+  {"bench", RPC_BENCH, cmdBench, "bench [rounds]"},
+  {"help", RPC_HELP, cmdHelp, "help"},
+  // Short forms from the original prompt (text mode only)
+  {"quiet", 0, cmdOutput, "quiet"},
+  {"normal", 0, cmdOutput, "normal"},
+  {"verbose", 0, cmdOutput, "verbose"},
+  {"notify", 0, cmdStats, "notify"},
+  {"mem", 0, cmdStats, "mem"},
+  {"tasks", 0, cmdStats, "tasks"},
+  {"events", 0, cmdStats, "events"},
+  {"report", 0, cmdThermal, "report"},
+  {"stop", 0, cmdThermal, "stop"}
+};
+
+// Starts a session on the GATT task for sessionAddress; flags as for GattJob
+bool connectToDevice(uint8_t flags) {
+  if (sessionAddress.empty()) return false;
+
+  // Whatever the previous session left in the arena goes in one step
+  endSessionData();
+  notifyDispatcher.reset();
+
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("%s%s\n", flags & GATT_JOB_REUSE_LINK ? "Running test plan on " : "Connecting to ",
+                    sessionAddress.c_str());
+  consoleOut.flush();
+
+  GattJob job;
+  job.type = JOB_SESSION;
+  job.mode = testMode;
+  job.flags = flags;
+  job.addressType = sessionAddressType;
+  job.chosenMs = sessionChosenMs;
+  strncpy(job.address, sessionAddress.c_str(), sizeof(job.address) - 1);
+  job.address[sizeof(job.address) - 1] = '\0';
+  return gattWorker.post(job);
+}
+
+// Connects and reads every explored service; loop() evaluates as the records arrive
+static void gattSession(const GattJob& job) {
+  MemScope memScope(MEM_GATT);
+
+  ConnectTiming timing = {};
+  uint32_t start = millis();
+  timing.queuedMs = start - job.chosenMs;
+  bool reuse = (job.flags & GATT_JOB_REUSE_LINK) && pClient && pClient->isConnected();
+  if (!reuse) {
+    if (pClient) clientPool.release(pClient);
+    pClient = clientPool.acquire(&clientCallbacks);
+
+    // Straight to the cached address and type; no scan result is needed for the connect
+    if (!pClient ||
+        !pClient->connect(BLEAddress(std::string(job.address)), (esp_ble_addr_type_t)job.addressType)) {
+      if (pClient) clientPool.release(pClient);
+      pClient = nullptr;
+      publishRecord(RECORD_CONNECT_FAILED);
+      return;
+    }
   }
+  uint32_t linked = millis();
+  timing.linkMs = linked - start;
 
-  Serial.println("Connection established. Discovering services...");
+  // Encrypt before anything is read: the Control Register is only served over a bonded link
+  if (!reuse) {
+    timing.security = bondStore.secure(pClient);
+    uint32_t secured = millis();
+    timing.securityMs = secured - linked;
+    linked = secured;
+  }
 
   // Discover services
   auto services = pClient->getServices();
   if (!services) {
-    Serial.println("Failed to get services");
-    return false;
+    publishRecord(RECORD_CONNECT_FAILED, true);
+    return;
   }
+  timing.discoveryMs = millis() - linked;
+
+  SessionRecord connected;
+  connected.type = RECORD_CONNECTED;
+  connected.flag = job.flags & GATT_JOB_CONNECT_ONLY;
+  connected.length = reuse ? 0 : sizeof(timing);
+  memcpy(connected.data, &timing, sizeof(timing));
+  gattWorker.publish(connected);
+  if (job.flags & GATT_JOB_CONNECT_ONLY) return;
+
+  // Device Information is read once into a fixed snapshot rather than explored field by field
+  publishRecord(RECORD_SNAPSHOT, readDisSnapshot(pClient->getService(DIS_UUID), workerSnapshot));
 
-  // Print info about all services and characteristics
   for (auto& service : *services) {
     BLEUUID serviceUUID = service.second->getUUID();
-    if (serviceUUID.equals(DIS_UUID) || serviceUUID.equals(TEMP_UUID) ||
+    if (serviceUUID.equals(TEMP_UUID) ||
         serviceUUID.equals(CSCP_UUID) || serviceUUID.equals(USER_UUID) ||
         serviceUUID.equals(BATTERY_UUID) || serviceUUID.equals(CONTROL_UUID)) {
       exploreService(service.second);
     }
   }
-  
-  // After exploring services, write the magic word to the Control Register
-  Serial.println("\nAttempting to write magic word to Control Register...");
-  bool writeResult = writeControlRegister();
-  if (writeResult) {
-    Serial.println("Control Register write completed successfully");
+  publishRecord(RECORD_EXPLORED);
+}
+
+// flag = the mode started (or, for capture and sync, did its work)
+static void gattStartMode(uint8_t mode) {
+  bool ok = true;
+  if (mode == MODE_BATTERY) {
+    ok = batteryTrend.start(pClient);
+  } else if (mode == MODE_THERMAL) {
+    ok = thermalProfile.start(pClient);
+  } else if (mode == MODE_CAPTURE) {
+    ok = profileSync.capture(pClient) > 0;
+  } else if (mode == MODE_SYNC) {
+    ok = profileSync.sync(pClient);
+  } else if (mode == MODE_MONITOR) {
+    ok = pollScheduler.start(pClient);
+  }
+  publishRecord(RECORD_MODE_DONE, ok);
+}
+
+static BLERemoteCharacteristic* findCharacteristic(BLEUUID uuid) {
+  auto services = pClient->getServices();
+  if (!services) return nullptr;
+  for (auto& service : *services) {
+    BLERemoteCharacteristic* pChar = service.second->getCharacteristic(uuid);
+    if (pChar) return pChar;
+  }
+  return nullptr;
+}
+
+// Console read/write/subscribe on the current link
+static void gattRequest(const GattJob& job) {
+  SessionRecord record;
+  record.type = RECORD_REQUEST_DONE;
+  record.uuid = job.uuid;
+  record.length = 0;
+  record.status = STATUS_BAD_STATE;
+  if (!pClient || !pClient->isConnected()) {
+    gattWorker.publish(record);
+    return;
+  }
+
+  BLERemoteCharacteristic* pChar = findCharacteristic(job.uuid);
+  if (!pChar) {
+    record.status = STATUS_NOT_FOUND;
+    gattWorker.publish(record);
+    return;
+  }
+
+  record.status = STATUS_OK;
+  if (job.type == JOB_READ) {
+    if (!pChar->canRead()) {
+      record.status = STATUS_BAD_ARGS;
+    } else {
+      std::string value = pChar->readValue();
+      record.length = value.size();
+      memcpy(record.data, value.data(), std::min<size_t>(value.size(), SESSION_RECORD_MAX_VALUE));
+    }
+  } else if (job.type == JOB_WRITE) {
+    if (!pChar->canWrite() && !pChar->canWriteNoResponse()) {
+      record.status = STATUS_BAD_ARGS;
+    } else {
+      uint8_t value[GATT_JOB_MAX_VALUE];
+      memcpy(value, job.data, job.length);
+      pChar->writeValue(value, job.length, pChar->canWrite());
+    }
+  } else if (job.mode) {
+    // Values arrive through the dispatcher and are printed (or framed) on loop()
+    bool subscribed = notifyDispatcher.subscribe(pChar, [](BLERemoteCharacteristic* c, const NotifyEvent& event) {
+      commandConsole.notify(c->getUUID(), c->getHandle(), event.data, event.length);
+    });
+    if (!subscribed) record.status = STATUS_BAD_ARGS;
   } else {
-    Serial.println("Control Register write failed");
+    notifyDispatcher.unsubscribe(pChar);
+  }
+
+  // A request that ran into a dropped link failed, whatever it returned
+  if (record.status == STATUS_OK && !pClient->isConnected()) record.status = STATUS_GATT_ERROR;
+  if (job.type == JOB_SUBSCRIBE) {
+    uint16_t handle = pChar->getHandle();
+    record.data[0] = handle & 0xFF;
+    record.data[1] = handle >> 8;
+    record.length = 2;
+  }
+  gattWorker.publish(record);
+}
+
+void runGattJob(const GattJob& job) {
+  switch (job.type) {
+    case JOB_SESSION:
+      gattSession(job);
+      break;
+    case JOB_CONTROL:
+      publishRecord(RECORD_CONTROL_DONE, writeControlRegister());
+      break;
+    case JOB_MODE:
+      gattStartMode(job.mode);
+      break;
+    case JOB_AUDIT:
+      fleetAudit.run(deviceList);
+      publishRecord(RECORD_AUDIT_DONE);
+      break;
+    case JOB_READ:
+    case JOB_WRITE:
+    case JOB_SUBSCRIBE:
+      gattRequest(job);
+      break;
+    case JOB_POLL:
+      pollScheduler.runDue();
+      publishRecord(RECORD_POLL_DONE);
+      break;
+  }
+}
+
+// ---- loop(): decode, evaluation, logging and output ----------------------------------
+
+static bool serviceShown = false;   // consoleOut holds an open service block
+static unsigned serviceUnchanged = 0;  // ...and this many of its characteristics were left out
+static bool haveSnapshot = false;
+
+static void closeServiceBlock() {
+  if (serviceShown) {
+    if (serviceUnchanged) consoleOut.printf("  %u unchanged\n", serviceUnchanged);
+    consoleOut.flush();
+  }
+  serviceShown = false;
+  serviceUnchanged = 0;
+}
+
+static void showValue(const SessionRecord& record) {
+  BLEUUID charUUID = record.uuid;
+  std::string rawValue(reinterpret_cast<const char*>(record.data),
+                       std::min<size_t>(record.length, SESSION_RECORD_MAX_VALUE));
+  // A characteristic that cannot be read is remembered by its presence alone
+  ValueChange change = valueStore.note(charUUID, record.handle, record.flag ? rawValue : std::string());
+  bool shown = serviceShown;
+  if (shown && change == VALUE_UNCHANGED && valueStore.deltaOnly()) {
+    serviceUnchanged++;
+    shown = false;
+  }
+  if (shown) {
+    consoleOut.printf("  Characteristic: %s\n  UUID: %s\n", getUuidName(charUUID).c_str(),
+                      charUUID.toString().c_str());
+  }
+  if (!record.flag) return;
+
+  DecimalValue number;
+  bool haveNumber = record.haveCpf && decodeDecimal(rawValue, record.format, record.exponent, number);
+  expectations.record(charUUID, record.unit, haveNumber, number, rawValue);
+  telemetryLog.logValue(charUUID, rawValue);
+
+  // Formatting is skipped entirely when output is muted or the value is unchanged
+  if (!shown) return;
+
+  String formattedValue = haveNumber ? convertRawValue(rawValue, record.format, record.exponent, record.unit) : "";
+
+  // If descriptor conversion failed, use fallback conversion.
+  if (formattedValue.length() == 0) {
+    formattedValue = fallbackConvert(rawValue);
+  }
+
+  consoleOut.printf(change == VALUE_CHANGED ? "  Value: %s (changed)\n" : "  Value: %s\n", formattedValue.c_str());
+}
+
+static void showSnapshot() {
+  const DisSnapshot& snapshot = workerSnapshot;
+  const DisSnapshot* previous = disRegistry.findUnit(snapshot);
+  bool unchanged = previous && previous->unitHash == snapshot.unitHash;
+  // With delta-only reporting an unchanged unit is not listed again
+  if (!unchanged || !valueStore.deltaOnly()) printDisSnapshot(snapshot);
+  if (unchanged) {
+    progress("Unit unchanged since its last test\n");
+  } else if (previous) {
+    progress("Unit changed since its last test:\n");
+    printDisDiff(*previous, snapshot);
+  }
+
+  // A firmware config that already passed has nothing new to show in its DIS strings
+  int passes = disRegistry.configPasses(snapshot.configHash);
+  if (passes > 0) {
+    consoleOut.begin(OUT_QUIET);
+    consoleOut.printf("Firmware config %08lX already passed on %d unit(s); skipping DIS checks\n",
+                      (unsigned long)snapshot.configHash, passes);
+    consoleOut.flush();
+  } else {
+    recordDisSnapshot(snapshot);
+  }
+}
+
+// Monitored values are printed and logged when they change (every time with "delta off")
+static void showPolled(const SessionRecord& record) {
+  BLEUUID charUUID = record.uuid;
+  std::string rawValue(reinterpret_cast<const char*>(record.data),
+                       std::min<size_t>(record.length, SESSION_RECORD_MAX_VALUE));
+  if (valueStore.note(charUUID, record.handle, rawValue) == VALUE_UNCHANGED && valueStore.deltaOnly()) return;
+  telemetryLog.logValue(charUUID, rawValue);
+  if (!consoleOut.begin(OUT_NORMAL)) return;
+
+  String formattedValue = record.haveCpf ? convertRawValue(rawValue, record.format, record.exponent, record.unit) : "";
+  if (formattedValue.length() == 0) formattedValue = fallbackConvert(rawValue);
+  consoleOut.printf("[%lu ms] %s: %s\n", (unsigned long)millis(), getUuidName(charUUID).c_str(),
+                    formattedValue.c_str());
+  consoleOut.flush();
+}
+
+void onSessionRecord(const SessionRecord& record) {
+  switch (record.type) {
+    case RECORD_CONNECT_FAILED:
+      linkLost = false;  // the scan is restarted right here
+      progress(record.flag ? "Failed to get services\n" : "Connection failed\n");
+      progress("Connection failed. Restarting scan...\n");
+      startScan();
+      commandConsole.complete(STATUS_GATT_ERROR);
+      break;
+
+    case RECORD_CONNECTED:
+      progress("Connection established. Services discovered.\n");
+      // Known once the link is secured: a unit that just paired has handed over its IRK
+      sessionUnit = deviceList.unitAddress(BLEAddress(sessionAddress), sessionAddressType);
+      if (record.length == sizeof(ConnectTiming)) {
+        ConnectTiming timing;
+        memcpy(&timing, record.data, sizeof(timing));
+        clientPool.recordConnect(sessionAddress, timing);
+        consoleOut.begin(OUT_QUIET);
+        consoleOut.printf("Connected to %s in %lu ms (queued %lu, link %lu, security %lu, discovery %lu), %s\n",
+                          sessionAddress.c_str(),
+                          (unsigned long)(timing.queuedMs + timing.linkMs + timing.securityMs + timing.discoveryMs),
+                          (unsigned long)timing.queuedMs, (unsigned long)timing.linkMs,
+                          (unsigned long)timing.securityMs, (unsigned long)timing.discoveryMs,
+                          linkSecurityName(timing.security));
+        consoleOut.flush();
+      }
+      if (record.flag) {
+        progress("Link kept open: read, write, subscribe, plan or disconnect\n");
+        commandConsole.complete(STATUS_OK);
+        break;
+      }
+      // Print info about all services and characteristics, collecting values for the verdict
+      expectations.beginSession(sessionUnit);
+      telemetryLog.beginSession(sessionUnit);
+      valueStore.beginSweep(sessionUnit);
+      break;
+
+    case RECORD_SNAPSHOT:
+      haveSnapshot = record.flag;
+      if (haveSnapshot) showSnapshot();
+      break;
+
+    case RECORD_SERVICE: {
+      // The whole service block is rendered into one buffer and written once
+      closeServiceBlock();
+      serviceShown = consoleOut.begin(OUT_NORMAL);
+      BLEUUID serviceUUID = record.uuid;
+      if (serviceShown) {
+        consoleOut.printf("\nService: %s\nUUID: %s\n", getUuidName(serviceUUID).c_str(),
+                          serviceUUID.toString().c_str());
+      }
+      break;
+    }
+
+    case RECORD_VALUE:
+      showValue(record);
+      break;
+
+    case RECORD_EXPLORED: {
+      closeServiceBlock();
+      valueStore.endSweep();
+      SessionVerdict verdict = expectations.evaluate();
+      {
+        MemScope outputScope(MEM_OUTPUT);
+        expectations.printVerdict(verdict);
+      }
+      if (haveSnapshot) disRegistry.remember(workerSnapshot, verdict.pass);
+      telemetryLog.logVerdict(verdict, haveSnapshot ? workerSnapshot.configHash : 0);
+      planResult[0] = verdict.pass;
+      planResult[1] = verdict.checked & 0xFF;
+      planResult[2] = verdict.checked >> 8;
+      planResult[3] = verdict.failed & 0xFF;
+      planResult[4] = verdict.failed >> 8;
+
+      // A monitoring run goes straight on: the magic word makes the unit drop the link
+      if (testMode == MODE_MONITOR) {
+        GattJob job;
+        job.type = JOB_MODE;
+        job.mode = testMode;
+        gattWorker.post(job);
+        break;
+      }
+
+      // After exploring services, write the magic word to the Control Register
+      progress("\nAttempting to write magic word to Control Register...\n"
+               "Writing magic word 0x337412E4 (big-endian)...\n");
+      GattJob job;
+      job.type = JOB_CONTROL;
+      gattWorker.post(job);
+      break;
+    }
+
+    case RECORD_CONTROL_DONE:
+      controlChannel.printResults();
+      for (size_t i = 0; i < controlChannel.lastResultCount(); i++) {
+        telemetryLog.logControl(controlChannel.lastResult(i));
+      }
+      progress(record.flag ? "Control Register write completed successfully\n" : "Control Register write failed\n");
+
+      planResult[5] = record.flag;
+
+      if (testMode != MODE_EXPLORE) {
+        GattJob job;
+        job.type = JOB_MODE;
+        job.mode = testMode;
+        gattWorker.post(job);
+      } else {
+        commandConsole.complete(STATUS_OK, planResult, sizeof(planResult));
+      }
+      break;
+
+    case RECORD_MODE_DONE:
+      if (testMode == MODE_SYNC) profileSync.printReport();
+      // The whole monitoring run counts as one sweep of the unit
+      if (pollScheduler.active()) valueStore.beginSweep(sessionUnit);
+      commandConsole.complete(record.flag ? STATUS_OK : STATUS_GATT_ERROR, planResult, sizeof(planResult));
+      break;
+
+    case RECORD_POLL:
+      showPolled(record);
+      break;
+
+    case RECORD_POLL_DONE:
+      pollPosted = false;
+      break;
+
+    case RECORD_TEXT: {
+      char text[SESSION_RECORD_MAX_VALUE + 1];
+      memcpy(text, record.data, record.length);
+      text[record.length] = '\0';
+      if (consoleOut.begin((OutputLevel)record.status)) {
+        consoleOut.print(text);
+        consoleOut.flush();
+      }
+      break;
+    }
+
+    case RECORD_AUDIT_ROW:
+      fleetAudit.printRow(record.data[0]);
+      break;
+
+    case RECORD_AUDIT_DONE:
+      fleetAudit.printTable();
+      displayFoundDevices();
+      commandConsole.complete(STATUS_OK);
+      break;
+
+    case RECORD_REQUEST_DONE: {
+      size_t stored = std::min<size_t>(record.length, SESSION_RECORD_MAX_VALUE);
+      // In RPC mode the RESULT frame carries the value
+      if (record.status == STATUS_OK && !commandConsole.rpcMode() && consoleOut.begin(OUT_QUIET)) {
+        std::string uuid = BLEUUID(record.uuid).toString();
+        if (requestType == JOB_READ) {
+          consoleOut.printf("Value %s:", uuid.c_str());
+          for (size_t i = 0; i < stored; i++) consoleOut.printf(" %02X", record.data[i]);
+          consoleOut.print("\n");
+        } else if (requestType == JOB_WRITE) {
+          consoleOut.printf("Written %s\n", uuid.c_str());
+        } else {
+          consoleOut.printf("Notifications from %s (handle %u) %s\n", uuid.c_str(),
+                            (unsigned)(record.data[0] | record.data[1] << 8), requestEnable ? "on" : "off");
+        }
+        consoleOut.flush();
+      }
+      commandConsole.complete(record.status, record.data, stored);
+      break;
+    }
   }
-  
-  return true;
 }
 
 void startScan() {
-  Serial.println("Starting BLE scan for devices with prefix: " + String(TARGET_DEVICE_PREFIX) + "...");
+  MemScope memScope(MEM_SCAN);
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Starting BLE scan for devices with prefix: %s...\n", TARGET_DEVICE_PREFIX);
+  consoleOut.flush();
   
-  // Clear previous scan results
+  // Clear previous scan results; the device list carries over and is reconciled at the end
   pBLEScan->clearResults();
-  
-  // Clear stored devices from previous scan
-  for (auto& item : foundDevices) {
-    delete item.second.first;  // Delete the BLEAdvertisedDevice pointer
-  }
-  foundDevices.clear();
+  deviceList.beginScan();
   
   // Start scan for 5 seconds
   scanCompleted = false;
   waitingForUserInput = false;
+  scanEnded = false;
+  rescanDue = false;
   
+  // Runs on the BLE host task; loop() reports the result
   pBLEScan->start(5, [](BLEScanResults results) {
-    Serial.print("Scan complete. Found ");
-    Serial.print(foundDevices.size());
-    Serial.println(" matching devices.");
-    
-    if (foundDevices.empty()) {
-      Serial.println("No devices found with prefix '" + String(TARGET_DEVICE_PREFIX) + "'. Restarting scan...");
-      delay(2000);  // Wait 2 seconds before restarting scan
-      startScan();
-    } else {
-      // Display the devices and wait for user input
-      displayFoundDevices();
-    }
-    
-    scanCompleted = true;
+    scanEnded = true;
+    loopEvents.signal(LOOP_EVENT_SCAN);
   }, false);
 }
 
+// A scan that ran its full time: reconcile the list, then show it or scan again shortly
+static void endScan() {
+  // Stopped early (a unit was picked): the list is left as it is
+  if (scanCompleted) return;
+  // Anything not heard during this scan is dropped (and reported lost)
+  deviceList.endScan();
+  scanCompleted = true;
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Scan complete. Found %u matching devices.\n", (unsigned)deviceList.size());
+  if (deviceList.size() == 0) {
+    consoleOut.printf("No devices found with prefix '%s'. Restarting scan...\n", TARGET_DEVICE_PREFIX);
+    consoleOut.flush();
+    rescanAtMs = millis() + SCAN_RETRY_MS;
+    rescanDue = true;
+    return;
+  }
+  consoleOut.flush();
+  // Display the devices and wait for user input
+  displayFoundDevices();
+}
+
 void setup() {
+  Serial.setTxBufferSize(OUTPUT_BUFFER_SIZE);  // Whole output blocks queue without blocking
   Serial.begin(115200);
   esp_log_level_set("*", ESP_LOG_NONE);
+  // Typed input wakes loop() straight from the UART driver
+  loopEvents.begin();
+  notifyDispatcher.begin();
+  Serial.onReceive([]() { loopEvents.signal(LOOP_EVENT_INPUT); });
+  commandConsole.begin(consoleCommands, sizeof(consoleCommands) / sizeof(consoleCommands[0]), cmdSelect);
   
   Serial.println("\nBLE Scanner with User Selection");
   Serial.println("==============================");
   
+  expectations.compile(nullptr, 0);
+  telemetryLog.begin();
+
   BLEDevice::init("ESP32");
+  bondStore.begin();
+  deviceList.begin();
+  gattWorker.begin(runGattJob, onSessionRecord);
   pBLEScan = BLEDevice::getScan();
   pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
   pBLEScan->setActiveScan(true);
@@ -443,20 +1279,98 @@ void setup() {
 }
 
 void loop() {
-  // Process user input if waiting for a selection
-  if (waitingForUserInput) {
-    processUserSelection();
+  uint32_t passStart = micros();
+
+  // Commands and RPC frames from the console
+  commandConsole.poll();
+
+  // News from the scan: devices heard for the first time, the scan running its full time,
+  // or the pause after an empty one being over
+  printFoundDevices();
+  if (scanEnded.exchange(false)) {
+    endScan();
+    loopEvents.handled(LOOP_EVENT_SCAN);
   }
+  if (rescanDue && (int32_t)(millis() - rescanAtMs) >= 0) startScan();
+
+  // The unit a pending connect waits for has advertised, or the scan ended without it
+  if (pendingConnect.armed && (pendingConnect.heard || scanCompleted)) {
+    pendingConnect.armed = false;
+    BLEAdvertisedDevice device;
+    bool heard = false;
+    if (pendingConnect.heard) {
+      stopScan();
+      heard = deviceList.find(pendingConnect.address, &device);
+    }
+    if (heard) {
+      uint8_t status = startSession(device, GATT_JOB_CONNECT_ONLY, pendingConnect.chosenMs);
+      if (status != STATUS_PENDING) commandConsole.complete(status);
+    } else {
+      consoleOut.begin(OUT_QUIET);
+      consoleOut.printf("%s was not heard during the scan\n", pendingConnect.address.c_str());
+      consoleOut.flush();
+      commandConsole.complete(STATUS_NOT_FOUND);
+    }
+    loopEvents.handled(LOOP_EVENT_TARGET);
+  }
+
+  // Monitoring: the next batch goes to the GATT task once it is due and the last one is done
+  if (!pollPosted && pollScheduler.due()) {
+    GattJob job;
+    job.type = JOB_POLL;
+    pollPosted = gattWorker.post(job);
+  }
+
+  // Results from the GATT task: decode, evaluate, log and print them here. A full budget
+  // means more may be queued, so the next wait returns at once.
+  size_t records = gattWorker.poll();
+  if (records == SESSION_RECORD_DEPTH) loopEvents.signal(LOOP_EVENT_RECORD);
   
-  // Handle disconnection
-  if (isConnected && pClient && !pClient->isConnected()) {
-    isConnected = false;
-    pClient->disconnect();
-    delete pClient;
-    pClient = nullptr;
-    Serial.println("Device disconnected. Restarting scan...");
-    startScan();
+  // Hand queued notifications to their handlers
+  if (notifyDispatcher.poll() == NOTIFY_POLL_BUDGET) loopEvents.signal(LOOP_EVENT_NOTIFY);
+
+  // Move queued log records to flash, one bounded slice per pass
+  telemetryLog.service();
+
+  // The client belongs to the GATT task while it has work; the rest waits for it
+  if (gattWorker.idle()) {
+    // Advance a running battery capture (polling, periodic summaries, final report)
+    batteryTrend.update(pClient && pClient->isConnected());
+
+    // Advance a running thermal profile; the series can be printed or the run ended on demand
+    thermalProfile.update(pClient && pClient->isConnected());
+
+    // Handle disconnection
+    if (linkLost) {
+      linkLost = false;
+      isConnected = false;
+      if (pollScheduler.active()) {
+        progress("Monitor: link lost\n");
+        endMonitor();
+      }
+      if (pClient) {
+        clientPool.release(pClient);
+        pClient = nullptr;
+      }
+      endSessionData();
+      notifyDispatcher.reset();
+      progress("Device disconnected. Restarting scan...\n");
+      startScan();
+      // Whatever the console was waiting for died with the link
+      commandConsole.complete(STATUS_GATT_ERROR);
+      loopEvents.handled(LOOP_EVENT_DISCONNECT);
+    }
   }
 
-  delay(100); // shorter delay for more responsive input processing
+  gattWorker.accountLoop(micros() - passStart);
+
+  // Sleep until a callback, the UART or the GATT task signals; captures and pending log
+  // records bound the wait so their periodic work still runs on time
+  bool capturing = gattWorker.idle() && (batteryTrend.active() || thermalProfile.active());
+  bool periodic = capturing || telemetryLog.backlog();
+  uint32_t waitMs = periodic ? LOOP_TICK_MS : LOOP_IDLE_WAIT_MS;
+  // A monitoring run wakes for its next batch exactly; a batch in flight signals when done
+  if (pollScheduler.active() && !pollPosted) waitMs = std::min(waitMs, pollScheduler.msUntilDue());
+  if (rescanDue) waitMs = std::min<uint32_t>(waitMs, std::max<int32_t>(0, rescanAtMs - millis()));
+  loopEvents.wait(waitMs);
 }
\ No newline at end of file
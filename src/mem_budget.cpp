@@ -0,0 +1,152 @@
+#include "mem_budget.h"
+#include "output.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+MemCounters memCounters[MEM_TAG_COUNT];
+int32_t memBudgetBytes[MEM_TAG_COUNT] = {0, 16 * 1024, 48 * 1024, 8 * 1024, 8 * 1024};
+
+static const char* memTagNames[MEM_TAG_COUNT] = {"other", "scan", "gatt", "decode", "output"};
+
+// Tag of the running task; FreeRTOS tasks each get their own copy
+static __thread uint8_t activeTag = MEM_OTHER;
+
+MemTag currentMemTag() {
+  return (MemTag)activeTag;
+}
+
+static uint32_t freeHeap() {
+#ifdef ARDUINO
+  return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+  return 0;
+#endif
+}
+
+void memHeapInfo(uint32_t& freeBytes, uint32_t& minFreeBytes, uint32_t& largestBlock) {
+#ifdef ARDUINO
+  freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#else
+  freeBytes = minFreeBytes = largestBlock = 0;
+#endif
+}
+
+MemScope::MemScope(MemTag tag) : previous((MemTag)activeTag), heapAtEntry(freeHeap()) {
+  activeTag = tag;
+}
+
+MemScope::~MemScope() {
+  // Heap consumed while the scope was open (negative when it released memory)
+  memCounters[activeTag].heapDelta += (int32_t)(heapAtEntry - freeHeap());
+  activeTag = previous;
+}
+
+#ifndef MEM_BUDGET_DISABLE
+
+// Every operator new carries a small header recording its size and tag, so delete can
+// credit the right subsystem. The header keeps the payload maximally aligned.
+struct AllocHeader {
+  uint32_t size;
+  uint8_t tag;
+};
+static const size_t ALLOC_HEADER_SIZE =
+  (sizeof(AllocHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+static void* trackedAlloc(size_t size) {
+  uint8_t* block = static_cast<uint8_t*>(malloc(size + ALLOC_HEADER_SIZE));
+  if (!block) return nullptr;
+
+  AllocHeader* header = reinterpret_cast<AllocHeader*>(block);
+  header->size = size;
+  header->tag = activeTag;
+
+  MemCounters& counters = memCounters[header->tag];
+  int32_t live = counters.liveBytes += size;
+  counters.allocs++;
+  counters.allocBytes += size;
+  int32_t peak = counters.peakBytes.load();
+  while (live > peak && !counters.peakBytes.compare_exchange_weak(peak, live)) {
+  }
+  return block + ALLOC_HEADER_SIZE;
+}
+
+static void trackedFree(void* pointer) {
+  if (!pointer) return;
+  uint8_t* block = static_cast<uint8_t*>(pointer) - ALLOC_HEADER_SIZE;
+  AllocHeader* header = reinterpret_cast<AllocHeader*>(block);
+  MemCounters& counters = memCounters[header->tag];
+  counters.liveBytes -= header->size;
+  counters.frees++;
+  free(block);
+}
+
+void* operator new(size_t size) {
+  void* pointer = trackedAlloc(size);
+  if (!pointer) abort();
+  return pointer;
+}
+
+void* operator new[](size_t size) {
+  void* pointer = trackedAlloc(size);
+  if (!pointer) abort();
+  return pointer;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return trackedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return trackedAlloc(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  trackedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  trackedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  trackedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  trackedFree(pointer);
+}
+
+#endif  // MEM_BUDGET_DISABLE
+
+void printMemReport() {
+  uint32_t freeBytes, minFreeBytes, largestBlock;
+  memHeapInfo(freeBytes, minFreeBytes, largestBlock);
+
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.print("\n===== Memory =====\n"
+                   "Subsystem | Live B | Peak B | Budget B | Allocs | Frees | Heap delta B\n");
+  for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+    MemCounters& counters = memCounters[tag];
+    int32_t budget = memBudgetBytes[tag];
+    bool over = budget > 0 && counters.peakBytes.load() > budget;
+    consoleOut.printf("%-9s | %6ld | %6ld | %8ld | %6lu | %5lu | %ld%s\n", memTagNames[tag],
+                      (long)counters.liveBytes.load(), (long)counters.peakBytes.load(), (long)budget,
+                      (unsigned long)counters.allocs.load(), (unsigned long)counters.frees.load(),
+                      (long)counters.heapDelta.load(), over ? "  OVER BUDGET" : "");
+  }
+  if (freeBytes) {
+    // Fragmentation: share of free heap not usable as one block
+    unsigned fragmentation = 100 - (unsigned)((uint64_t)largestBlock * 100 / freeBytes);
+    consoleOut.printf("Heap free %lu B, min free %lu B, largest block %lu B, fragmentation %u%%\n",
+                      (unsigned long)freeBytes, (unsigned long)minFreeBytes, (unsigned long)largestBlock,
+                      fragmentation);
+  }
+  consoleOut.flush();
+}
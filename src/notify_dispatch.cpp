@@ -0,0 +1,146 @@
+#include "notify_dispatch.h"
+#include "loop_events.h"
+#include "output.h"
+
+NotifyDispatcher notifyDispatcher;
+
+static const uint8_t NO_SLOT = 0xFF;
+
+NotifyDispatcher::NotifyDispatcher() {
+  for (auto& index : slotByHandle) index.store(NO_SLOT, std::memory_order_relaxed);
+}
+
+void NotifyDispatcher::begin() {
+  if (!mutex) mutex = xSemaphoreCreateMutex();
+}
+
+void NotifyDispatcher::lock() {
+  if (mutex) xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+void NotifyDispatcher::unlock() {
+  if (mutex) xSemaphoreGive(mutex);
+}
+
+void NotifyDispatcher::onNotify(BLERemoteCharacteristic* pChar, uint8_t* data, size_t length, bool) {
+  uint32_t stamp = micros();
+  uint16_t handle = pChar->getHandle();
+  if (handle >= NOTIFY_MAX_HANDLE) return;
+  uint8_t index = notifyDispatcher.slotByHandle[handle].load(std::memory_order_acquire);
+  if (index == NO_SLOT) return;
+
+  NotifyEvent event;
+  event.stampUs = stamp;
+  event.length = std::min<size_t>(length, NOTIFY_MAX_VALUE);
+  memcpy(event.data, data, event.length);
+
+  Slot& slot = notifyDispatcher.slots[index];
+  slot.received++;
+  if (!slot.queue.push(event)) {
+    slot.dropped++;
+    return;
+  }
+  loopEvents.signal(LOOP_EVENT_NOTIFY);
+}
+
+bool NotifyDispatcher::subscribe(BLERemoteCharacteristic* pChar, NotifyHandler handler) {
+  uint16_t handle = pChar->getHandle();
+  if (handle >= NOTIFY_MAX_HANDLE || (!pChar->canNotify() && !pChar->canIndicate())) return false;
+
+  lock();
+  uint8_t index = slotByHandle[handle].load(std::memory_order_relaxed);
+  if (index != NO_SLOT) {
+    // Events queued for the old handler are not the new one's to see
+    slots[index].handler = handler;
+    slots[index].queue.clear();
+    unlock();
+    return true;
+  }
+  index = slotCount.load(std::memory_order_relaxed);
+  if (index >= NOTIFY_MAX_SLOTS) {
+    unlock();
+    return false;
+  }
+
+  Slot& slot = slots[index];
+  slot.characteristic = pChar;
+  slot.handler = handler;
+  slot.queue.clear();
+  slot.received = 0;
+  slot.dropped = 0;
+  slot.delivered = 0;
+  slot.latencyMaxUs = 0;
+  slot.latencySumUs = 0;
+  // Publish the slot before the CCCD write can make the peer start sending
+  slotCount.store(index + 1, std::memory_order_release);
+  slotByHandle[handle].store(index, std::memory_order_release);
+  unlock();
+
+  pChar->registerForNotify(onNotify, pChar->canNotify());
+  return true;
+}
+
+void NotifyDispatcher::unsubscribe(BLERemoteCharacteristic* pChar) {
+  uint16_t handle = pChar->getHandle();
+  if (handle >= NOTIFY_MAX_HANDLE) return;
+  uint8_t index = slotByHandle[handle].load(std::memory_order_acquire);
+  if (index == NO_SLOT) return;
+
+  pChar->registerForNotify(nullptr);
+  // The slot stays allocated until reset(); it just stops receiving
+  lock();
+  Slot& slot = slots[index];
+  slot.handler = nullptr;
+  slotByHandle[handle].store(NO_SLOT, std::memory_order_release);
+  slot.queue.clear();
+  unlock();
+}
+
+void NotifyDispatcher::reset() {
+  lock();
+  for (auto& index : slotByHandle) index.store(NO_SLOT, std::memory_order_release);
+  uint8_t count = slotCount.load(std::memory_order_relaxed);
+  for (uint8_t i = 0; i < count; i++) {
+    slots[i].handler = nullptr;
+    slots[i].queue.clear();
+  }
+  slotCount.store(0, std::memory_order_release);
+  unlock();
+}
+
+size_t NotifyDispatcher::poll(size_t budget) {
+  size_t delivered = 0;
+  NotifyEvent event;
+  lock();
+  uint8_t count = slotCount.load(std::memory_order_acquire);
+  for (uint8_t i = 0; i < count && delivered < budget; i++) {
+    Slot& slot = slots[i];
+    while (delivered < budget && slot.queue.pop(event)) {
+      uint32_t latency = micros() - event.stampUs;
+      slot.delivered++;
+      slot.latencySumUs += latency;
+      if (latency > slot.latencyMaxUs) slot.latencyMaxUs = latency;
+      if (slot.handler) slot.handler(slot.characteristic, event);
+      delivered++;
+    }
+  }
+  unlock();
+  return delivered;
+}
+
+void NotifyDispatcher::printStats() {
+  uint8_t count = slotCount.load(std::memory_order_acquire);
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("\n===== Notifications (%u subscribed) =====\n"
+                    "Handle | UUID                                 | Recv   | Drop  | Avg us | Max us\n",
+                    (unsigned)count);
+  for (uint8_t i = 0; i < count; i++) {
+    Slot& slot = slots[i];
+    uint32_t average = slot.delivered ? (uint32_t)(slot.latencySumUs / slot.delivered) : 0;
+    consoleOut.printf("%6u | %-36s | %6lu | %5lu | %6lu | %6lu\n", (unsigned)slot.characteristic->getHandle(),
+                      slot.characteristic->getUUID().toString().c_str(), (unsigned long)slot.received.load(),
+                      (unsigned long)slot.dropped.load(), (unsigned long)average,
+                      (unsigned long)slot.latencyMaxUs);
+  }
+  consoleOut.flush();
+}
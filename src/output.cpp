@@ -0,0 +1,152 @@
+#include "output.h"
+
+OutputLevel outputLevel = OUT_NORMAL;
+
+static char consoleStorage[OUTPUT_BUFFER_SIZE];
+OutputBuffer consoleOut(consoleStorage, sizeof(consoleStorage));
+
+size_t outputFormat(char* dst, size_t capacity, const char* format, va_list args) {
+  size_t len = 0;
+  auto put = [&](char c) {
+    if (len < capacity) dst[len] = c;
+    len++;
+  };
+
+  for (const char* p = format; *p; p++) {
+    if (*p != '%') {
+      put(*p);
+      continue;
+    }
+    p++;
+    if (*p == '\0') break;
+    if (*p == '%') {
+      put('%');
+      continue;
+    }
+
+    bool leftAlign = false;
+    char pad = ' ';
+    for (; *p == '-' || *p == '0'; p++) {
+      if (*p == '-') leftAlign = true;
+      else pad = '0';
+    }
+    size_t width = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      width = width * 10 + (*p - '0');
+    }
+    bool isLong = false;
+    if (*p == 'l') {
+      isLong = true;
+      p++;
+    }
+    if (*p == '\0') break;  // format ends inside a conversion
+
+    // Render the conversion into `text`/`textLen`
+    char digits[24];
+    const char* text = digits;
+    size_t textLen = 0;
+    bool negative = false;
+
+    switch (*p) {
+      case 's': {
+        text = va_arg(args, const char*);
+        if (!text) text = "(null)";
+        textLen = strlen(text);
+        break;
+      }
+      case 'c':
+        digits[0] = (char)va_arg(args, int);
+        textLen = 1;
+        break;
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'x':
+      case 'X': {
+        unsigned long value;
+        if (*p == 'd' || *p == 'i') {
+          long v = isLong ? va_arg(args, long) : va_arg(args, int);
+          negative = v < 0;
+          value = negative ? 0UL - (unsigned long)v : (unsigned long)v;
+        } else {
+          value = isLong ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+        }
+        unsigned base = (*p == 'x' || *p == 'X') ? 16 : 10;
+        const char* alphabet = (*p == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+        char* end = digits + sizeof(digits);
+        char* cursor = end;
+        do {
+          *--cursor = alphabet[value % base];
+          value /= base;
+        } while (value);
+        text = cursor;
+        textLen = end - cursor;
+        break;
+      }
+      default:
+        // Unknown conversion: emit it verbatim so the mistake is visible
+        put('%');
+        put(*p);
+        continue;
+    }
+
+    size_t total = textLen + (negative ? 1 : 0);
+    size_t fill = width > total ? width - total : 0;
+    if (!leftAlign && pad == ' ') while (fill) { put(' '); fill--; }
+    if (negative) put('-');
+    if (!leftAlign && pad == '0') while (fill) { put('0'); fill--; }
+    for (size_t i = 0; i < textLen; i++) put(text[i]);
+    while (fill) { put(' '); fill--; }
+  }
+  return len;
+}
+
+OutputBuffer::OutputBuffer(char* storage, size_t capacity)
+  : buffer(storage), capacity(capacity), length(0), active(false) {}
+
+bool OutputBuffer::begin(OutputLevel level) {
+  length = 0;
+  active = outputEnabled(level);
+  return active;
+}
+
+void OutputBuffer::printf(const char* format, ...) {
+  if (!active) return;
+
+  va_list args;
+  va_start(args, format);
+  va_list retry;
+  va_copy(retry, args);
+  size_t needed = outputFormat(buffer + length, capacity - length, format, args);
+  va_end(args);
+
+  if (length + needed > capacity && length > 0) {
+    // Block outgrew the buffer: emit what we have and render this piece again at the start
+    flush();
+    needed = outputFormat(buffer, capacity, format, retry);
+  }
+  va_end(retry);
+  length = std::min(length + needed, capacity);
+}
+
+void OutputBuffer::print(const char* text) {
+  if (!active) return;
+
+  size_t textLen = strlen(text);
+  while (textLen) {
+    if (length == capacity) flush();
+    size_t chunk = std::min(textLen, capacity - length);
+    memcpy(buffer + length, text, chunk);
+    length += chunk;
+    text += chunk;
+    textLen -= chunk;
+  }
+}
+
+void OutputBuffer::flush() {
+  if (length) {
+    Print& out = sink ? *sink : Serial;
+    out.write(reinterpret_cast<const uint8_t*>(buffer), length);
+    length = 0;
+  }
+}
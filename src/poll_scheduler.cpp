@@ -0,0 +1,315 @@
+#include "poll_scheduler.h"
+#include "decode.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "uuids.h"
+#include <esp_gattc_api.h>
+
+PollScheduler pollScheduler;
+
+// Read Multiple completes on the GATTC event handler; the response is copied out of it
+static SemaphoreHandle_t multiDone = nullptr;
+static volatile esp_gatt_status_t multiStatus = ESP_GATT_OK;
+static uint8_t multiValue[512];
+static volatile size_t multiLength = 0;
+
+// Characteristics whose value size the specification fixes, for units that give them no CPF
+struct FixedSize {
+  uint16_t uuid;
+  uint8_t bytes;
+};
+static const FixedSize fixedSizes[] = {
+  {0x2A19, 1},  // Battery Level
+  {0x2A5C, 2},  // CSC Feature
+};
+
+static uint8_t fixedLength(BLEUUID uuid, bool haveCpf, uint8_t format) {
+  if (haveCpf && cpfValueSize(format)) return cpfValueSize(format);
+  for (const FixedSize& fixed : fixedSizes) {
+    if (uuid.equals(BLEUUID(fixed.uuid))) return fixed.bytes;
+  }
+  return 0;
+}
+
+static void pollGattcHandler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                             esp_ble_gattc_cb_param_t* param) {
+  if (event != ESP_GATTC_READ_MULTIPLE_EVT) return;
+  multiStatus = param->read.status;
+  multiLength = std::min<size_t>(param->read.value_len, sizeof(multiValue));
+  memcpy(multiValue, param->read.value, multiLength);
+  xSemaphoreGive(multiDone);
+}
+
+bool PollScheduler::setRate(BLEUUID uuid, uint32_t periodMs) {
+  for (uint8_t i = 0; i < ruleCount; i++) {
+    if (rules[i].uuid.equals(uuid)) {
+      rules[i].periodMs = periodMs;
+      return true;
+    }
+  }
+  if (ruleCount >= POLL_RATE_RULES) return false;
+  rules[ruleCount].uuid = uuid;
+  rules[ruleCount].periodMs = periodMs;
+  ruleCount++;
+  return true;
+}
+
+uint32_t PollScheduler::periodFor(BLEUUID characteristic, BLEUUID service) {
+  for (uint8_t i = 0; i < ruleCount; i++) {
+    if (rules[i].uuid.equals(characteristic)) return rules[i].periodMs;
+  }
+  for (uint8_t i = 0; i < ruleCount; i++) {
+    if (rules[i].uuid.equals(service)) return rules[i].periodMs;
+  }
+  if (service.equals(BATTERY_UUID)) return POLL_BATTERY_MS;
+  if (service.equals(TEMP_UUID)) return POLL_TEMPERATURE_MS;
+  if (service.equals(CSCP_UUID)) return POLL_CSC_MS;
+  if (service.equals(USER_UUID)) return POLL_USER_MS;
+  return 0;
+}
+
+void PollScheduler::printRates() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Poll periods: battery %lu ms, temperature %lu ms, csc %lu ms, user %lu ms\n",
+                    (unsigned long)periodFor(BLEUUID(), BATTERY_UUID),
+                    (unsigned long)periodFor(BLEUUID(), TEMP_UUID),
+                    (unsigned long)periodFor(BLEUUID(), CSCP_UUID),
+                    (unsigned long)periodFor(BLEUUID(), USER_UUID));
+  for (uint8_t i = 0; i < ruleCount; i++) {
+    consoleOut.printf("  %s: %lu ms\n", rules[i].uuid.toString().c_str(), (unsigned long)rules[i].periodMs);
+  }
+  consoleOut.flush();
+}
+
+bool PollScheduler::start(BLEClient* pollClient) {
+  if (!multiDone) {
+    multiDone = xSemaphoreCreateBinary();
+    addGattcHandler(pollGattcHandler);
+  }
+  running = false;
+  client = pollClient;
+  entryCount = 0;
+  batches = 0;
+  readMultiples = 0;
+  coalescedReads = 0;
+  singleReads = 0;
+
+  auto services = client->getServices();
+  if (services) {
+    for (auto& service : *services) {
+      BLEUUID serviceUUID = service.second->getUUID();
+      for (auto& chr : *service.second->getCharacteristics()) {
+        BLERemoteCharacteristic* pChar = chr.second;
+        if (!pChar->canRead() || entryCount >= POLL_MAX_ENTRIES) continue;
+        uint32_t periodMs = periodFor(pChar->getUUID(), serviceUUID);
+        if (periodMs == 0) continue;
+
+        Entry& entry = entries[entryCount++];
+        entry = Entry();
+        entry.characteristic = pChar;
+        entry.uuid = pChar->getUUID();
+        entry.handle = pChar->getHandle();
+        entry.periodMs = periodMs;
+        entry.unit = 0x2700;
+        entry.haveCpf = readCpf(pChar, entry.format, entry.exponent, entry.unit);
+        entry.fixedLength = fixedLength(entry.uuid, entry.haveCpf, entry.format);
+      }
+    }
+  }
+  if (entryCount == 0) {
+    gattWorker.print(OUT_QUIET, "Monitor: nothing to poll\n");
+    return false;
+  }
+
+  // Everything is read once straight away
+  memset(wheel, -1, sizeof(wheel));
+  wheelTick = 0;
+  startMs = millis();
+  for (uint8_t i = 0; i < entryCount; i++) schedule(i, 0);
+  updateNextDue();
+  running = true;
+  gattWorker.print(OUT_QUIET, "Monitor: polling %u characteristic(s); 'monitor report' or 'monitor stop'\n", entryCount);
+  return true;
+}
+
+// Due times are kept in ms and rounded up to a tick, so periods that are not a whole
+// number of ticks do not drift
+void PollScheduler::schedule(int8_t index, uint32_t dueMs) {
+  Entry& entry = entries[index];
+  uint32_t tick = std::max((dueMs + POLL_TICK_MS - 1) / POLL_TICK_MS, wheelTick);
+  uint32_t slot = tick % POLL_WHEEL_SLOTS;
+  entry.dueMs = dueMs;
+  entry.dueTick = tick;
+  entry.rounds = (tick - wheelTick) / POLL_WHEEL_SLOTS;
+  entry.next = wheel[slot];
+  wheel[slot] = index;
+}
+
+void PollScheduler::updateNextDue() {
+  uint32_t earliest = UINT32_MAX;
+  for (uint8_t i = 0; i < entryCount; i++) earliest = std::min(earliest, entries[i].dueTick);
+  nextDueMs = startMs + earliest * POLL_TICK_MS;
+}
+
+uint32_t PollScheduler::msUntilDue() const {
+  int32_t left = (int32_t)(nextDueMs.load() - millis());
+  return left > 0 ? left : 0;
+}
+
+void PollScheduler::runDue() {
+  if (!running) return;
+  uint32_t nowTick = (millis() - startMs) / POLL_TICK_MS;
+
+  // Unlink everything whose slot comes round with no turns left
+  int8_t batch[POLL_MAX_ENTRIES];
+  uint8_t count = 0;
+  for (; wheelTick <= nowTick; wheelTick++) {
+    int8_t* link = &wheel[wheelTick % POLL_WHEEL_SLOTS];
+    while (*link >= 0) {
+      Entry& entry = entries[*link];
+      if (entry.rounds) {
+        entry.rounds--;
+        link = &entry.next;
+      } else {
+        batch[count++] = *link;
+        *link = entry.next;
+      }
+    }
+  }
+  if (count == 0) return;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (entries[batch[i]].dueTick < nowTick) entries[batch[i]].late++;
+  }
+  readBatch(batch, count);
+  batches++;
+
+  // Next reads keep to the period's grid; periods missed while a batch ran long are
+  // skipped rather than read back to back
+  uint32_t elapsedMs = millis() - startMs;
+  for (uint8_t i = 0; i < count; i++) {
+    Entry& entry = entries[batch[i]];
+    uint32_t nextMs = entry.dueMs + entry.periodMs;
+    if ((int32_t)(elapsedMs - nextMs) > 0) nextMs += ((elapsedMs - nextMs) / entry.periodMs + 1) * entry.periodMs;
+    schedule(batch[i], nextMs);
+  }
+  updateNextDue();
+}
+
+void PollScheduler::readSingle(Entry& entry) {
+  std::string value = entry.characteristic->readValue();
+  singleReads++;
+  if (value.empty()) entry.errors++;
+  else deliver(entry, reinterpret_cast<const uint8_t*>(value.data()), value.size(), millis());
+}
+
+void PollScheduler::readBatch(int8_t* batch, uint8_t count) {
+  // Handle order, so adjacent attributes end up in the same Read Multiple
+  for (uint8_t i = 1; i < count; i++) {
+    for (uint8_t j = i; j > 0 && entries[batch[j]].handle < entries[batch[j - 1]].handle; j--) {
+      std::swap(batch[j], batch[j - 1]);
+    }
+  }
+
+  // The response is cut at MTU - 1 and carries no lengths, so only values whose length
+  // cannot change go in a group
+  size_t capacity = client->getMTU() - 1;
+  int8_t group[ESP_GATT_MAX_READ_MULTI_HANDLES];
+  uint8_t grouped = 0;
+  size_t groupBytes = 0;
+  for (uint8_t i = 0; i <= count; i++) {
+    if (!client->isConnected()) return;  // loop() ends the run on the disconnect
+    Entry* entry = i < count ? &entries[batch[i]] : nullptr;
+    bool fits = entry && entry->fixedLength && grouped < ESP_GATT_MAX_READ_MULTI_HANDLES &&
+                groupBytes + entry->fixedLength <= capacity;
+    if (!fits && grouped) {
+      if (grouped == 1 || !readMultiple(group, grouped)) {
+        for (uint8_t g = 0; g < grouped; g++) readSingle(entries[group[g]]);
+      }
+      grouped = 0;
+      groupBytes = 0;
+      fits = entry && entry->fixedLength;
+    }
+    if (!entry) break;
+    if (fits) {
+      group[grouped++] = batch[i];
+      groupBytes += entry->fixedLength;
+    } else {
+      readSingle(*entry);
+    }
+  }
+}
+
+bool PollScheduler::readMultiple(int8_t* group, uint8_t count) {
+  esp_gattc_multi_t request;
+  request.num_attr = count;
+  size_t expected = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    request.handles[i] = entries[group[i]].handle;
+    expected += entries[group[i]].fixedLength;
+  }
+
+  xSemaphoreTake(multiDone, 0);  // a completion nobody waited for
+  if (esp_ble_gattc_read_multiple(client->getGattcIf(), client->getConnId(), &request,
+                                  ESP_GATT_AUTH_REQ_NONE) != ESP_OK) {
+    return false;
+  }
+  // A length mismatch means a unit does not keep to the size; the values are read singly
+  if (xSemaphoreTake(multiDone, pdMS_TO_TICKS(POLL_READ_TIMEOUT_MS)) != pdTRUE || multiStatus != ESP_GATT_OK ||
+      multiLength != expected) {
+    return false;
+  }
+
+  readMultiples++;
+  coalescedReads += count;
+  uint32_t arrivedMs = millis();
+  size_t offset = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    Entry& entry = entries[group[i]];
+    deliver(entry, multiValue + offset, entry.fixedLength, arrivedMs);
+    offset += entry.fixedLength;
+  }
+  return true;
+}
+
+void PollScheduler::deliver(Entry& entry, const uint8_t* data, size_t length, uint32_t nowMs) {
+  if (entry.reads) entry.intervalSumMs += nowMs - entry.lastReadMs;
+  entry.reads++;
+  entry.lastReadMs = nowMs;
+
+  SessionRecord record;
+  record.type = RECORD_POLL;
+  record.uuid = entry.uuid;
+  record.handle = entry.handle;
+  record.flag = true;
+  record.haveCpf = entry.haveCpf;
+  record.format = entry.format;
+  record.exponent = entry.exponent;
+  record.unit = entry.unit;
+  record.length = length;
+  memcpy(record.data, data, std::min<size_t>(length, SESSION_RECORD_MAX_VALUE));
+  gattWorker.publish(record);
+}
+
+void PollScheduler::stop() {
+  if (!running) return;
+  running = false;
+  printStats();
+  client = nullptr;
+}
+
+void PollScheduler::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Monitor over %lu s: %lu batches, %lu Read Multiple carrying %lu values, %lu single reads\n",
+                    (unsigned long)((millis() - startMs) / 1000), (unsigned long)batches,
+                    (unsigned long)readMultiples, (unsigned long)coalescedReads, (unsigned long)singleReads);
+  consoleOut.print("Characteristic                       | Period ms | Avg ms | Reads | Errors | Late\n");
+  for (uint8_t i = 0; i < entryCount; i++) {
+    Entry& entry = entries[i];
+    uint32_t averageMs = entry.reads > 1 ? entry.intervalSumMs / (entry.reads - 1) : 0;
+    consoleOut.printf("%-36s | %9lu | %6lu | %5lu | %6lu | %4lu\n", entry.uuid.toString().c_str(),
+                      (unsigned long)entry.periodMs, (unsigned long)averageMs,
+                      (unsigned long)entry.reads, (unsigned long)entry.errors, (unsigned long)entry.late);
+  }
+  consoleOut.flush();
+}
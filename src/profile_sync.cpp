@@ -0,0 +1,160 @@
+#include "profile_sync.h"
+#include "output.h"
+#include "uuids.h"
+#include "gatt_worker.h"
+#include <esp_gattc_api.h>
+
+ProfileSync profileSync;
+
+// The same attribute on another unit: same handle, and still the same UUID there
+static BLERemoteCharacteristic* findEntry(BLERemoteService* service, const ProfileEntry& entry) {
+  auto characteristics = service->getCharacteristicsByHandle();
+  auto found = characteristics->find(entry.handle);
+  if (found == characteristics->end() || !found->second->getUUID().equals(entry.uuid)) return nullptr;
+  return found->second;
+}
+
+// Completion of Prepare/Execute Write arrives on the GATTC event handler
+static SemaphoreHandle_t longWriteDone = nullptr;
+static volatile esp_gatt_status_t longWriteStatus = ESP_GATT_OK;
+
+static void profileGattcHandler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                esp_ble_gattc_cb_param_t* param) {
+  if (event == ESP_GATTC_PREP_WRITE_EVT) {
+    longWriteStatus = param->write.status;
+    xSemaphoreGive(longWriteDone);
+  } else if (event == ESP_GATTC_EXEC_EVT) {
+    longWriteStatus = param->exec_cmpl.status;
+    xSemaphoreGive(longWriteDone);
+  }
+}
+
+// A completion that arrived after an earlier timeout must not answer the next request
+static void drainLongWrite() {
+  xSemaphoreTake(longWriteDone, 0);
+}
+
+static bool waitLongWrite() {
+  return xSemaphoreTake(longWriteDone, pdMS_TO_TICKS(PROFILE_WRITE_TIMEOUT_MS)) == pdTRUE &&
+         longWriteStatus == ESP_GATT_OK;
+}
+
+size_t ProfileSync::capture(BLEClient* client) {
+  desired.clear();
+  BLERemoteService* user = client->getService(USER_UUID);
+  if (!user) {
+    gattWorker.print(OUT_QUIET, "Profile capture: User Service not found\n");
+    return 0;
+  }
+
+  for (auto& chr : *user->getCharacteristicsByHandle()) {
+    BLERemoteCharacteristic* pChar = chr.second;
+    if (!pChar->canRead() || !pChar->canWrite()) continue;
+    ProfileEntry entry;
+    entry.uuid = pChar->getUUID();
+    entry.handle = pChar->getHandle();
+    entry.value = pChar->readValue();
+    desired.push_back(entry);
+  }
+  gattWorker.print(OUT_QUIET, "Profile capture: %u writable characteristic(s) stored\n", (unsigned)desired.size());
+  return desired.size();
+}
+
+bool ProfileSync::longWrite(BLEClient* client,
+                            std::vector<std::pair<BLERemoteCharacteristic*, const std::string*>>& writes) {
+  if (!longWriteDone) {
+    longWriteDone = xSemaphoreCreateBinary();
+    addGattcHandler(profileGattcHandler);
+  }
+
+  // Prepare Write carries handle and offset, leaving MTU - 5 bytes of value per request
+  size_t chunk = client->getMTU() - 5;
+  for (auto& write : writes) {
+    const std::string& value = *write.second;
+    for (size_t offset = 0; offset < value.size(); offset += chunk) {
+      uint16_t length = std::min(chunk, value.size() - offset);
+      drainLongWrite();
+      esp_err_t err = esp_ble_gattc_prepare_write(client->getGattcIf(), client->getConnId(),
+                                                  write.first->getHandle(), offset, length,
+                                                  (uint8_t*)value.data() + offset, ESP_GATT_AUTH_REQ_NONE);
+      if (err != ESP_OK || !waitLongWrite()) {
+        // Drop whatever the server has queued so no partial value is committed
+        drainLongWrite();
+        esp_ble_gattc_execute_write(client->getGattcIf(), client->getConnId(), false);
+        waitLongWrite();
+        return false;
+      }
+    }
+  }
+
+  drainLongWrite();
+  return esp_ble_gattc_execute_write(client->getGattcIf(), client->getConnId(), true) == ESP_OK &&
+         waitLongWrite();
+}
+
+bool ProfileSync::sync(BLEClient* client) {
+  report.valid = false;
+  if (desired.empty()) {
+    gattWorker.print(OUT_QUIET, "Profile sync: no profile captured\n");
+    return false;
+  }
+  BLERemoteService* user = client->getService(USER_UUID);
+  if (!user) {
+    gattWorker.print(OUT_QUIET, "Profile sync: User Service not found\n");
+    return false;
+  }
+
+  size_t shortLimit = client->getMTU() - 3;
+  size_t differing = 0, written = 0, bytes = 0, missing = 0;
+  std::vector<std::pair<BLERemoteCharacteristic*, const std::string*>> longWrites;
+  std::vector<std::pair<BLERemoteCharacteristic*, const std::string*>> toVerify;
+
+  for (auto& entry : desired) {
+    BLERemoteCharacteristic* pChar = findEntry(user, entry);
+    if (!pChar || !pChar->canWrite()) {
+      missing++;
+      continue;
+    }
+    if (pChar->canRead() && pChar->readValue() == entry.value) continue;
+
+    differing++;
+    bytes += entry.value.size();
+    toVerify.push_back(std::make_pair(pChar, &entry.value));
+    if (entry.value.size() > shortLimit) {
+      longWrites.push_back(std::make_pair(pChar, &entry.value));
+    } else {
+      pChar->writeValue((uint8_t*)entry.value.data(), entry.value.size(), true);
+      written++;
+    }
+  }
+
+  bool longOk = longWrites.empty() || longWrite(client, longWrites);
+  if (longOk) written += longWrites.size();
+
+  size_t verifyFailures = 0;
+  for (auto& write : toVerify) {
+    if (write.first->canRead() && write.first->readValue() != *write.second) verifyFailures++;
+  }
+
+  bool ok = longOk && missing == 0 && verifyFailures == 0;
+  report.ok = ok;
+  report.checked = desired.size();
+  report.differing = differing;
+  report.written = written;
+  report.bytes = bytes;
+  report.longWrites = longWrites.size();
+  report.missing = missing;
+  report.verifyFailures = verifyFailures;
+  report.valid = true;
+  return ok;
+}
+
+void ProfileSync::printReport() {
+  if (!report.valid) return;
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Profile sync %s: %u checked, %u differ, %u written (%u bytes, %u long), %u missing, %u verify failures\n",
+                    report.ok ? "OK" : "FAILED", (unsigned)report.checked, (unsigned)report.differing,
+                    (unsigned)report.written, (unsigned)report.bytes, (unsigned)report.longWrites,
+                    (unsigned)report.missing, (unsigned)report.verifyFailures);
+  consoleOut.flush();
+}
@@ -0,0 +1,108 @@
+#include "rpa_resolver.h"
+#include "output.h"
+#include <mbedtls/aes.h>
+
+RpaResolver rpaResolver;
+
+void RpaResolver::begin() {
+  if (!mutex) mutex = xSemaphoreCreateMutex();
+}
+
+void RpaResolver::lock() {
+  if (mutex) xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+void RpaResolver::unlock() {
+  if (mutex) xSemaphoreGive(mutex);
+}
+
+void RpaResolver::setKey(const uint8_t* identity, const uint8_t* irk) {
+  lock();
+  size_t index = 0;
+  while (index < keyCount && memcmp(keys[index].identity, identity, 6) != 0) index++;
+  if (index == keyCount && keyCount < RPA_MAX_KEYS) keyCount++;
+  if (index < keyCount) {
+    memcpy(keys[index].identity, identity, 6);
+    for (int i = 0; i < 16; i++) keys[index].irk[i] = irk[15 - i];
+    generation++;
+  }
+  unlock();
+}
+
+void RpaResolver::removeKey(const uint8_t* identity) {
+  lock();
+  for (size_t i = keyCount; i-- > 0;) {
+    if (identity && memcmp(keys[i].identity, identity, 6) != 0) continue;
+    keys[i] = keys[--keyCount];
+    generation++;
+  }
+  unlock();
+}
+
+// ah(IRK, prand) = e(IRK, 0^104 | prand) mod 2^24
+bool RpaResolver::matches(const Key& key, const uint8_t* address) {
+  uint8_t block[16] = {0};
+  memcpy(block + 13, address, 3);
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, key.irk, 128);
+  mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, block, block);
+  mbedtls_aes_free(&aes);
+  aesBlocks++;
+  return memcmp(block + 13, address + 3, 3) == 0;
+}
+
+bool RpaResolver::resolve(const uint8_t* address, uint8_t* identity) {
+  if (!resolvable(address)) return false;
+  lock();
+  lookups++;
+  // The hash half is an AES output, so it spreads addresses evenly over the slots
+  size_t start = (address[3] ^ address[4] ^ address[5]) % RPA_CACHE_SLOTS;
+  CacheSlot* slot = nullptr;
+  CacheSlot* victim = nullptr;
+  uint32_t victimAge = 0;
+  for (size_t probe = 0; probe < RPA_CACHE_PROBES; probe++) {
+    CacheSlot& candidate = cache[(start + probe) % RPA_CACHE_SLOTS];
+    bool current = candidate.generation == generation;
+    if (current && memcmp(candidate.address, address, 6) == 0) {
+      slot = &candidate;
+      break;
+    }
+    // A slot from before the last key change goes first, then the least recently used
+    uint32_t age = current ? candidate.lastUsed : 0;
+    if (!victim || age < victimAge) {
+      victim = &candidate;
+      victimAge = age;
+    }
+  }
+  if (slot) {
+    hits++;
+  } else {
+    slot = victim;
+    memcpy(slot->address, address, 6);
+    slot->generation = generation;
+    slot->key = -1;
+    for (size_t i = 0; i < keyCount; i++) {
+      if (matches(keys[i], address)) {
+        slot->key = i;
+        break;
+      }
+    }
+  }
+  slot->lastUsed = lookups;
+  bool found = slot->key >= 0;
+  if (found) {
+    memcpy(identity, keys[slot->key].identity, 6);
+    resolved++;
+  }
+  unlock();
+  return found;
+}
+
+void RpaResolver::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("RPA resolver: %u key(s), %lu lookup(s), %lu cached, %lu resolved, %lu AES block(s)\n",
+                    (unsigned)keyCount, (unsigned long)lookups, (unsigned long)hits, (unsigned long)resolved,
+                    (unsigned long)aesBlocks);
+  consoleOut.flush();
+}
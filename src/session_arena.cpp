@@ -0,0 +1,47 @@
+#include "session_arena.h"
+#include "output.h"
+
+static uint8_t arenaStorage[SESSION_ARENA_BYTES] __attribute__((aligned(16)));
+SessionArena sessionArena(arenaStorage, sizeof(arenaStorage));
+
+SessionArena::SessionArena(uint8_t* storage, size_t capacity) : base(storage), size(capacity) {}
+
+void* SessionArena::allocate(size_t bytes, size_t align) {
+  size_t start = (offset + align - 1) & ~(align - 1);
+  if (start + bytes <= size) {
+    offset = start + bytes;
+    if (offset > peak) peak = offset;
+    return base + start;
+  }
+
+  // Out of arena: borrow from the heap until the session ends
+  overflowCount++;
+  void* block = malloc(bytes);
+  if (block) overflowBlocks.push_back(block);
+  return block;
+}
+
+char* SessionArena::copy(const void* data, size_t length) {
+  char* text = static_cast<char*>(allocate(length + 1, 1));
+  if (!text) return nullptr;
+  memcpy(text, data, length);
+  text[length] = '\0';
+  return text;
+}
+
+void SessionArena::reset() {
+  offset = 0;
+  for (void* block : overflowBlocks) free(block);
+  overflowBlocks.clear();
+}
+
+void SessionArena::printStats() {
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Session arena: %u / %u B used, high water %u B, %lu overflow allocation(s)\n",
+                    (unsigned)offset, (unsigned)size, (unsigned)peak, (unsigned long)overflowCount);
+  consoleOut.flush();
+}
+
+void endSessionData() {
+  sessionArena.reset();
+}
@@ -0,0 +1,471 @@
+#include "telemetry_log.h"
+#include "dis_snapshot.h"
+#include "output.h"
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <LittleFS.h>
+#define LOG_ROOT "/tlog"
+#else
+#include <cstdio>
+#include <sys/stat.h>
+#define LOG_ROOT "tlog"
+#endif
+
+TelemetryLog telemetryLog;
+
+// Thin file wrapper: LittleFS on the station, stdio on native builds
+class LogFile {
+public:
+  bool open(const char* path, const char* mode) {
+#ifdef ARDUINO
+    file = LittleFS.open(path, mode);
+    return (bool)file;
+#else
+    file = fopen(path, *mode == 'a' ? "ab+" : (*mode == 'w' ? "wb" : "rb"));
+    return file != nullptr;
+#endif
+  }
+  size_t write(const uint8_t* data, size_t length) {
+#ifdef ARDUINO
+    return file.write(data, length);
+#else
+    return fwrite(data, 1, length, file);
+#endif
+  }
+  size_t read(uint8_t* data, size_t length) {
+#ifdef ARDUINO
+    return file.read(data, length);
+#else
+    return fread(data, 1, length, file);
+#endif
+  }
+  bool seek(uint32_t position) {
+#ifdef ARDUINO
+    return file.seek(position);
+#else
+    return fseek(file, position, SEEK_SET) == 0;
+#endif
+  }
+  uint32_t size() {
+#ifdef ARDUINO
+    return file.size();
+#else
+    long position = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    fseek(file, position, SEEK_SET);
+    return end;
+#endif
+  }
+  void flush() {
+#ifdef ARDUINO
+    file.flush();
+#else
+    fflush(file);
+#endif
+  }
+  void close() {
+#ifdef ARDUINO
+    file.close();
+#else
+    if (file) fclose(file);
+    file = nullptr;
+#endif
+  }
+
+private:
+#ifdef ARDUINO
+  File file;
+#else
+  FILE* file = nullptr;
+#endif
+};
+
+static LogFile activeFile;
+
+static void segmentPath(char* path, size_t size, uint8_t segment) {
+  snprintf(path, size, LOG_ROOT "/seg%u", (unsigned)segment);
+}
+
+static void removeFile(const char* path) {
+#ifdef ARDUINO
+  LittleFS.remove(path);
+#else
+  ::remove(path);
+#endif
+}
+
+static void renameFile(const char* from, const char* to) {
+#ifdef ARDUINO
+  LittleFS.rename(from, to);
+#else
+  ::rename(from, to);
+#endif
+}
+
+static uint64_t addressKey(const uint8_t address[6]) {
+  uint64_t key = 0;
+  for (int i = 0; i < 6; i++) key = (key << 8) | address[i];
+  return key;
+}
+
+bool parseAddress(const std::string& text, uint8_t out[6]) {
+  unsigned bytes[6];
+  if (sscanf(text.c_str(), "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3],
+             &bytes[4], &bytes[5]) != 6) {
+    return false;
+  }
+  for (int i = 0; i < 6; i++) out[i] = bytes[i];
+  return true;
+}
+
+static uint32_t recordChecksum(LogRecordHeader header, const uint8_t* payload) {
+  header.checksum = 0;
+  return fnv1a(payload, header.length, fnv1a(&header, sizeof(header)));
+}
+
+// Reads the record at the file's current position; false at the end of valid data
+static bool readRecord(LogFile& file, LogRecordHeader& header, uint8_t* payload) {
+  if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header)) return false;
+  if (header.magic != LOG_RECORD_MAGIC) return false;
+  if (file.read(payload, header.length) != header.length) return false;
+  return recordChecksum(header, payload) == header.checksum;
+}
+
+// Sequence of a segment's first record; UINT32_MAX when it is missing or empty
+static uint32_t segmentFirstSequence(uint8_t segment, uint8_t* payload) {
+  char path[24];
+  segmentPath(path, sizeof(path), segment);
+  LogFile file;
+  LogRecordHeader header;
+  uint32_t sequence = UINT32_MAX;
+  if (file.open(path, "r")) {
+    if (readRecord(file, header, payload)) sequence = header.sequence;
+    file.close();
+  }
+  return sequence;
+}
+
+bool TelemetryLog::begin() {
+#ifdef ARDUINO
+  if (!LittleFS.begin(true)) {
+    Serial.println("Telemetry log: LittleFS mount failed, logging disabled");
+    return false;
+  }
+  LittleFS.mkdir(LOG_ROOT);
+#else
+  mkdir(LOG_ROOT, 0755);
+#endif
+
+  // Boot counter orders records from different power cycles
+  LogFile bootFile;
+  if (bootFile.open(LOG_ROOT "/boot", "r")) {
+    bootFile.read(reinterpret_cast<uint8_t*>(&boot), sizeof(boot));
+    bootFile.close();
+  }
+  boot++;
+  if (bootFile.open(LOG_ROOT "/boot", "w")) {
+    bootFile.write(reinterpret_cast<const uint8_t*>(&boot), sizeof(boot));
+    bootFile.close();
+  }
+
+  rebuildIndex();
+  mounted = true;
+  return true;
+}
+
+void TelemetryLog::indexRecord(const LogRecordHeader& header, uint8_t segment, uint32_t offset,
+                               const uint8_t* payload) {
+  std::vector<LogIndexEntry>& sessions = index[addressKey(header.address)];
+  if (header.type == LOG_SESSION) {
+    LogIndexEntry entry = {header.sequence, header.boot, header.uptimeMs, segment, offset, 0};
+    sessions.push_back(entry);
+  } else if (header.type == LOG_VERDICT && !sessions.empty() && header.length > 0) {
+    sessions.back().verdict = payload[0] ? 1 : 2;
+  }
+}
+
+void TelemetryLog::rebuildIndex() {
+  static uint8_t payload[LOG_MAX_PAYLOAD];
+  index.clear();
+  nextSequence = 0;
+  activeSegment = 0;
+  activeSize = 0;
+
+  // Segments are scanned oldest first so each device's sessions stay in log order
+  uint32_t firstSequence[LOG_SEGMENTS];
+  uint8_t order[LOG_SEGMENTS];
+  for (uint8_t s = 0; s < LOG_SEGMENTS; s++) {
+    order[s] = s;
+    firstSequence[s] = segmentFirstSequence(s, payload);
+  }
+  std::sort(order, order + LOG_SEGMENTS,
+            [&](uint8_t a, uint8_t b) { return firstSequence[a] < firstSequence[b]; });
+
+  for (uint8_t n = 0; n < LOG_SEGMENTS; n++) {
+    uint8_t s = order[n];
+    if (firstSequence[s] == UINT32_MAX) continue;
+    char path[24];
+    segmentPath(path, sizeof(path), s);
+    LogFile file;
+    if (!file.open(path, "r")) continue;
+
+    uint32_t offset = 0;
+    LogRecordHeader header;
+    while (readRecord(file, header, payload)) {
+      indexRecord(header, s, offset, payload);
+      nextSequence = std::max(nextSequence, header.sequence + 1);
+      offset += sizeof(header) + header.length;
+    }
+    file.close();
+    activeSegment = s;
+    activeSize = offset;
+  }
+
+  // A torn record at the end of the newest segment is left behind: continue in a fresh one
+  char path[24];
+  segmentPath(path, sizeof(path), activeSegment);
+  LogFile check;
+  uint32_t fileSize = 0;
+  if (check.open(path, "r")) {
+    fileSize = check.size();
+    check.close();
+  }
+  if (fileSize != activeSize) {
+    openSegment((activeSegment + 1) % LOG_SEGMENTS, true);
+  } else {
+    openSegment(activeSegment, false);
+  }
+}
+
+void TelemetryLog::openSegment(uint8_t segment, bool recycle) {
+  activeFile.close();
+  char path[24];
+  segmentPath(path, sizeof(path), segment);
+  if (recycle) {
+    removeFile(path);
+    activeSize = 0;
+    // Forget the sessions that lived in the recycled segment
+    for (auto& item : index) {
+      std::vector<LogIndexEntry>& sessions = item.second;
+      sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                    [segment](const LogIndexEntry& e) { return e.segment == segment; }),
+                     sessions.end());
+    }
+  }
+  activeSegment = segment;
+  activeFile.open(path, "a");
+}
+
+void TelemetryLog::append(uint8_t type, const void* payload, size_t length) {
+  if (!mounted) return;
+  length = std::min<size_t>(length, LOG_MAX_PAYLOAD);
+  if (pendingLength + sizeof(LogRecordHeader) + length > LOG_PENDING_BYTES) {
+    dropped++;
+    return;
+  }
+
+  LogRecordHeader header;
+  header.magic = LOG_RECORD_MAGIC;
+  header.type = type;
+  header.length = length;
+  header.sequence = nextSequence++;
+  header.boot = boot;
+  header.uptimeMs = millis();
+  memcpy(header.address, sessionAddress, sizeof(header.address));
+  header.checksum = recordChecksum(header, static_cast<const uint8_t*>(payload));
+
+  memcpy(pending + pendingLength, &header, sizeof(header));
+  memcpy(pending + pendingLength + sizeof(header), payload, length);
+  pendingLength += sizeof(header) + length;
+}
+
+void TelemetryLog::beginSession(const std::string& address) {
+  if (!parseAddress(address, sessionAddress)) memset(sessionAddress, 0, sizeof(sessionAddress));
+  append(LOG_SESSION, nullptr, 0);
+}
+
+void TelemetryLog::logValue(BLEUUID uuid, const std::string& raw) {
+  uint8_t payload[LOG_MAX_PAYLOAD];
+  std::string uuidText = uuid.toString();
+  uint32_t uuidHash = fnv1a(uuidText.data(), uuidText.size());
+  size_t length = std::min(raw.size(), sizeof(payload) - sizeof(uuidHash));
+  memcpy(payload, &uuidHash, sizeof(uuidHash));
+  memcpy(payload + sizeof(uuidHash), raw.data(), length);
+  append(LOG_VALUE, payload, sizeof(uuidHash) + length);
+}
+
+void TelemetryLog::logControl(const ControlResult& result) {
+  uint8_t payload[6 + 16];
+  payload[0] = result.outcome;
+  payload[1] = result.attempts;
+  memcpy(payload + 2, &result.latencyUs, sizeof(result.latencyUs));
+  size_t nameLength = std::min<size_t>(strlen(result.name), 16);
+  memcpy(payload + 6, result.name, nameLength);
+  append(LOG_CONTROL, payload, 6 + nameLength);
+}
+
+void TelemetryLog::logVerdict(const SessionVerdict& verdict, uint32_t configHash) {
+  uint8_t payload[9];
+  payload[0] = verdict.pass;
+  memcpy(payload + 1, &verdict.checked, 2);
+  memcpy(payload + 3, &verdict.failed, 2);
+  memcpy(payload + 5, &configHash, 4);
+  append(LOG_VERDICT, payload, sizeof(payload));
+}
+
+bool TelemetryLog::writeRecord(const uint8_t* record, size_t length) {
+  if (activeSize + length > LOG_SEGMENT_BYTES) {
+    activeFile.flush();
+    openSegment((activeSegment + 1) % LOG_SEGMENTS, true);
+  }
+  if (activeFile.write(record, length) != length) return false;
+
+  const LogRecordHeader* header = reinterpret_cast<const LogRecordHeader*>(record);
+  indexRecord(*header, activeSegment, activeSize, record + sizeof(LogRecordHeader));
+  activeSize += length;
+  return true;
+}
+
+void TelemetryLog::service() {
+  if (!mounted || pendingLength == 0) return;
+
+  // Whole records only, up to one slice per call
+  size_t written = 0;
+  while (written < pendingLength && written < LOG_SLICE_BYTES) {
+    LogRecordHeader header;
+    memcpy(&header, pending + written, sizeof(header));
+    size_t length = sizeof(header) + header.length;
+    if (!writeRecord(pending + written, length)) break;
+    written += length;
+  }
+  activeFile.flush();
+
+  memmove(pending, pending + written, pendingLength - written);
+  pendingLength -= written;
+}
+
+void TelemetryLog::flushAll() {
+  while (mounted && pendingLength) {
+    size_t before = pendingLength;
+    service();
+    if (pendingLength == before) break;
+  }
+}
+
+void TelemetryLog::compact(size_t keepPerDevice) {
+  static uint8_t payload[LOG_MAX_PAYLOAD];
+  flushAll();
+  activeFile.close();
+
+  // Sessions whose value records survive: the newest `keepPerDevice` of each device
+  std::map<uint64_t, uint32_t> keepFrom;
+  for (auto& item : index) {
+    const std::vector<LogIndexEntry>& sessions = item.second;
+    keepFrom[item.first] = sessions.size() > keepPerDevice
+                             ? sessions[sessions.size() - keepPerDevice].sequence
+                             : 0;
+  }
+
+  uint32_t before = 0, after = 0;
+  for (uint8_t s = 0; s < LOG_SEGMENTS; s++) {
+    char path[24], tmpPath[28];
+    segmentPath(path, sizeof(path), s);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    LogFile in, out;
+    if (!in.open(path, "r")) continue;
+    if (!out.open(tmpPath, "w")) {
+      in.close();
+      continue;
+    }
+
+    LogRecordHeader header;
+    while (readRecord(in, header, payload)) {
+      before += sizeof(header) + header.length;
+      if (header.type == LOG_VALUE && header.sequence < keepFrom[addressKey(header.address)]) continue;
+      out.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+      out.write(payload, header.length);
+      after += sizeof(header) + header.length;
+    }
+    in.close();
+    out.close();
+    removeFile(path);
+    renameFile(tmpPath, path);
+  }
+
+  rebuildIndex();
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Telemetry log compacted: %lu -> %lu bytes\n", (unsigned long)before, (unsigned long)after);
+  consoleOut.flush();
+}
+
+void TelemetryLog::printSessions(const std::string& address) {
+  uint8_t bytes[6];
+  if (!parseAddress(address, bytes)) {
+    consoleOut.begin(OUT_QUIET);
+    consoleOut.print("Telemetry log: bad address\n");
+    consoleOut.flush();
+    return;
+  }
+  auto found = index.find(addressKey(bytes));
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Sessions for %s:\n", address.c_str());
+  if (found != index.end()) {
+    static const char* verdictText[] = {"?", "PASS", "FAIL"};
+    for (const LogIndexEntry& entry : found->second) {
+      consoleOut.printf("  seq=%lu boot=%u t=%lus %s\n", (unsigned long)entry.sequence, (unsigned)entry.boot,
+                        (unsigned long)(entry.uptimeMs / 1000), verdictText[entry.verdict]);
+    }
+  }
+  consoleOut.flush();
+}
+
+void TelemetryLog::dump(uint32_t fromSequence) {
+  static uint8_t payload[LOG_MAX_PAYLOAD];
+  flushAll();
+  activeFile.flush();
+
+  // Segments are recycled round robin, so the log reads in order from the oldest one on
+  uint8_t oldest = 0;
+  uint32_t oldestSequence = UINT32_MAX;
+  for (uint8_t s = 0; s < LOG_SEGMENTS; s++) {
+    uint32_t first = segmentFirstSequence(s, payload);
+    if (first < oldestSequence) {
+      oldest = s;
+      oldestSequence = first;
+    }
+  }
+
+  for (uint8_t n = 0; n < LOG_SEGMENTS; n++) {
+    uint8_t s = (oldest + n) % LOG_SEGMENTS;
+    char path[24];
+    segmentPath(path, sizeof(path), s);
+    LogFile file;
+    if (!file.open(path, "r")) continue;
+    LogRecordHeader header;
+    while (readRecord(file, header, payload)) {
+      if (header.sequence < fromSequence) continue;
+      consoleOut.begin(OUT_QUIET);
+      consoleOut.print("LOG ");
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&header);
+      for (size_t i = 0; i < sizeof(header); i++) consoleOut.printf("%02x", bytes[i]);
+      for (size_t i = 0; i < header.length; i++) consoleOut.printf("%02x", payload[i]);
+      consoleOut.print("\n");
+      consoleOut.flush();
+    }
+    file.close();
+  }
+}
+
+void TelemetryLog::printStats() {
+  size_t sessions = 0;
+  for (auto& item : index) sessions += item.second.size();
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Telemetry log: boot %u, next seq %lu, %u device(s), %u session(s), segment %u at %lu bytes, "
+                    "%u pending, %lu dropped\n",
+                    (unsigned)boot, (unsigned long)nextSequence, (unsigned)index.size(), (unsigned)sessions,
+                    (unsigned)activeSegment, (unsigned long)activeSize, (unsigned)pendingLength,
+                    (unsigned long)dropped);
+  consoleOut.flush();
+}
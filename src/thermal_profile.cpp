@@ -0,0 +1,247 @@
+#include "thermal_profile.h"
+#include "decode.h"
+#include "gatt_worker.h"
+#include "output.h"
+#include "uuids.h"
+
+ThermalProfile thermalProfile;
+
+void ThermalSeries::reset(const char* seriesName, uint32_t start) {
+  snprintf(name, sizeof(name), "%s", seriesName);
+  used = 0;
+  widthMs = THERMAL_BUCKET_MS;
+  startMs = start;
+}
+
+void ThermalSeries::compact() {
+  // Merge neighbouring pairs and double the bucket width
+  uint16_t merged = 0;
+  for (uint16_t i = 0; i < used; i += 2) {
+    ThermalBucket bucket = buckets[i];
+    if (i + 1 < used) {
+      const ThermalBucket& next = buckets[i + 1];
+      bucket.min = std::min(bucket.min, next.min);
+      bucket.max = std::max(bucket.max, next.max);
+      bucket.sum += next.sum;
+      bucket.count += next.count;
+    }
+    buckets[merged++] = bucket;
+  }
+  used = merged;
+  widthMs *= 2;
+  // Realign bucket starts to the new width
+  for (uint16_t i = 0; i < used; i++) {
+    buckets[i].startMs = startMs + i * widthMs;
+  }
+}
+
+void ThermalSeries::add(uint32_t timeMs, float value) {
+  uint32_t index = (timeMs - startMs) / widthMs;
+  while (index >= THERMAL_BUCKETS) {
+    compact();
+    index = (timeMs - startMs) / widthMs;
+  }
+
+  // Open empty buckets up to the sample's slot (gaps keep count == 0)
+  while (used <= index) {
+    ThermalBucket& bucket = buckets[used];
+    bucket.startMs = startMs + used * widthMs;
+    bucket.min = bucket.max = bucket.sum = 0;
+    bucket.count = 0;
+    used++;
+  }
+
+  ThermalBucket& bucket = buckets[index];
+  if (bucket.count == 0 || value < bucket.min) bucket.min = value;
+  if (bucket.count == 0 || value > bucket.max) bucket.max = value;
+  bucket.sum += value;
+  bucket.count++;
+}
+
+size_t lttbSelect(const float* x, const float* y, size_t count, size_t threshold, uint16_t* selected) {
+  if (threshold >= count || threshold < 3) {
+    size_t n = std::min(count, threshold < 3 ? count : threshold);
+    for (size_t i = 0; i < n; i++) selected[i] = i;
+    return n;
+  }
+
+  size_t out = 0;
+  selected[out++] = 0;
+  double every = (double)(count - 2) / (threshold - 2);
+  size_t a = 0;
+
+  for (size_t i = 0; i < threshold - 2; i++) {
+    // Average of the next bucket is the third triangle vertex
+    size_t avgStart = (size_t)((i + 1) * every) + 1;
+    size_t avgEnd = std::min((size_t)((i + 2) * every) + 1, count);
+    double avgX = 0, avgY = 0;
+    for (size_t j = avgStart; j < avgEnd; j++) {
+      avgX += x[j];
+      avgY += y[j];
+    }
+    size_t avgLen = avgEnd > avgStart ? avgEnd - avgStart : 1;
+    avgX /= avgLen;
+    avgY /= avgLen;
+
+    // Pick the point in this bucket forming the largest triangle with a and the average
+    size_t rangeStart = (size_t)(i * every) + 1;
+    size_t rangeEnd = (size_t)((i + 1) * every) + 1;
+    double maxArea = -1;
+    size_t chosen = rangeStart;
+    for (size_t j = rangeStart; j < rangeEnd; j++) {
+      double area = fabs((x[a] - avgX) * (y[j] - y[a]) - (x[a] - x[j]) * (avgY - y[a]));
+      if (area > maxArea) {
+        maxArea = area;
+        chosen = j;
+      }
+    }
+    selected[out++] = chosen;
+    a = chosen;
+  }
+
+  selected[out++] = count - 1;
+  return out;
+}
+
+bool ThermalProfile::start(BLEClient* client) {
+  channelCount = 0;
+  startMs = millis();
+  lastPollMs = startMs;
+
+  BLERemoteService* temperature = client->getService(TEMP_UUID);
+  if (!temperature) {
+    gattWorker.print(OUT_QUIET, "Thermal profile: Temperature Service not found\n");
+    return false;
+  }
+
+  for (auto& chr : *temperature->getCharacteristics()) {
+    if (channelCount >= THERMAL_CHANNELS) break;
+    BLERemoteCharacteristic* pChar = chr.second;
+    if (!pChar->canNotify() && !pChar->canRead()) continue;
+
+    Source& source = sources[channelCount];
+    source.characteristic = pChar;
+    source.polled = !pChar->canNotify();
+    uint16_t unitUUID;
+    source.haveCpf = readCpf(pChar, source.format, source.exponent, unitUUID);
+    series[channelCount].reset(getUuidName(pChar->getUUID()).c_str(), startMs);
+    channelCount++;
+  }
+
+  if (channelCount == 0) {
+    gattWorker.print(OUT_QUIET, "Thermal profile: no readable temperature characteristics\n");
+    return false;
+  }
+
+  gattWorker.print(OUT_QUIET, "Thermal profile: %u channel(s) for up to %lu min. Type 'report' or 'stop'.\n",
+                   channelCount, THERMAL_DURATION_MS / 60000UL);
+  running = true;
+  // Last, so the first notification finds every channel in place
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (sources[i].polled) continue;
+    notifyDispatcher.subscribe(sources[i].characteristic,
+                               [this](BLERemoteCharacteristic* c, const NotifyEvent& event) { onNotify(c, event); });
+  }
+  return true;
+}
+
+bool ThermalProfile::decodeSample(const Source& source, const std::string& raw, float& value) {
+  if (source.haveCpf) {
+    DecimalValue decoded;
+    // An IEEE-11073 NaN or INF is no sample
+    if (!decodeDecimal(raw, source.format, source.exponent, decoded) || !decoded.finite()) return false;
+    value = decimalToFloat(decoded);
+  } else {
+    // No CPF descriptor: the vendor service reports sint16 in hundredths of a degree
+    if (raw.size() < 2) return false;
+    value = (int16_t)((uint8_t)raw[0] | ((uint8_t)raw[1] << 8)) / 100.0f;
+  }
+  return true;
+}
+
+void ThermalProfile::onNotify(BLERemoteCharacteristic* pChar, const NotifyEvent& event) {
+  if (!running) return;
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (sources[i].characteristic != pChar) continue;
+    float value;
+    if (decodeSample(sources[i], std::string(reinterpret_cast<const char*>(event.data), event.length), value)) {
+      // Time the sample by when it arrived, not by when loop() got to it
+      uint32_t now = millis() - (micros() - event.stampUs) / 1000;
+      // Received before this capture started: it belongs to an earlier one
+      if ((int32_t)(now - startMs) < 0) return;
+      series[i].add(now, value);
+    }
+    return;
+  }
+}
+
+void ThermalProfile::update(bool connected) {
+  if (!running) return;
+  if (!connected) {
+    consoleOut.begin(OUT_QUIET);
+    consoleOut.print("Thermal profile: link lost, reporting partial run\n");
+    consoleOut.flush();
+    stop();  // releases the dispatcher slots as well
+    return;
+  }
+
+  uint32_t now = millis();
+  if (now - lastPollMs >= THERMAL_POLL_MS) {
+    lastPollMs = now;
+    for (uint8_t i = 0; i < channelCount; i++) {
+      if (!sources[i].polled) continue;
+      float value;
+      if (decodeSample(sources[i], sources[i].characteristic->readValue(), value)) {
+        series[i].add(now, value);
+      }
+    }
+  }
+
+  if (now - startMs >= THERMAL_DURATION_MS) stop();
+}
+
+void ThermalProfile::stop() {
+  if (!running) return;
+  running = false;
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (!sources[i].polled) notifyDispatcher.unsubscribe(sources[i].characteristic);
+  }
+  printSeries();
+}
+
+void ThermalProfile::printSeries() {
+  static float x[THERMAL_BUCKETS];
+  static float y[THERMAL_BUCKETS];
+  static ThermalBucket filled[THERMAL_BUCKETS];
+  uint16_t selected[THERMAL_OUTPUT_POINTS];
+
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("\nThermal profile at %lus (t_s,mean,min,max):\n",
+                    (unsigned long)((millis() - startMs) / 1000));
+
+  for (uint8_t c = 0; c < channelCount; c++) {
+    // Copy out the non-empty buckets, then downsample
+    uint16_t n = 0;
+    uint32_t widthMs;
+    widthMs = series[c].widthMs;
+    for (uint16_t i = 0; i < series[c].used; i++) {
+      if (series[c].buckets[i].count) filled[n++] = series[c].buckets[i];
+    }
+
+    for (uint16_t i = 0; i < n; i++) {
+      x[i] = (filled[i].startMs - startMs) / 1000.0f;
+      y[i] = filled[i].sum / filled[i].count;
+    }
+    size_t points = lttbSelect(x, y, n, THERMAL_OUTPUT_POINTS, selected);
+
+    consoleOut.printf("  %s (bucket %lus, %u pts):", series[c].name, (unsigned long)(widthMs / 1000),
+                      (unsigned)points);
+    for (size_t i = 0; i < points; i++) {
+      const ThermalBucket& bucket = filled[selected[i]];
+      consoleOut.printf(" %lu,%s,%s,%s", (unsigned long)x[selected[i]], String(y[selected[i]], 1).c_str(),
+                        String(bucket.min, 1).c_str(), String(bucket.max, 1).c_str());
+    }
+    consoleOut.print("\n");
+  }
+  consoleOut.flush();
+}
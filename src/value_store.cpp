@@ -0,0 +1,100 @@
+#include "value_store.h"
+#include "dis_snapshot.h"
+#include "output.h"
+#include "telemetry_log.h"
+
+ValueStore valueStore;
+
+// Only the bytes the UUID actually uses; the rest of the native union is not always cleared
+static uint32_t uuidHash(BLEUUID& uuid) {
+  esp_bt_uuid_t* native = uuid.getNative();
+  return fnv1a(&native->uuid, native->len, fnv1a(&native->len, sizeof(native->len)));
+}
+
+void ValueStore::beginSweep(const std::string& address) {
+  uint8_t key[6];
+  if (!parseAddress(address, key)) {
+    current = nullptr;
+    return;
+  }
+
+  Device* oldest = &devices[0];
+  current = nullptr;
+  for (Device& device : devices) {
+    if (device.lastSweep && memcmp(device.address, key, 6) == 0) {
+      current = &device;
+      break;
+    }
+    if (device.lastSweep < oldest->lastSweep) oldest = &device;
+  }
+  if (!current) {
+    current = oldest;
+    memcpy(current->address, key, 6);
+    current->sweeps = 0;
+    current->slotCount = 0;
+  }
+  current->sweeps++;
+  current->lastSweep = ++sweepClock;
+  sweepNew = 0;
+  sweepChanged = 0;
+  sweepUnchanged = 0;
+}
+
+ValueChange ValueStore::note(BLEUUID uuid, uint16_t handle, const std::string& raw) {
+  // Outside a sweep every value is news
+  if (!current) return VALUE_NEW;
+  valuesNoted++;
+  uint32_t key = uuidHash(uuid);
+  uint32_t hash = fnv1a(raw.data(), raw.size());
+
+  for (uint8_t i = 0; i < current->slotCount; i++) {
+    Slot& slot = current->slots[i];
+    if (slot.handle != handle || slot.uuidHash != key) continue;
+    if (slot.valueHash == hash) {
+      sweepUnchanged++;
+      valuesUnchanged++;
+      return VALUE_UNCHANGED;
+    }
+    slot.valueHash = hash;
+    sweepChanged++;
+    return VALUE_CHANGED;
+  }
+
+  if (current->slotCount < VALUE_STORE_SLOTS) {
+    current->slots[current->slotCount++] = {key, hash, handle};
+  } else {
+    slotsFull++;
+  }
+  sweepNew++;
+  return VALUE_NEW;
+}
+
+void ValueStore::endSweep() {
+  if (!current) return;
+  // The first sweep of a device has nothing to compare against
+  if (current->sweeps > 1 && consoleOut.begin(OUT_NORMAL)) {
+    const uint8_t* a = current->address;
+    consoleOut.printf("Sweep %lu of %02x:%02x:%02x:%02x:%02x:%02x: %u changed, %u new, %u unchanged\n",
+                      (unsigned long)current->sweeps, a[0], a[1], a[2], a[3], a[4], a[5], sweepChanged,
+                      sweepNew, sweepUnchanged);
+    consoleOut.flush();
+  }
+  current = nullptr;
+}
+
+void ValueStore::clear() {
+  for (Device& device : devices) device.lastSweep = 0;
+  current = nullptr;
+}
+
+void ValueStore::printStats() {
+  size_t stored = 0;
+  for (Device& device : devices) {
+    if (device.lastSweep) stored++;
+  }
+  consoleOut.begin(OUT_QUIET);
+  consoleOut.printf("Values: delta-only %s, %u/%u device(s), %lu noted, %lu unchanged, %lu without a slot\n",
+                    delta ? "on" : "off", (unsigned)stored, (unsigned)VALUE_STORE_DEVICES,
+                    (unsigned long)valuesNoted, (unsigned long)valuesUnchanged, (unsigned long)slotsFull);
+  consoleOut.flush();
+}